@@ -0,0 +1,165 @@
+/** @file tsip_batch.h
+ * \brief Header containing the batch packet output.
+ * The packets decoded within a tick are collected into a preallocated arena,
+ * and handed over to the caller as a whole once the tick is over
+*/
+#ifndef TSIP_BATCH_H
+#define TSIP_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * \brief Default packet data size of the batch arena.
+ */
+#define BATCH_ARENA_SIZE (64 << 10)
+/**
+ * \brief Default maximum number of packets in a batch.
+ */
+#define BATCH_MAX_PACKETS 1024
+
+/**
+ * \brief View of a packet within the batch arena.
+ */
+struct packet_view {
+  uint32_t offset;
+  uint16_t len;
+  uint8_t id1;
+  uint8_t id2;
+  uint8_t status;
+};
+
+struct packet_batch;
+
+/**
+ * \brief Batch flush handler, called when the arena fills up within a tick.
+ */
+typedef void (*batch_flush_fn)(const struct packet_batch *batch, void *user);
+
+/**
+ * \brief Batch of packets, with the packet data stored in an arena.
+ */
+struct packet_batch {
+  uint8_t *data;
+  uint32_t data_len;
+  uint32_t data_size;
+  struct packet_view *view;
+  uint32_t count;
+  uint32_t size;
+  uint32_t overflow;
+  bool keep_invalid;
+  batch_flush_fn flush;
+  void *user;
+};
+
+/**
+* \brief Allocate the batch arena.
+*
+* \param batch 		Pointer to the batch.
+* \param data_size 	Size of the packet data arena.
+* \param size 		Maximum number of packets.
+* \return 			True if the arena was allocated, false if either size is
+* 0.
+*/
+bool batch_init(struct packet_batch *batch, uint32_t data_size,
+                uint32_t size) {
+  memset(batch, 0, sizeof(*batch));
+  if (data_size == 0 || size == 0)
+    return false;
+  batch->data = (uint8_t *)malloc(data_size);
+  batch->view = (struct packet_view *)malloc(size * sizeof(struct packet_view));
+  if (batch->data == NULL || batch->view == NULL) {
+    free(batch->data);
+    free(batch->view);
+    batch->data = NULL;
+    batch->view = NULL;
+    return false;
+  }
+  batch->data_size = data_size;
+  batch->size = size;
+  return true;
+}
+
+/**
+* \brief Release the batch arena.
+*
+* \param batch Pointer to the batch.
+* \return
+*/
+void batch_free(struct packet_batch *batch) {
+  free(batch->data);
+  free(batch->view);
+  batch->data = NULL;
+  batch->view = NULL;
+  batch->data_size = 0;
+  batch->size = 0;
+}
+
+/**
+* \brief Empty the batch, keeping the arena.
+*
+* \param batch Pointer to the batch.
+* \return
+*/
+void batch_reset(struct packet_batch *batch) {
+  batch->data_len = 0;
+  batch->count = 0;
+  batch->overflow = 0;
+}
+
+/**
+* \brief Add a packet to the batch.
+*
+* Copies the packet into the arena. If the arena is full, the batch is handed
+* to the flush handler and emptied, or the packet is dropped and counted if
+* there's no handler. A packet that doesn't fit even the empty arena is
+* dropped and counted as well.
+*
+* \param batch 	Pointer to the batch.
+* \param buffer 	Pointer to the packet, starting with the IDs.
+* \param len 		Packet size, checksum excluded.
+* \param status 	Packet validation result.
+* \return 			True if the packet was added.
+*/
+bool batch_append(struct packet_batch *batch, const uint8_t *buffer,
+                  uint32_t len, uint8_t status) {
+  if (status != 0 && !batch->keep_invalid)
+    return false;
+  if (batch->count == batch->size || batch->data_len + len > batch->data_size) {
+    if (batch->flush == NULL) {
+      batch->overflow++;
+      return false;
+    }
+    batch->flush(batch, batch->user);
+    batch->data_len = 0;
+    batch->count = 0;
+    if (batch->size == 0 || len > batch->data_size) {
+      batch->overflow++;
+      return false;
+    }
+  }
+  struct packet_view *v = &batch->view[batch->count++];
+  v->offset = batch->data_len;
+  v->len = len;
+  v->id1 = buffer[0];
+  v->id2 = len > 1 ? buffer[1] : 0;
+  v->status = status;
+  memcpy(batch->data + batch->data_len, buffer, len);
+  batch->data_len += len;
+  return true;
+}
+
+/**
+* \brief Get the data of a batch packet.
+*
+* \param batch 	Pointer to the batch.
+* \param i 		Packet index.
+* \return 		Pointer to the packet, starting with the IDs.
+*/
+const uint8_t *batch_packet(const struct packet_batch *batch, uint32_t i) {
+  return batch->data + batch->view[i].offset;
+}
+
+#endif
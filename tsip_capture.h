@@ -0,0 +1,464 @@
+/** @file tsip_capture.h
+ * \brief Header containing the capture file format.
+ * Records the raw link data in timestamped chunks along with a sparse index
+ * of the packet starts, and replays it as a decoder input source
+*/
+#ifndef TSIP_CAPTURE_H
+#define TSIP_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsip_decode.h"
+
+/**
+ * \brief Capture file magic.
+ */
+#define CAPTURE_MAGIC "TSIPCAP1"
+/**
+ * \brief Capture file format version.
+ */
+#define CAPTURE_VERSION 2
+/**
+ * \brief Byte order mark of the capture file header, read back as is on a
+ * host with the byte order of the writer.
+ */
+#define CAPTURE_BYTE_ORDER 0x01020304
+/**
+ * \brief Data bytes between two index entries.
+ */
+#define CAPTURE_INDEX_INTERVAL (64 << 10)
+
+/**
+ * \brief Capture file header.
+ *
+ * The file holds the header, the raw data, the chunk table and the index, in
+ * this order. The tables are 8 byte aligned and stored in the byte order of
+ * the writer, given by byte_order, so they are used straight from a memory
+ * mapping.
+ */
+struct capture_header {
+  char magic[8];
+  uint32_t version;
+  //! CAPTURE_BYTE_ORDER in the byte order of the writer
+  uint32_t byte_order;
+  uint32_t header_size;
+  uint32_t reserved;
+  //! wall clock time the recording started at, in ns since the epoch
+  uint64_t start_ns;
+  uint64_t data_offset;
+  uint64_t data_len;
+  uint64_t chunk_offset;
+  uint64_t chunk_count;
+  uint64_t index_offset;
+  uint64_t index_count;
+};
+
+/**
+ * \brief Chunk of data received at once. A chunk ends where the next one
+ * starts.
+ */
+struct capture_chunk {
+  //! arrival time since the recording start
+  uint64_t t_ns;
+  uint64_t offset;
+};
+
+/**
+ * \brief Index entry, pointing at the DLE starting a packet.
+ */
+struct capture_index {
+  uint64_t t_ns;
+  uint64_t offset;
+  //! chunk holding the offset
+  uint64_t chunk;
+};
+
+/**
+ * \brief Capture file writer.
+ *
+ * The tables are kept in memory until the file is closed.
+ */
+struct capture_writer {
+  FILE *f;
+  struct capture_header hdr;
+  struct capture_chunk *chunk;
+  uint64_t chunk_size;
+  struct capture_index *index;
+  uint64_t index_size;
+  //! data offset from which the next index entry is looked for
+  uint64_t next_index;
+  //! the data written so far ends on an unpaired DLE
+  bool dle;
+  //! monotonic clock at the recording start, for capture_record()
+  uint64_t clock_ns;
+};
+
+/**
+ * \brief Memory mapped capture file.
+ */
+struct capture {
+  struct tsip_source map;
+  const struct capture_header *hdr;
+  const uint8_t *data;
+  const struct capture_chunk *chunk;
+  const struct capture_index *index;
+};
+
+/**
+ * \brief Capture replay state.
+ */
+struct capture_replay {
+  const struct capture *cap;
+  //! replay speed relative to real time, 0 for as fast as possible
+  double speed;
+  //! first chunk that hasn't arrived yet
+  uint64_t chunk;
+  //! replay clock start, and the capture time it stands for
+  uint64_t start_ns;
+  uint64_t t0;
+};
+
+/**
+* \brief Append an entry to a growing table.
+*
+* \param table 	Pointer to the table.
+* \param count 	Number of entries.
+* \param size 	Capacity of the table.
+* \param entry 	Pointer to the entry.
+* \param len 	Size of an entry.
+* \return 		True if the entry was added.
+*/
+bool capture_table_add(void **table, uint64_t count, uint64_t *size,
+                       const void *entry, uint32_t len) {
+  if (count == *size) {
+    uint64_t n = *size ? 2 * *size : 1024;
+    void *t = realloc(*table, n * len);
+    if (t == NULL)
+      return false;
+    *table = t;
+    *size = n;
+  }
+  memcpy((uint8_t *)*table + count * len, entry, len);
+  return true;
+}
+
+/**
+* \brief Create a capture file.
+*
+* \param w 			Pointer to the writer.
+* \param fname 		File name.
+* \param start_ns 	Wall clock time the recording starts at.
+* \return 			True if the file was created.
+*/
+bool capture_create(struct capture_writer *w, const char *fname,
+                    uint64_t start_ns) {
+  memset(w, 0, sizeof(*w));
+  w->f = fopen(fname, "wb");
+  if (w->f == NULL)
+    return false;
+  memcpy(w->hdr.magic, CAPTURE_MAGIC, sizeof(w->hdr.magic));
+  w->hdr.version = CAPTURE_VERSION;
+  w->hdr.byte_order = CAPTURE_BYTE_ORDER;
+  w->hdr.header_size = sizeof(struct capture_header);
+  w->hdr.start_ns = start_ns;
+  w->hdr.data_offset = sizeof(struct capture_header);
+  // the header is rewritten once the tables are known
+  return fwrite(&w->hdr, sizeof(w->hdr), 1, w->f) == 1;
+}
+
+/**
+* \brief Append a chunk of received data.
+*
+* Looks for a packet start past every index interval, following the DLE pairs
+* across the chunks, and indexes it.
+*
+* \param w 		Pointer to the writer.
+* \param data 	Pointer to the data.
+* \param len 	Size of the data.
+* \param t_ns 	Arrival time since the recording start, not decreasing.
+* \return 		True if the chunk was written.
+*/
+bool capture_write(struct capture_writer *w, const uint8_t *data, uint32_t len,
+                   uint64_t t_ns) {
+  if (len == 0)
+    return true;
+  struct capture_chunk c = {t_ns, w->hdr.data_len};
+  if (!capture_table_add((void **)&w->chunk, w->hdr.chunk_count,
+                         &w->chunk_size, &c, sizeof(c)) ||
+      fwrite(data, 1, len, w->f) != len)
+    return false;
+  uint64_t chunk = w->hdr.chunk_count++;
+  uint32_t i = 0;
+  while (i < len) {
+    if (!w->dle) {
+      i = g_dle_scan(data, i, len);
+      if (i < len) {
+        w->dle = true;
+        i++;
+      }
+      continue;
+    }
+    // the byte after an unpaired DLE
+    w->dle = false;
+    uint64_t at = w->hdr.data_len + i - 1;
+    if (data[i] != DLE && data[i] != ETX && at >= w->next_index) {
+      // the DLE may have come with the preceding chunk
+      uint64_t k = at < c.offset ? chunk - 1 : chunk;
+      struct capture_index e = {w->chunk[k].t_ns, at, k};
+      if (!capture_table_add((void **)&w->index, w->hdr.index_count,
+                             &w->index_size, &e, sizeof(e)))
+        return false;
+      w->hdr.index_count++;
+      w->next_index = at + CAPTURE_INDEX_INTERVAL;
+    }
+    i++;
+  }
+  w->hdr.data_len += len;
+  return true;
+}
+
+/**
+* \brief Read a source and record the data with its arrival time.
+*
+* The recording starts with the first call.
+*
+* \param w 			Pointer to the writer.
+* \param src 		Pointer to the source.
+* \param scratch 	Pointer to the source copy buffer.
+* \param count 		Maximum number of bytes to be read.
+* \return 			Number of bytes recorded.
+*/
+uint32_t capture_record(struct capture_writer *w, struct tsip_source *src,
+                        uint8_t *scratch, uint32_t count) {
+  const uint8_t *data;
+  uint32_t len = src->read(src, scratch, &data, count);
+  uint64_t now = decoder_clock_ns();
+  if (w->clock_ns == 0) {
+    // the arrival times are monotonic, only the start is wall clock
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    w->hdr.start_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    w->clock_ns = now;
+  }
+  if (len > 0 && !capture_write(w, data, len, now - w->clock_ns))
+    return 0;
+  return len;
+}
+
+/**
+* \brief Write the tables and the header, and close the capture file.
+*
+* \param w Pointer to the writer.
+* \return 	True if the file was completed.
+*/
+bool capture_finish(struct capture_writer *w) {
+  static const uint8_t pad[8] = {0};
+  bool ok = w->f != NULL;
+  uint64_t end = w->hdr.data_offset + w->hdr.data_len;
+  uint32_t n = (8 - end % 8) % 8;
+  ok = ok && fwrite(pad, 1, n, w->f) == n;
+  w->hdr.chunk_offset = end + n;
+  w->hdr.index_offset =
+      w->hdr.chunk_offset + w->hdr.chunk_count * sizeof(struct capture_chunk);
+  ok = ok && fwrite(w->chunk, sizeof(struct capture_chunk), w->hdr.chunk_count,
+                    w->f) == w->hdr.chunk_count;
+  ok = ok && fwrite(w->index, sizeof(struct capture_index), w->hdr.index_count,
+                    w->f) == w->hdr.index_count;
+  ok = ok && fseek(w->f, 0, SEEK_SET) == 0 &&
+       fwrite(&w->hdr, sizeof(w->hdr), 1, w->f) == 1;
+  if (w->f != NULL)
+    ok = fclose(w->f) == 0 && ok;
+  free(w->chunk);
+  free(w->index);
+  memset(w, 0, sizeof(*w));
+  return ok;
+}
+
+/**
+* \brief Convert a raw data dump into a capture file.
+*
+* The raw dump has no arrival times, so they are made up from the baud rate,
+* as if the data was received in chunks of the given size.
+*
+* \param in 		Raw data file name.
+* \param out 		Capture file name.
+* \param baud 		Baud rate of the link.
+* \param chunk_len 	Size of the chunks.
+* \return 			True if the capture was written.
+*/
+bool capture_convert(const char *in, const char *out, uint32_t baud,
+                     uint32_t chunk_len) {
+  struct tsip_source src;
+  struct capture_writer w;
+  if (baud == 0 || chunk_len == 0 || !source_mmap_open(&src, in))
+    return false;
+  bool ok = capture_create(&w, out, 0);
+  for (uint64_t pos = 0; ok && pos < src.len; pos += chunk_len) {
+    uint32_t len = min((uint64_t)chunk_len, src.len - pos);
+    // 10 bits per byte on the line, the chunk arrives with its last byte
+    uint64_t t = (pos + len) * 10 * 1000000000ull / baud;
+    ok = capture_write(&w, src.data + pos, len, t);
+  }
+  ok = capture_finish(&w) && ok;
+  source_close(&src);
+  return ok;
+}
+
+/**
+* \brief Map a capture file.
+*
+* The header is checked against the file size, so a damaged or crafted header
+* can't point the tables outside of the mapping.
+*
+* \param cap 	Pointer to the capture.
+* \param fname 	File name.
+* \return 		True if the file is a valid capture written with the host byte
+* order.
+*/
+bool capture_open(struct capture *cap, const char *fname) {
+  memset(cap, 0, sizeof(*cap));
+  if (!source_mmap_open(&cap->map, fname))
+    return false;
+  const struct capture_header *h = (const struct capture_header *)cap->map.data;
+  uint64_t len = cap->map.len;
+  // the sections are checked in a form that can't wrap around
+  if (len < sizeof(*h) || memcmp(h->magic, CAPTURE_MAGIC, 8) != 0 ||
+      h->version != CAPTURE_VERSION || h->byte_order != CAPTURE_BYTE_ORDER ||
+      h->data_offset > len || h->data_len > len - h->data_offset ||
+      h->chunk_offset % 8 != 0 || h->chunk_offset > len ||
+      h->chunk_count > (len - h->chunk_offset) / sizeof(struct capture_chunk) ||
+      h->index_offset % 8 != 0 || h->index_offset > len ||
+      h->index_count > (len - h->index_offset) / sizeof(struct capture_index)) {
+    source_close(&cap->map);
+    return false;
+  }
+  cap->hdr = h;
+  cap->data = cap->map.data + h->data_offset;
+  cap->chunk = (const struct capture_chunk *)(cap->map.data + h->chunk_offset);
+  cap->index = (const struct capture_index *)(cap->map.data + h->index_offset);
+  return true;
+}
+
+/**
+* \brief Unmap a capture file.
+*
+* \param cap Pointer to the capture.
+* \return
+*/
+void capture_close(struct capture *cap) {
+  source_close(&cap->map);
+  memset(cap, 0, sizeof(*cap));
+}
+
+/**
+* \brief Capture duration.
+*
+* \param cap Pointer to the capture.
+* \return 	Arrival time of the last chunk.
+*/
+uint64_t capture_duration(const struct capture *cap) {
+  uint64_t n = cap->hdr->chunk_count;
+  return n ? cap->chunk[n - 1].t_ns : 0;
+}
+
+/**
+* \brief Find the last index entry at or before a time.
+*
+* \param cap 	Pointer to the capture.
+* \param t_ns 	Time since the recording start.
+* \return 		Pointer to the entry, NULL if the time is before the first
+* entry.
+*/
+const struct capture_index *capture_index_find(const struct capture *cap,
+                                               uint64_t t_ns) {
+  uint64_t lo = 0, hi = cap->hdr->index_count;
+  // binary search for the first entry past the time
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (cap->index[mid].t_ns <= t_ns)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo ? &cap->index[lo - 1] : NULL;
+}
+
+/**
+* \brief Replay a capture.
+*
+* Hands out the data of the chunks that have arrived by the replay clock,
+* straight from the mapping.
+*
+* \param src 		Pointer to the source.
+* \param scratch 	Unused.
+* \param data 		Pointer to the read data.
+* \param count 		Maximum number of bytes to be read.
+* \return 			Number of read bytes.
+*/
+uint32_t source_capture_read(struct tsip_source *src, uint8_t *scratch,
+                             const uint8_t **data, uint32_t count) {
+  (void)scratch;
+  struct capture_replay *r = (struct capture_replay *)src->ctx;
+  uint64_t end = src->len;
+  if (r->speed > 0) {
+    uint64_t t = r->t0 + (decoder_clock_ns() - r->start_ns) * r->speed;
+    uint64_t n = r->cap->hdr->chunk_count;
+    while (r->chunk < n && r->cap->chunk[r->chunk].t_ns <= t) {
+      r->chunk++;
+    }
+    end = r->chunk < n ? r->cap->chunk[r->chunk].offset : src->len;
+  }
+  uint32_t len = min((uint64_t)count, end - min(end, src->pos));
+  *data = src->data + src->pos;
+  src->pos += len;
+  return len;
+}
+
+/**
+* \brief Set up a source replaying a capture.
+*
+* \param src 	Pointer to the source.
+* \param r 		Pointer to the replay state.
+* \param cap 	Pointer to the capture.
+* \param speed 	Replay speed relative to real time, 0 for as fast as
+* possible.
+* \return
+*/
+void source_capture_init(struct tsip_source *src, struct capture_replay *r,
+                         const struct capture *cap, double speed) {
+  source_mem_init(src, cap->data, cap->hdr->data_len);
+  src->read = source_capture_read;
+  src->ctx = r;
+  r->cap = cap;
+  r->speed = speed;
+  r->chunk = 0;
+  r->start_ns = decoder_clock_ns();
+  r->t0 = 0;
+}
+
+/**
+* \brief Seek a capture replay to a time.
+*
+* Moves the replay to the last indexed packet start at or before the time,
+* found by a binary search of the index, and restarts the replay clock there.
+* The decoder stream state has to be reset after a seek.
+*
+* \param src 	Pointer to the replay source.
+* \param t_ns 	Time since the recording start.
+* \return 		Capture time the replay restarts at.
+*/
+uint64_t capture_seek(struct tsip_source *src, uint64_t t_ns) {
+  struct capture_replay *r = (struct capture_replay *)src->ctx;
+  const struct capture_index *e = capture_index_find(r->cap, t_ns);
+  src->pos = e ? e->offset : 0;
+  r->chunk = e ? e->chunk : 0;
+  r->t0 = e ? e->t_ns : 0;
+  r->start_ns = decoder_clock_ns();
+  return r->t0;
+}
+
+#endif
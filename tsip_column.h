@@ -0,0 +1,693 @@
+/** @file tsip_column.h
+ * \brief Header containing the columnar packet export.
+ * Groups the decoded packets by their IDs and stores every payload field as a
+ * contiguous typed column, written out to a columnar file
+*/
+#ifndef TSIP_COLUMN_H
+#define TSIP_COLUMN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsip_decode.h"
+
+/**
+ * \brief Column file magic.
+ */
+#define COLUMN_MAGIC "TSIPCOL1"
+/**
+ * \brief Column file format version.
+ */
+#define COLUMN_VERSION 2
+/**
+ * \brief Byte order mark of the column file header, read back as is on a host
+ * with the byte order of the writer.
+ */
+#define COLUMN_BYTE_ORDER 0x01020304
+/**
+ * \brief Maximum number of fields of a packet schema.
+ */
+#define COLUMN_MAX_FIELDS 32
+/**
+ * \brief Size of a column name, including the terminator.
+ */
+#define COLUMN_NAME_SIZE 16
+/**
+ * \brief Initial number of rows of a table.
+ */
+#define COLUMN_MIN_ROWS 1024
+/**
+ * \brief Output stream buffer size of the column file.
+ */
+#define COLUMN_OUT_BUFFER (1 << 20)
+
+/**
+ * \brief Column value types.
+ */
+enum column_type { col_u8, col_u16, col_u32, col_u64, col_f32, col_f64 };
+
+/**
+ * \brief Value size of every column type.
+ */
+const uint8_t column_type_size[] = {1, 2, 4, 8, 4, 8};
+
+/**
+ * \brief Payload field of a packet schema.
+ */
+struct column_field {
+  char name[COLUMN_NAME_SIZE];
+  uint8_t type;
+  //! payload offset of the field
+  uint8_t offset;
+};
+
+/**
+ * \brief Payload layout of a packet type.
+ */
+struct column_schema {
+  uint8_t id1;
+  uint8_t id2;
+  uint16_t payload_len;
+  uint8_t field_count;
+  const struct column_field *field;
+};
+
+/**
+ * \brief Fields of the 0xA5 0x09 packet, named after tsip_msg_a509, whose
+ * layout is inferred and not specified.
+ */
+const struct column_field column_fields_a509[] = {
+    {"u32[0]", col_u32, 0},  {"u32[1]", col_u32, 4},  {"f32[0]", col_f32, 8},
+    {"u32[2]", col_u32, 12}, {"u16[0]", col_u16, 16}, {"u16[1]", col_u16, 18},
+    {"u16[2]", col_u16, 20}, {"u8[0]", col_u8, 22},   {"u16[3]", col_u16, 23},
+    {"u16[4]", col_u16, 25}, {"u16[5]", col_u16, 27}, {"f64[0]", col_f64, 29},
+    {"f32[1]", col_f32, 37}, {"u16[6]", col_u16, 41}};
+/**
+ * \brief Fields of the 0xA5 0x0A packet, named after tsip_msg_a50a, whose
+ * layout is inferred and not specified.
+ */
+const struct column_field column_fields_a50a[] = {
+    {"u16[0]", col_u16, 0},  {"u16[1]", col_u16, 2},  {"f32[0]", col_f32, 4},
+    {"u16[2]", col_u16, 8},  {"u16[3]", col_u16, 10}, {"u16[4]", col_u16, 12},
+    {"u16[5]", col_u16, 14}, {"u16[6]", col_u16, 16}};
+/**
+ * \brief Fields of the 0x39 0x02 packet, named after tsip_msg_3902, whose
+ * layout is inferred and not specified.
+ */
+const struct column_field column_fields_3902[] = {{"f64[0]", col_f64, 0}};
+
+/**
+ * \brief Schemas of the packets found in the sample data.
+ */
+const struct column_schema column_builtin[] = {
+    {0xA5, 0x09, 43, 14, column_fields_a509},
+    {0xA5, 0x0A, 18, 8, column_fields_a50a},
+    {0x39, 0x02, 8, 1, column_fields_3902}};
+
+/**
+ * \brief Growing column buffer.
+ */
+struct column_buf {
+  uint8_t *data;
+  uint64_t len;
+  uint64_t size;
+};
+
+/**
+ * \brief Table of the packets with the same IDs.
+ *
+ * Every table has a seq column with the packet sequence numbers across all
+ * tables, so that the tables can be merged back in order. A table with a
+ * schema has a column per field, while a table without one keeps the payload
+ * sizes in a len column and the payloads back to back in a payload column. The
+ * packets that don't fit the schema go to the same len and payload columns of
+ * the schema table, with their sequence numbers in a raw_seq column.
+ */
+struct column_table {
+  uint8_t id1;
+  uint8_t id2;
+  const struct column_schema *schema;
+  //! schema fields ordered by value size, their payload offsets, and the
+  //! number of fields of every size
+  uint8_t order[COLUMN_MAX_FIELDS];
+  uint8_t src[COLUMN_MAX_FIELDS];
+  uint8_t by_size[4];
+  uint64_t rows;
+  //! row capacity of the fixed size columns
+  uint64_t capacity;
+  struct column_buf seq;
+  struct column_buf col[COLUMN_MAX_FIELDS];
+  //! packets that didn't fit the schema, kept in raw_seq, len and payload
+  uint64_t raw_rows;
+  struct column_buf raw_seq;
+  struct column_buf raw[2];
+};
+
+/**
+ * \brief Columnar packet exporter.
+ */
+struct column_export {
+  //! table number + 1 of every ID pair, 0 if it has no table yet
+  uint16_t *slot;
+  struct column_table *table;
+  uint32_t table_count;
+  uint32_t table_size;
+  //! schema of every ID pair, NULL for the raw packets
+  const struct column_schema **schema;
+  //! packets added so far
+  uint64_t packets;
+  //! packets with a schema that didn't fit it, kept as raw packets
+  uint64_t mismatched;
+  bool failed;
+};
+
+/**
+ * \brief Column file header.
+ *
+ * The file holds the header, the columns and the table directory, in this
+ * order. The columns are 8 byte aligned and their values are little-endian, as
+ * on the wire, so they are used straight from a memory mapping on a
+ * little-endian host. The header and the directory are in the byte order of
+ * the writer, given by byte_order.
+ */
+struct column_header {
+  char magic[8];
+  uint32_t version;
+  //! COLUMN_BYTE_ORDER in the byte order of the writer
+  uint32_t byte_order;
+  uint32_t table_count;
+  uint32_t reserved;
+  uint64_t packets;
+  uint64_t dir_offset;
+};
+
+/**
+ * \brief Table directory entry, followed by its column entries.
+ */
+struct column_dir_table {
+  uint8_t id1;
+  uint8_t id2;
+  uint16_t reserved;
+  uint32_t column_count;
+  uint64_t rows;
+};
+
+/**
+ * \brief Column directory entry.
+ */
+struct column_dir_column {
+  char name[COLUMN_NAME_SIZE];
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t offset;
+  //! number of values
+  uint64_t count;
+};
+
+/**
+ * \brief Memory mapped column file.
+ */
+struct column_file {
+  struct tsip_source map;
+  const struct column_header *hdr;
+};
+
+/**
+* \brief Add a packet schema.
+*
+* The packets with the schema IDs are split into the schema fields. Must be
+* called before the first packet with the IDs is added.
+*
+* \param exp 	Pointer to the exporter.
+* \param schema Pointer to the schema, kept.
+* \return 		True if the schema fits.
+*/
+bool column_schema_add(struct column_export *exp,
+                       const struct column_schema *schema) {
+  if (schema->field_count > COLUMN_MAX_FIELDS)
+    return false;
+  for (uint8_t i = 0; i < schema->field_count; i++) {
+    const struct column_field *f = &schema->field[i];
+    if (f->offset + column_type_size[f->type] > schema->payload_len)
+      return false;
+  }
+  exp->schema[schema->id1 << 8 | schema->id2] = schema;
+  return true;
+}
+
+/**
+* \brief Initialize an exporter with the built-in schemas.
+*
+* \param exp Pointer to the exporter.
+* \return 	True if the exporter was allocated.
+*/
+bool column_init(struct column_export *exp) {
+  memset(exp, 0, sizeof(*exp));
+  exp->slot = (uint16_t *)calloc(1 << 16, sizeof(uint16_t));
+  exp->schema = (const struct column_schema **)calloc(
+      1 << 16, sizeof(struct column_schema *));
+  if (exp->slot == NULL || exp->schema == NULL) {
+    free(exp->slot);
+    free(exp->schema);
+    return false;
+  }
+  for (uint8_t i = 0; i < sizeof(column_builtin) / sizeof(column_builtin[0]);
+       i++) {
+    column_schema_add(exp, &column_builtin[i]);
+  }
+  return true;
+}
+
+/**
+* \brief Release the exporter buffers.
+*
+* \param exp Pointer to the exporter.
+* \return
+*/
+void column_free(struct column_export *exp) {
+  for (uint32_t i = 0; i < exp->table_count; i++) {
+    free(exp->table[i].seq.data);
+    free(exp->table[i].raw_seq.data);
+    free(exp->table[i].raw[0].data);
+    free(exp->table[i].raw[1].data);
+    for (uint8_t k = 0; k < COLUMN_MAX_FIELDS; k++) {
+      free(exp->table[i].col[k].data);
+    }
+  }
+  free(exp->table);
+  free(exp->slot);
+  free(exp->schema);
+  memset(exp, 0, sizeof(*exp));
+}
+
+/**
+* \brief Make room in a column buffer.
+*
+* \param buf 	Pointer to the buffer.
+* \param size 	Size needed.
+* \return 		True if the buffer holds the size.
+*/
+bool column_reserve(struct column_buf *buf, uint64_t size) {
+  if (size <= buf->size)
+    return true;
+  uint64_t n = buf->size ? buf->size : COLUMN_MIN_ROWS;
+  while (n < size) {
+    n *= 2;
+  }
+  uint8_t *d = (uint8_t *)realloc(buf->data, n);
+  if (d == NULL)
+    return false;
+  buf->data = d;
+  buf->size = n;
+  return true;
+}
+
+/**
+* \brief Find the table of a packet type, creating it on the first packet.
+*
+* \param exp Pointer to the exporter.
+* \param id1 Packet ID1.
+* \param id2 Packet ID2.
+* \return 	Pointer to the table, NULL if it couldn't be created.
+*/
+struct column_table *column_table_get(struct column_export *exp, uint8_t id1,
+                                      uint8_t id2) {
+  uint16_t key = id1 << 8 | id2;
+  if (exp->slot[key] != 0)
+    return &exp->table[exp->slot[key] - 1];
+  if (exp->table_count == exp->table_size) {
+    uint32_t n = exp->table_size ? 2 * exp->table_size : 16;
+    struct column_table *t =
+        (struct column_table *)realloc(exp->table, n * sizeof(*t));
+    if (t == NULL)
+      return NULL;
+    exp->table = t;
+    exp->table_size = n;
+  }
+  struct column_table *t = &exp->table[exp->table_count++];
+  memset(t, 0, sizeof(*t));
+  t->id1 = id1;
+  t->id2 = id2;
+  t->schema = exp->schema[key];
+  for (uint8_t c = 0, n = 0; t->schema != NULL && c < 4; c++) {
+    uint8_t first = n;
+    for (uint8_t i = 0; i < t->schema->field_count; i++) {
+      if (column_type_size[t->schema->field[i].type] == 1 << c) {
+        t->src[n] = t->schema->field[i].offset;
+        t->order[n++] = i;
+      }
+    }
+    t->by_size[c] = n - first;
+  }
+  exp->slot[key] = exp->table_count;
+  return t;
+}
+
+/**
+* \brief Grow the fixed size columns of a table by a row.
+*
+* \param t Pointer to the table.
+* \return 	True if there's room for the row.
+*/
+bool column_table_grow(struct column_table *t) {
+  if (t->rows < t->capacity)
+    return true;
+  uint64_t n = t->capacity ? 2 * t->capacity : COLUMN_MIN_ROWS;
+  bool ok = column_reserve(&t->seq, n * sizeof(uint64_t));
+  if (t->schema != NULL) {
+    for (uint8_t i = 0; ok && i < t->schema->field_count; i++) {
+      ok = column_reserve(&t->col[i],
+                          n * column_type_size[t->schema->field[i].type]);
+    }
+  } else {
+    ok = ok && column_reserve(&t->col[0], n * sizeof(uint16_t));
+  }
+  if (ok)
+    t->capacity = n;
+  return ok;
+}
+
+/**
+* \brief Store a little-endian value.
+*
+* \param p 		Pointer to the value.
+* \param v 		Value.
+* \param size 	Value size in bytes.
+* \return
+*/
+void column_put(uint8_t *p, uint64_t v, uint8_t size) {
+  for (uint8_t i = 0; i < size; i++) {
+    p[i] = v >> 8 * i;
+  }
+}
+
+/**
+* \brief Append a raw packet to a seq, a len and a payload column.
+*
+* \param seq_col Pointer to the seq column.
+* \param raw 	Pointer to the len and payload columns.
+* \param row 	Row of the packet.
+* \param seq 	Packet sequence number.
+* \param payload Pointer to the payload.
+* \param n 		Payload size.
+* \return 		True if the packet was added.
+*/
+bool column_put_raw(struct column_buf *seq_col, struct column_buf *raw,
+                    uint64_t row, uint64_t seq, const uint8_t *payload,
+                    uint16_t n) {
+  if (!column_reserve(seq_col, (row + 1) * 8) ||
+      !column_reserve(&raw[0], (row + 1) * 2) ||
+      !column_reserve(&raw[1], raw[1].len + n))
+    return false;
+  column_put(seq_col->data + row * 8, seq, 8);
+  column_put(raw[0].data + row * 2, n, 2);
+  memcpy(raw[1].data + raw[1].len, payload, n);
+  raw[1].len += n;
+  return true;
+}
+
+/**
+* \brief Add a packet to its table.
+*
+* Copies every schema field to the end of its column. The fields keep the
+* little-endian byte order of the payload, and the seq and len values are
+* stored little-endian as well. A packet with a payload size other than the
+* one of its schema is kept as a raw packet in the table.
+*
+* \param exp 	Pointer to the exporter.
+* \param buffer Pointer to the packet, starting with the IDs.
+* \param len 	Packet size, checksum excluded.
+* \return 		True if the packet was added.
+*/
+bool column_add(struct column_export *exp, const uint8_t *buffer,
+                uint32_t len) {
+  if (len < 2)
+    return false;
+  uint64_t seq = exp->packets++;
+  const uint8_t *payload = buffer + 2;
+  uint32_t payload_len = len - 2;
+  struct column_table *t = column_table_get(exp, buffer[0], buffer[1]);
+  if (t != NULL && t->schema != NULL && payload_len != t->schema->payload_len) {
+    exp->mismatched++;
+    if (!column_put_raw(&t->raw_seq, t->raw, t->raw_rows, seq, payload,
+                        payload_len)) {
+      exp->failed = true;
+      return false;
+    }
+    t->raw_rows++;
+    return true;
+  }
+  if (t == NULL || !column_table_grow(t)) {
+    exp->failed = true;
+    return false;
+  }
+  uint64_t row = t->rows;
+  const struct column_schema *s = t->schema;
+  if (s != NULL) {
+    // fixed size copies by size class, turned into plain loads and stores
+    uint8_t i = 0, e = 0;
+    for (e += t->by_size[0]; i < e; i++) {
+      t->col[t->order[i]].data[row] = payload[t->src[i]];
+    }
+    for (e += t->by_size[1]; i < e; i++) {
+      memcpy(t->col[t->order[i]].data + row * 2, payload + t->src[i], 2);
+    }
+    for (e += t->by_size[2]; i < e; i++) {
+      memcpy(t->col[t->order[i]].data + row * 4, payload + t->src[i], 4);
+    }
+    for (e += t->by_size[3]; i < e; i++) {
+      memcpy(t->col[t->order[i]].data + row * 8, payload + t->src[i], 8);
+    }
+    column_put(t->seq.data + row * 8, seq, 8);
+  } else if (!column_put_raw(&t->seq, t->col, row, seq, payload, payload_len)) {
+    exp->failed = true;
+    return false;
+  }
+  t->rows++;
+  return true;
+}
+
+/**
+* \brief Packet handler adding the packets to an exporter.
+*
+* Set with tsip_set_handler() or tsip_register_raw(), with the exporter as the
+* handler argument.
+*
+* \param pkt 	Pointer to the packet.
+* \param user 	Pointer to the exporter.
+* \return
+*/
+void column_handler(const struct tsip_packet *pkt, void *user) {
+  // the payload follows the IDs in the dispatched buffer
+  column_add((struct column_export *)user, pkt->payload - 2, pkt->len + 2);
+}
+
+/**
+* \brief Route all the dispatched packets to an exporter.
+*
+* Sets the handler of the packet types with a schema, keeping their decoders,
+* and the raw handler, replacing the current handlers.
+*
+* \param exp Pointer to the exporter.
+* \return
+*/
+void column_register(struct column_export *exp) {
+  for (uint32_t ids = 0; ids < 1 << 16; ids++) {
+    if (exp->schema[ids] != NULL)
+      tsip_set_handler(ids >> 8, ids & 0xFF, column_handler, exp);
+  }
+  tsip_register_raw(column_handler, exp);
+}
+
+/**
+* \brief Write a column, padded to 8 bytes.
+*
+* \param f 			Output stream.
+* \param data 		Pointer to the column.
+* \param len 		Column size.
+* \param[in,out] pos 	File offset, advanced.
+* \return 			True if the column was written.
+*/
+bool column_write(FILE *f, const void *data, uint64_t len, uint64_t *pos) {
+  static const uint8_t pad[8] = {0};
+  uint32_t n = (8 - len % 8) % 8;
+  bool ok = (len == 0 || fwrite(data, 1, len, f) == len) &&
+            fwrite(pad, 1, n, f) == n;
+  *pos += len + n;
+  return ok;
+}
+
+/**
+* \brief Number of columns of a table.
+*
+* \param t Pointer to the table.
+* \return 	Number of columns, seq included.
+*/
+uint32_t column_count(const struct column_table *t) {
+  return 1 + (t->schema != NULL ? t->schema->field_count + 3 : 2);
+}
+
+/**
+* \brief Write the tables to a column file.
+*
+* The columns are written one after the other through a buffered stream, then
+* the directory locating them, and the header last.
+*
+* \param exp 	Pointer to the exporter.
+* \param fname 	File name.
+* \return 		True if the file was written.
+*/
+bool column_save(const struct column_export *exp, const char *fname) {
+  FILE *f = fopen(fname, "wb");
+  if (f == NULL)
+    return false;
+  char *out_buf = (char *)malloc(COLUMN_OUT_BUFFER);
+  if (out_buf != NULL)
+    setvbuf(f, out_buf, _IOFBF, COLUMN_OUT_BUFFER);
+  struct column_header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, COLUMN_MAGIC, sizeof(hdr.magic));
+  hdr.version = COLUMN_VERSION;
+  hdr.byte_order = COLUMN_BYTE_ORDER;
+  hdr.table_count = exp->table_count;
+  hdr.packets = exp->packets;
+  bool ok = !exp->failed && fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+  uint64_t pos = sizeof(hdr);
+  uint32_t n_columns = 0;
+  for (uint32_t i = 0; i < exp->table_count; i++) {
+    n_columns += column_count(&exp->table[i]);
+  }
+  struct column_dir_column *dir = (struct column_dir_column *)calloc(
+      n_columns + 1, sizeof(struct column_dir_column));
+  ok = ok && dir != NULL;
+  struct column_dir_column *d = dir;
+  for (uint32_t i = 0; ok && i < exp->table_count; i++) {
+    const struct column_table *t = &exp->table[i];
+    // the seq column first, then the fields or the payloads
+    strcpy(d->name, "seq");
+    d->type = col_u64;
+    d->offset = pos;
+    d->count = t->rows;
+    ok = column_write(f, t->seq.data, t->rows * 8, &pos);
+    d++;
+    for (uint32_t k = 0; ok && k + 1 < column_count(t); k++, d++) {
+      const uint8_t *data;
+      if (t->schema != NULL && k < t->schema->field_count) {
+        memcpy(d->name, t->schema->field[k].name, COLUMN_NAME_SIZE);
+        d->type = t->schema->field[k].type;
+        d->count = t->rows;
+        data = t->col[k].data;
+      } else {
+        // raw_seq, len and payload, the first only after the schema fields
+        static const char *raw_name[] = {"raw_seq", "len", "payload"};
+        static const uint8_t raw_type[] = {col_u64, col_u16, col_u8};
+        bool fields = t->schema != NULL;
+        uint32_t r = fields ? k - t->schema->field_count : k + 1;
+        const struct column_buf *raw = fields ? t->raw : t->col;
+        strcpy(d->name, raw_name[r]);
+        d->type = raw_type[r];
+        d->count = r < 2 ? (fields ? t->raw_rows : t->rows) : raw[1].len;
+        data = r == 0 ? t->raw_seq.data : raw[r - 1].data;
+      }
+      d->offset = pos;
+      ok = column_write(f, data, d->count * column_type_size[d->type], &pos);
+    }
+  }
+  hdr.dir_offset = pos;
+  d = dir;
+  for (uint32_t i = 0; ok && i < exp->table_count; i++) {
+    const struct column_table *t = &exp->table[i];
+    struct column_dir_table dt = {t->id1, t->id2, 0, column_count(t), t->rows};
+    ok = fwrite(&dt, sizeof(dt), 1, f) == 1 &&
+         fwrite(d, sizeof(*d), dt.column_count, f) == dt.column_count;
+    d += dt.column_count;
+  }
+  ok = ok && fseek(f, 0, SEEK_SET) == 0 &&
+       fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+  ok = fclose(f) == 0 && ok;
+  free(out_buf);
+  free(dir);
+  return ok;
+}
+
+/**
+* \brief Map a column file.
+*
+* \param cf 	Pointer to the column file.
+* \param fname 	File name.
+* \return 		True if the file is a valid column file written with the host
+* byte order.
+*/
+bool column_open(struct column_file *cf, const char *fname) {
+  memset(cf, 0, sizeof(*cf));
+  if (!source_mmap_open(&cf->map, fname))
+    return false;
+  const struct column_header *h = (const struct column_header *)cf->map.data;
+  if (cf->map.len < sizeof(*h) || memcmp(h->magic, COLUMN_MAGIC, 8) != 0 ||
+      h->version != COLUMN_VERSION || h->byte_order != COLUMN_BYTE_ORDER ||
+      h->dir_offset > cf->map.len) {
+    source_close(&cf->map);
+    return false;
+  }
+  cf->hdr = h;
+  return true;
+}
+
+/**
+* \brief Unmap a column file.
+*
+* \param cf Pointer to the column file.
+* \return
+*/
+void column_close(struct column_file *cf) {
+  source_close(&cf->map);
+  memset(cf, 0, sizeof(*cf));
+}
+
+/**
+* \brief Find a column in a column file.
+*
+* \param cf 			Pointer to the column file.
+* \param id1 			Packet ID1.
+* \param id2 			Packet ID2.
+* \param name 			Column name.
+* \param[out] column 	Column directory entry.
+* \return 				Pointer to the little-endian column values, NULL if
+* there's no such column.
+*/
+const void *column_find(const struct column_file *cf, uint8_t id1, uint8_t id2,
+                        const char *name,
+                        const struct column_dir_column **column) {
+  // pos never passes the file size, so the room left can't wrap
+  uint64_t pos = cf->hdr->dir_offset;
+  for (uint32_t i = 0; i < cf->hdr->table_count; i++) {
+    if (cf->map.len - pos < sizeof(struct column_dir_table))
+      return NULL;
+    const struct column_dir_table *t =
+        (const struct column_dir_table *)(cf->map.data + pos);
+    pos += sizeof(*t);
+    if (t->column_count >
+        (cf->map.len - pos) / sizeof(struct column_dir_column))
+      return NULL;
+    const struct column_dir_column *c =
+        (const struct column_dir_column *)(cf->map.data + pos);
+    pos += t->column_count * sizeof(*c);
+    if (t->id1 != id1 || t->id2 != id2)
+      continue;
+    for (uint32_t k = 0; k < t->column_count; k++) {
+      if (strncmp(c[k].name, name, COLUMN_NAME_SIZE) == 0 &&
+          c[k].type <= col_f64 && c[k].offset <= cf->hdr->dir_offset &&
+          c[k].count <= (cf->hdr->dir_offset - c[k].offset) /
+                            column_type_size[c[k].type]) {
+        *column = &c[k];
+        return cf->map.data + c[k].offset;
+      }
+    }
+  }
+  return NULL;
+}
+
+#endif
@@ -7,22 +7,47 @@
 
 #include "string.h"
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "tsip_batch.h"
+#include "tsip_pool.h"
 #include "tsip_read.h"
+#include "tsip_scan.h"
+#include "tsip_source.h"
+#include "tsip_stats.h"
+#include "tsip_tune.h"
 
   //! [Setup parameters]
 /**
- * \brief Number of concurrent threads.
+ * \brief Default number of concurrent threads.
  */
 #define N_THREADS 2
 /**
- * \brief Data block size to be processed by a single thread.
+ * \brief Default data block size to be processed by a single thread.
  */
+#ifndef BLOCK_SIZE
 #define BLOCK_SIZE 2048
+#endif
+/**
+ * \brief Block size limits, the thread buffers are sized for the largest
+ * block.
+ */
+#define MIN_BLOCK_SIZE 64
+#ifndef MAX_BLOCK_SIZE
+#define MAX_BLOCK_SIZE 16384
+#endif
 /**
- * \brief Maximum allowable raw data size.
+ * \brief Number of block buffers of a decoder thread, so a thread decodes its
+ * next block while the previous one waits to be parsed.
+ */
+#define DECODER_BLOCK_BUFFERS 2
+#if DECODER_BLOCK_BUFFERS * POOL_MAX_THREADS > TURN_MAX_ITEMS
+#error "The parse turn can't hold the blocks of all the threads"
+#endif
+/**
+ * \brief Default maximum allowable raw data size of a COM read.
  */
 #define MAX_COM_SIZE 512
 /**
@@ -30,6 +55,9 @@
  */
 #define MAX_DATA_SIZE 256
   //! [Setup parameters]
+#if BLOCK_SIZE < MIN_BLOCK_SIZE || BLOCK_SIZE > MAX_BLOCK_SIZE
+#error "BLOCK_SIZE must be between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE"
+#endif
 /**
  * \brief Debug flag.
  */
@@ -37,29 +65,91 @@
 
   //! [Setup Parameters]
 /**
- * \brief Data read mutex locks.
+ * \brief Decoder stages timed by the stage timers.
+ */
+enum decoder_stage {
+  stage_read,
+  stage_decode,
+  stage_validate,
+  stage_parse,
+  stage_count
+};
+
+/**
+ * \brief Decoder context.
+ *
+ * Holds the state of a single decoded stream, so that several streams can be
+ * decoded by the same process.
  */
-static pthread_mutex_t g_data_read_lock;
-static uint8_t g_data_read_seq;
+struct decoder_ctx {
+  //! input source, the COM interface if none is set
+  struct tsip_source *source;
+  //! next block ticket of the tick
+  _Atomic uint32_t next_block;
+  //! data range of a memory source split into blocks by the tick
+  uint64_t tick_pos;
+  uint64_t tick_end;
+  //! read lock of the other sources, and the time spent waiting for it
+  pthread_mutex_t read_lock;
+  uint64_t read_wait_ns;
+  //! block parse turn handoff, in the ticket order
+  struct turn_seq parse_turn;
+  //! number of threads decoding the stream
+  uint8_t n_threads;
+  //! decode every read straight away instead of filling a block
+  bool low_latency;
+  //! block size, and the maximum size of a COM read
+  uint32_t block_size;
+  uint32_t com_size;
+  //! block size auto-tuner
+  struct block_tuner tune;
+  //! number of valid packets decoded by the last tick
+  uint32_t packet_counter;
+  //! batch output of the last tick, used instead of ParseTsipData() once
+  //! allocated
+  struct packet_batch batch;
+  //! trailing data buffer
+  uint8_t inter_buffer[MAX_DATA_SIZE + 6];
+  uint32_t inter_buffer_len;
+  uint32_t inter_crc;
+  //! the last block parsed ends with a DLE, its pair still to come
+  bool tail_dle;
+  //! stage timers switch, and the time spent in each stage by all threads
+  bool stage_timing;
+  _Atomic uint64_t stage_ns[stage_count];
+  //! decoder statistics, and the packet latency histogram switch
+  struct decoder_stats stats;
+  bool latency_timing;
+  bool ready;
+};
+
+/**
+ * \brief Default decoder context, driven by TaskUpLink200Hz().
+ */
+static struct decoder_ctx g_decoder;
 static uint32_t packet_counter;
 
 /**
- * \brief Data parse mutex locks.
+ * \brief Persistent decoder thread pool.
  */
-static pthread_mutex_t g_data_parse_lock;
-static uint8_t g_data_parse_seq;
+static struct worker_pool g_decoder_pool;
+static uint8_t g_decoder_threads = N_THREADS;
 
 /**
- * \brief Trailing data buffer.
+ * \brief COM interface input source.
  */
-static uint8_t g_inter_buffer[MAX_DATA_SIZE + 6];
-static uint32_t g_inter_buffer_len = 0;
-static bool g_inter_buffer_dle = false;
+static struct tsip_source g_com_source;
 
 /**
  * \brief Validation error types.
  */
-enum validate_error { none, size_mismatch, illegal_id, chksum_mismatch };
+enum validate_error {
+  none,
+  size_mismatch,
+  illegal_id,
+  chksum_mismatch,
+  unchecked
+};
 
 /**
  * \brief Special character flag types.
@@ -103,55 +193,220 @@ uint8_t validate_packet(const uint8_t *buffer, const uint32_t start,
 }
 
 /**
-* \brief Read the recieved raw data, multithread-protected.
+* \brief Validate the packet with a precomputed CRC.
 *
-* Read the data. Only one thread is allowed to read data at a time.
+* Same checks as validate_packet(), but the CRC register is computed while
+* the escape characters are removed, so the packet data is not read again.
+* The register covers the data and the trailing checksum, which leaves the
+* CRC residue for an intact packet.
 *
-* \param raw 		Pointer to raw data destination.
-* \param raw_len 	Pointer to the size of the data read.
-* \param id 		Thread id.
+* \param buffer 	Pointer to packet source.
+* \param start 		Packet data start.
+* \param end 		Packet data end.
+* \param crc 		CRC register over the packet data and checksum.
 * \return 			Error type, 0 if no errors are found.
 */
-void data_read(uint8_t *raw, uint32_t *raw_len, uint8_t id) {
-  // grab the raw data
+uint8_t validate_packet_crc(const uint8_t *buffer, const uint32_t start,
+                            const uint32_t end, const uint32_t crc) {
+  uint32_t len = end - start;
+  // packet size
+  if (len < 6 || len > MAX_DATA_SIZE + 6) {
+    return size_mismatch;
+  }
+  // ID
+  if (buffer[start] == DLE) {
+    return illegal_id;
+  }
+  // chksum
+  if (crc != CRC32_RESIDUE) {
+    return chksum_mismatch;
+  }
+  return 0;
+}
+
+/**
+* \brief Read the monotonic clock.
+*
+* \return Time in nanoseconds.
+*/
+uint64_t decoder_clock_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+* \brief Start timing a decoder stage.
+*
+* \param dec Pointer to the decoder context.
+* \return 	Start time in nanoseconds, 0 if the stage timers are off.
+*/
+uint64_t stage_start(struct decoder_ctx *dec) {
+  if (!dec->stage_timing)
+    return 0;
+  return decoder_clock_ns();
+}
+
+/**
+* \brief Add the time since the stage start to the stage timer.
+*
+* \param dec 	Pointer to the decoder context.
+* \param stage 	Decoder stage.
+* \param start 	Stage start time.
+* \return
+*/
+void stage_stop(struct decoder_ctx *dec, uint8_t stage, uint64_t start) {
+  if (!dec->stage_timing)
+    return;
+  atomic_fetch_add_explicit(&dec->stage_ns[stage], stage_start(dec) - start,
+                            memory_order_relaxed);
+}
+
+/**
+* \brief Reset the stage timers.
+*
+* \param dec Pointer to the decoder context.
+* \return
+*/
+void stage_reset(struct decoder_ctx *dec) {
+  for (uint8_t i = 0; i < stage_count; i++) {
+    atomic_store(&dec->stage_ns[i], 0);
+  }
+}
+
+/**
+* \brief Pass a validated packet on.
+*
+* Adds the packet to the tick batch in the batch mode, otherwise parses the
+* valid packet straight away. Only to be called within the parse turn.
+*
+* \param dec 		Pointer to the decoder context.
+* \param buffer 	Pointer to packet source.
+* \param start 		Packet data start.
+* \param end 		Packet data end.
+* \param status 	Packet validation result.
+* \return
+*/
+void packet_emit(struct decoder_ctx *dec, const uint8_t *buffer,
+                 const uint32_t start, const uint32_t end,
+                 const uint8_t status) {
+  // the valid packets are passed on without the checksum
+  uint32_t len = (status == none) ? end - start - 4 : end - start;
+  if (dec->batch.data != NULL) {
+    batch_append(&dec->batch, buffer + start, len, status);
+  } else if (status == none) {
+    ParseTsipData(buffer + start, len);
+  }
+  if (status == none) {
+    dec->packet_counter++;
+    dec->stats.packets_out++;
+  } else if (status < STATS_REJECT_REASONS) {
+    dec->stats.rejects[status]++;
+  }
+}
+
+/**
+* \brief Claim the next block of the stream.
+*
+* A memory source is split into blocks at the start of the tick, so a block is
+* claimed with a single atomic increment and decoded in place, without waiting
+* for the other threads. Any other source is read under the read lock by
+* whichever thread gets to it first. The data is only gathered into the
+* scratch buffer when the block takes several reads. In the low latency mode a
+* single read is made, so the packets it completes are parsed without waiting
+* for the rest of the block.
+*
+* Every block gets a ticket, the order its packets are parsed in. A block may
+* start or end in the middle of a DLE pair, see block_sync().
+*
+* \param dec 		Pointer to the decoder context.
+* \param raw 		Pointer to the raw data read.
+* \param raw_len 	Pointer to the size of the data read, 0 once the data is
+* all gone.
+* \param scratch 	Pointer to the thread raw data buffer.
+* \param ticket 	Pointer to the block ticket.
+* \return
+*/
+void data_read(struct decoder_ctx *dec, const uint8_t **raw, uint32_t *raw_len,
+               uint8_t *scratch, uint32_t *ticket) {
+  struct tsip_source *src = dec->source;
+  uint32_t block = dec->block_size;
   *raw_len = 0;
-  uint32_t len = 0;
-  // bytes to read
-  uint32_t res = BLOCK_SIZE;
-  uint32_t data_size;
-  while (true) {
-    // make sure that it's the right turn
-    pthread_mutex_lock(&g_data_read_lock);
-    if (g_data_read_seq == id) {
-      //! [Reading COM data]
-      do {
-        // keep filling up the raw buffer until it's full
-        data_size = (res < MAX_COM_SIZE) ? res : MAX_COM_SIZE;
-        len = uavnComRead(raw + (*raw_len), data_size);
-        (*raw_len) += len;
-        res -= len;
-      } while (len != 0 && res != 0);
-      //! [Reading COM data]
-
-      // queue the next thread
-      if (id == N_THREADS - 1) {
-        g_data_read_seq = 0;
-      } else {
-        g_data_read_seq++;
+  if (source_is_mem(src)) {
+    *ticket = atomic_fetch_add_explicit(&dec->next_block, 1,
+                                        memory_order_relaxed);
+    uint64_t pos = dec->tick_pos + (uint64_t)*ticket * block;
+    if (pos < dec->tick_end) {
+      *raw = src->data + pos;
+      *raw_len = min((uint64_t)block, dec->tick_end - pos);
+    }
+    return;
+  }
+
+  if (pthread_mutex_trylock(&dec->read_lock) != 0) {
+    uint64_t t0 = decoder_clock_ns();
+    pthread_mutex_lock(&dec->read_lock);
+    dec->read_wait_ns += decoder_clock_ns() - t0;
+  }
+  uint64_t start = stage_start(dec);
+  //! [Reading COM data]
+  const uint8_t *data;
+  *raw = scratch;
+  uint32_t len;
+  do {
+    len = src->read(src, scratch + *raw_len, &data, block - *raw_len);
+    if (*raw_len == 0) {
+      // the first read is used in place
+      *raw = data;
+    } else if (len != 0) {
+      // keep filling up the raw buffer
+      if (*raw != scratch) {
+        memcpy(scratch, *raw, *raw_len);
+        *raw = scratch;
       }
-      // exit
-      pthread_mutex_unlock(&g_data_read_lock);
-      break;
+      if (data != scratch + *raw_len)
+        memcpy(scratch + *raw_len, data, len);
     }
-    pthread_mutex_unlock(&g_data_read_lock);
+    *raw_len += len;
+  } while (len != 0 && *raw_len < block && !dec->low_latency);
+  if (*raw_len != 0)
+    *ticket = atomic_fetch_add_explicit(&dec->next_block, 1,
+                                        memory_order_relaxed);
+  //! [Reading COM data]
+  stage_stop(dec, stage_read, start);
+  pthread_mutex_unlock(&dec->read_lock);
+}
+
+/**
+* \brief Find where the escape state of a block is known.
+*
+* A block may start in the middle of a DLE pair. After the first non-DLE byte
+* the escape state is the same regardless of the preceding data, so the block
+* is decoded from there on concurrently, while the bytes in front of it are
+* decoded by block_head() once the preceding block has been parsed.
+*
+* \param raw 	Pointer to the raw data.
+* \param len 	Size of the raw data.
+* \return 	Offset of the byte following the first non-DLE byte, the size
+* of the data if there's none.
+*/
+uint32_t block_sync(const uint8_t *raw, uint32_t len) {
+  uint32_t sync = 0;
+  while (sync < len && raw[sync] == DLE) {
+    sync++;
   }
+  return min(sync + 1, len);
 }
 
 /**
 * \brief Process raw data.
 *
 * Process the raw data, removing the escape characters and marking packet start
-* and end points
+* and end points. The spans between the DLE characters are located with the
+* vectorized DLE search and copied in bulk. The CRC register of a packet is
+* computed as soon as its end flag is found, while the packet is still in the
+* cache. It covers the data from the preceding flag, or from the start of the
+* block, to the end flag.
 *
 * \param processed 		Pointer to destination.
 * \param processed_len 	Size of processed data.
@@ -159,22 +414,32 @@ void data_read(uint8_t *raw, uint32_t *raw_len, uint8_t id) {
 * \param raw_len 		Size of source data.
 * \param flag 			Pointer to flags, contains flag locations.
 * \param flag_type 		Types of marked flags.
+* \param flag_crc 		CRC registers at the end flags.
 * \param flag_count 	Number of flags.
 * \param hanging_dle 	A flag to indicate a hanging DLE character.
+* \param tail_crc 		CRC register at the end of the data, hanging DLE
+* excluded.
 * \return
 */
-void packet_decode(uint8_t *processed, uint32_t *processed_len, uint8_t *raw,
-                   uint32_t *raw_len, uint32_t *flag, uint8_t *flag_type,
-                   uint32_t *flag_count, bool *hanging_dle) {
+void packet_decode(uint8_t *processed, uint32_t *processed_len,
+                   const uint8_t *raw, uint32_t *raw_len, uint32_t *flag,
+                   uint8_t *flag_type, uint32_t *flag_crc, uint32_t *flag_count,
+                   bool *hanging_dle, uint32_t *tail_crc) {
 
   *flag_count = 0;
   *processed_len = 0;
   uint32_t i = 0;
+  uint32_t crc_start = 0;
   *hanging_dle = false;
   //! [Removing escape characters]
   while (i < *raw_len) {
+    // copy the data up to the next DLE
+    uint32_t next = g_dle_scan(raw, i, *raw_len);
+    memcpy(processed + *processed_len, raw + i, next - i);
+    *processed_len += next - i;
+    i = next;
     // check for DLE
-    if (raw[i] == DLE) {
+    if (i < *raw_len) {
       // check if there are still bytes left in the buffer
       if (i + 1 < *raw_len) {
         // check the byte after the DLE
@@ -184,7 +449,11 @@ void packet_decode(uint8_t *processed, uint32_t *processed_len, uint8_t *raw,
           // end of packet
           flag[*flag_count] = *processed_len;
           flag_type[*flag_count] = end_flag;
+          flag_crc[*flag_count] =
+              crc32_update(CRC32_INIT, processed + crc_start,
+                           *processed_len - crc_start);
           (*flag_count)++;
+          crc_start = *processed_len;
           break;
         case DLE:
           // escape flag, don't do anything
@@ -195,6 +464,7 @@ void packet_decode(uint8_t *processed, uint32_t *processed_len, uint8_t *raw,
           flag[*flag_count] = *processed_len;
           flag_type[*flag_count] = start_flag;
           (*flag_count)++;
+          crc_start = *processed_len;
           processed[(*processed_len)++] = raw[i];
           break;
         }
@@ -206,274 +476,843 @@ void packet_decode(uint8_t *processed, uint32_t *processed_len, uint8_t *raw,
         processed[(*processed_len)++] = raw[i];
         i++;
       }
-    } else {
-      processed[(*processed_len)++] = raw[i];
-      i++;
     }
   }
+  *tail_crc = crc32_update(CRC32_INIT, processed + crc_start,
+                           *processed_len - crc_start - (*hanging_dle ? 1 : 0));
   //! [Removing escape characters]
 }
 
 /**
-* \brief Test for special condition that the previous block ended on a DLE.
-*
-* Check if the previous raw data block ended on a DLE. Correct the following
-* data block structure and data to match the trailing DLE character.
-*
-* \param[in] processed 		Pointer to processed data
-* \param[in] processed_len 	Size of processed data
-* \param flag 			Pointer to flags, contains flag locations
-* \param flag_type 		Types of marked flags
-* \param flag_count 	Number of flags
-* \return
-*/
-void hanging_dle_test(uint8_t *processed, uint32_t processed_len,
-                      uint32_t *flag, uint8_t *flag_type,
-                      uint32_t *flag_count) {
-
-  //! [Checking hanging DLE flags]
-  // check if the last block ended on a DLE flag
-  if (g_inter_buffer_len > 0 && g_inter_buffer_dle == true) {
-    g_inter_buffer_dle = false;
-
-    if ((*flag_count) > 0 && flag[0] == 0 && flag_type[0] == start_flag) {
-      // the first start flag is false
-      memcpy(flag, flag + 1, ((*flag_count) - 1) * sizeof(uint32_t));
-      memcpy(flag_type, flag_type + 1, ((*flag_count) - 1) * sizeof(uint8_t));
-      (*flag_count)--;
-    } else if (processed_len > 0) {
-      if (processed[0] == ETX) {
-        // the first byte indicates an end flag
-        memcpy(flag + 1, flag, (*flag_count) * sizeof(uint32_t));
-        memcpy(flag_type + 1, flag_type, (*flag_count) * sizeof(uint8_t));
-        flag[0] = 0;
-        flag_type[0] = end_flag;
-        (*flag_count)++;
-        g_inter_buffer_len--;
-      } else if (processed[0] == DLE) {
-        // the first byte is escaped
-        g_inter_buffer_len--;
-      } else {
-        // the first byte indicates a start flag
-        memcpy(flag + 1, flag, (*flag_count) * sizeof(uint32_t));
-        memcpy(flag_type + 1, flag_type, (*flag_count) * sizeof(uint8_t));
-        flag[0] = 0;
-        flag_type[0] = start_flag;
-        (*flag_count)++;
-        g_inter_buffer_len--;
-      }
+* \brief Drop the packet being reassembled.
+*
+* \param dec Pointer to the decoder context.
+* \return
+*/
+void reasm_reset(struct decoder_ctx *dec) {
+  dec->inter_buffer_len = 0;
+  dec->inter_crc = CRC32_INIT;
+}
+
+/**
+* \brief Start reassembling a packet from the tail of a block.
+*
+* \param dec 	Pointer to the decoder context.
+* \param data 	Pointer to the packet tail, starting with the IDs.
+* \param len 	Size of the packet tail.
+* \param crc 	CRC register over the packet tail.
+* \return
+*/
+void reasm_start(struct decoder_ctx *dec, const uint8_t *data, uint32_t len,
+                 uint32_t crc) {
+  if (len > sizeof(dec->inter_buffer)) {
+    dec->stats.overflow_drops++;
+    reasm_reset(dec);
+    return;
+  }
+  memcpy(dec->inter_buffer, data, len);
+  dec->inter_buffer_len = len;
+  dec->inter_crc = crc;
+}
+
+/**
+* \brief Append data to the packet being reassembled.
+*
+* A packet that outgrows the inter buffer can't be valid, so it's dropped and
+* the rest of it is ignored.
+*
+* \param dec 	Pointer to the decoder context.
+* \param data 	Pointer to the data.
+* \param len 	Size of the data.
+* \return 		True if the packet is still being reassembled.
+*/
+bool reasm_append(struct decoder_ctx *dec, const uint8_t *data, uint32_t len) {
+  if (dec->inter_buffer_len == 0)
+    return false;
+  if (dec->inter_buffer_len + len > sizeof(dec->inter_buffer)) {
+    dec->stats.overflow_drops++;
+    reasm_reset(dec);
+    return false;
+  }
+  memcpy(dec->inter_buffer + dec->inter_buffer_len, data, len);
+  dec->inter_buffer_len += len;
+  dec->inter_crc = crc32_update(dec->inter_crc, data, len);
+  return true;
+}
+
+/**
+* \brief Finish the packet being reassembled at its end flag.
+*
+* \param dec Pointer to the decoder context.
+* \return
+*/
+void reasm_finish(struct decoder_ctx *dec) {
+  if (dec->inter_buffer_len != 0) {
+    uint8_t status = validate_packet_crc(dec->inter_buffer, 0,
+                                         dec->inter_buffer_len, dec->inter_crc);
+    packet_emit(dec, dec->inter_buffer, 0, dec->inter_buffer_len, status);
+    dec->stats.reassemblies++;
+  }
+  reasm_reset(dec);
+}
+
+/**
+* \brief Decode the head of a block.
+*
+* Decodes the bytes in front of the point found by block_sync(), carrying on
+* from the escape state the preceding block ended in. They hold at most a
+* single flag, which finishes or starts the packet being reassembled. Only to
+* be called within the parse turn.
+*
+* \param dec 	Pointer to the decoder context.
+* \param raw 	Pointer to the block head.
+* \param len 	Size of the block head.
+* \return
+*/
+void block_head(struct decoder_ctx *dec, const uint8_t *raw, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    if (!dec->tail_dle) {
+      if (raw[i] == DLE)
+        dec->tail_dle = true;
+      else
+        reasm_append(dec, raw + i, 1);
+      continue;
     }
+    dec->tail_dle = false;
+    if (raw[i] == DLE)
+      reasm_append(dec, raw + i, 1);
+    else if (raw[i] == ETX)
+      reasm_finish(dec);
+    else
+      reasm_start(dec, raw + i, 1, crc32_update(CRC32_INIT, raw + i, 1));
   }
-  //! [Checking hanging DLE flags]
 }
 
+
 /**
-* \brief Store the trailing data
+* \brief Validate the uninterrupted packets of a block.
 *
-* If no DLE/ETX combo is found at the end of the packet, pass on it's trailing
-* part to the next evaluation.
+* Run the validation checks on every start and end flag pair of the block,
+* using the CRC registers computed by packet_decode(). The packets enclosed by a
+* flag pair don't depend on the preceding blocks, so this is done concurrently,
+* outside of the parse turn.
 *
 * \param[in] processed 		Pointer to processed data.
-* \param[in] processed_len 	Size of processed data.
 * \param[in] flag 			Pointer to flags, contains flag
 * locations.
 * \param[in] flag_type 		Types of marked flags.
+* \param[in] flag_crc 		CRC registers at the end flags.
 * \param[in] flag_count 	Number of flags.
-* \param[in] hanging_dle 	Hanging DLE character indicator.
-* \return
-*/
-void trailing_data_store(uint8_t *processed, uint32_t processed_len,
-                         uint32_t *flag, uint8_t *flag_type,
-                         uint32_t *flag_count, bool hanging_dle) {
-  //! [Storing trailing data]
-  // store the tail of the processed data into the inter buffer, from the
-  // last start flag to the end
-  if (flag_type[(*flag_count) - 1] == start_flag) {
-    uint32_t loc = flag[(*flag_count) - 1];
-    uint32_t len = processed_len - loc;
-    if (g_inter_buffer_len + processed_len <= MAX_DATA_SIZE + 6) {
-      memcpy(g_inter_buffer, processed + loc, len * sizeof(uint16_t));
-      g_inter_buffer_len = len;
-      g_inter_buffer_dle = hanging_dle;
-    } else {
-      g_inter_buffer_len = 0;
-      g_inter_buffer_dle = false;
-    }
-  } else {
-    // if the last byte is a DLE flag then it could be a hanging delimiter
-    if (processed[processed_len - 1] == DLE && hanging_dle) {
-      g_inter_buffer_len = 1;
-      g_inter_buffer[0] = DLE;
-      g_inter_buffer_dle = hanging_dle;
+* \param[out] flag_status 	Validation result of the packet starting at
+* each flag.
+* \return
+*/
+void block_validate(const uint8_t *processed, const uint32_t *flag,
+                    const uint8_t *flag_type, const uint32_t *flag_crc,
+                    const uint32_t flag_count, uint8_t *flag_status) {
+  for (uint32_t i = 0; i + 1 < flag_count; i++) {
+    if (flag_type[i] == start_flag && flag_type[i + 1] == end_flag) {
+      flag_status[i] = validate_packet_crc(processed, flag[i], flag[i + 1],
+                                           flag_crc[i + 1]);
     } else {
-      // if the last flag isnt a start flag just discard it
-      g_inter_buffer_len = 0;
-      g_inter_buffer_dle = false;
+      flag_status[i] = unchecked;
     }
   }
-  //! [Storing trailing data]
 }
 
+/**
+ * \brief Block decoded by a thread, waiting to be parsed.
+ */
+struct decoded_block {
+  //! raw data, and the size of its head, see block_sync()
+  const uint8_t *raw;
+  uint32_t raw_len;
+  uint32_t sync;
+  //! processed data, a hanging DLE excluded
+  uint8_t *processed;
+  uint32_t processed_len;
+  //! flag locations and types, and the validation results of the packets
+  uint32_t *flag;
+  uint8_t *flag_type;
+  uint8_t *flag_status;
+  uint32_t flag_count;
+  //! CRC register from the last flag to the end
+  uint32_t tail_crc;
+  //! the block ends with a DLE, its pair still to come
+  bool tail_dle;
+  //! time the block was read, for the latency histogram
+  uint64_t read_ns;
+};
+
 /**
 * \brief Parse the decoded data, multithread-protected
 *
 * Format the data, run the checks on the preceding data block. Run the
-* validation checks. Parse the data if it's correct. Store the trailing part
-* that has not been parsed. Only one thread can parse the data at a time to make
-* sure that it's parsed in the same order as it comes in.
+* validation checks on the packets not validated by block_validate(). Parse the
+* data if it's correct. Store the trailing part that has not been parsed. Run
+* through the parse turn, so only one thread parses the data at a time, and
+* the blocks are parsed in the order of their tickets, to make sure that the
+* data is parsed in the same order as it comes in.
 *
-* \param[in] processed 		Pointer to processed data.
-* \param[in] processed_len 	Size of processed data.
-* \param[in] flag 			Pointer to flags, contains flag
-* locations.
-* \param[in] flag_type 		Types of marked flags.
-* \param[in] flag_count 	Number of flags.
-* \param[in] id 			Thread id.
-* \param[in] hanging_dle 	Hanging DLE character indicator.
+* A packet spanning several blocks is reassembled in the inter buffer of the
+* decoder context: its tail is stored at the end of the block it starts in,
+* the blocks with no flags are appended to it, and it's completed at the first
+* flag of a following block. Nothing is allocated, however many blocks the
+* packet spans.
+*
+* \param[in] block 	Pointer to the decoded block.
+* \param ctx 		Pointer to the decoder context.
 * \return
 */
-void data_parse(uint8_t *processed, uint32_t processed_len, uint32_t *flag,
-                uint8_t *flag_type, uint32_t *flag_count, uint8_t id,
-                bool hanging_dle) {
-  uint32_t i = 0;
-  while (true) {
-    // make sure that it's the right turn
-    pthread_mutex_lock(&g_data_parse_lock);
-
-    if (g_data_parse_seq == id) {
-      //! [Checking previous buffer]
-      // check if the last block ended on a DLE flag
-      hanging_dle_test(processed, processed_len, flag, flag_type, flag_count);
-      // make sure there are some flags found
-      if ((*flag_count) > 0) {
-        // check if there's data from before
-        if (g_inter_buffer_len > 0) {
-
-          if (flag_type[0] == end_flag) {
-            // patch the data together
-            memcpy(g_inter_buffer + g_inter_buffer_len, processed,
-                   flag[0] * sizeof(uint8_t));
-            g_inter_buffer_len += flag[0];
-            // validate and parse
-            if (validate_packet(g_inter_buffer, 0, g_inter_buffer_len) == 0) {
-              ParseTsipData(g_inter_buffer, g_inter_buffer_len - 4);
-              packet_counter++;
-            }
-            // reset buffer
-            g_inter_buffer_len = 0;
-            g_inter_buffer_dle = false;
-          }
-        }
-        //! [Checking previous buffer]
-
-        //! [Checking uninterrupted packets]
-        // check the uninterrupted packets
-        for (i = 0; i < (*flag_count) - 1; i++) {
-          if (flag_type[i] == start_flag && flag_type[i + 1] == end_flag) {
-            // uninterrupted packet, validate and parse
-            if (validate_packet(processed, flag[i], flag[i + 1]) == 0) {
-              ParseTsipData(processed + flag[i], flag[i + 1] - flag[i] - 4);
-              packet_counter++;
-            }
-          }
-        }
-        //! [Checking uninterrupted packets]
-        trailing_data_store(processed, processed_len, flag, flag_type,
-                            flag_count, hanging_dle);
-      } else {
-        // no flags here, just dump the whole sequence into the inter buffer
-        if (g_inter_buffer_len + processed_len <= MAX_DATA_SIZE + 6) {
-          memcpy(g_inter_buffer + g_inter_buffer_len, processed,
-                 processed_len * sizeof(uint8_t));
-          g_inter_buffer_len += processed_len;
-          g_inter_buffer_dle = hanging_dle;
-
-        } else {
-          g_inter_buffer_len = 0;
-          g_inter_buffer_dle = false;
-        }
-      }
+void data_parse(void *block, void *ctx) {
+  struct decoder_ctx *dec = (struct decoder_ctx *)ctx;
+  const struct decoded_block *b = (const struct decoded_block *)block;
+  uint8_t *processed = b->processed;
+  const uint32_t *flag = b->flag;
+  const uint8_t *flag_type = b->flag_type;
+  uint8_t *flag_status = b->flag_status;
+  uint32_t flag_count = b->flag_count;
+  uint64_t start = stage_start(dec);
+  uint64_t packets_out = dec->stats.packets_out;
+  dec->stats.bytes_in += b->raw_len;
+  // the head carries on from where the preceding block ended
+  block_head(dec, b->raw, b->sync);
 
-      // advance the thread queue
-      if (id == N_THREADS - 1) {
-        g_data_parse_seq = 0;
-      } else {
-        g_data_parse_seq++;
+  if (flag_count == 0) {
+    // no flags here, the whole block belongs to the packet carried over
+    reasm_append(dec, processed, b->processed_len);
+  } else {
+    //! [Checking previous buffer]
+    // a packet carried over from the preceding blocks ends at the first flag,
+    // unless a new packet starts there
+    if (flag_type[0] == end_flag && reasm_append(dec, processed, flag[0]))
+      reasm_finish(dec);
+    reasm_reset(dec);
+    //! [Checking previous buffer]
+
+    //! [Checking uninterrupted packets]
+    // check the uninterrupted packets
+    for (uint32_t i = 0; i + 1 < flag_count; i++) {
+      if (flag_type[i] == start_flag && flag_type[i + 1] == end_flag) {
+        // uninterrupted packet, validate unless done already and parse
+        if (flag_status[i] == unchecked) {
+          flag_status[i] = validate_packet(processed, flag[i], flag[i + 1]);
+        }
+        packet_emit(dec, processed, flag[i], flag[i + 1], flag_status[i]);
       }
-      pthread_mutex_unlock(&g_data_parse_lock);
-      break;
     }
-    pthread_mutex_unlock(&g_data_parse_lock);
+    //! [Checking uninterrupted packets]
+
+    //! [Storing trailing data]
+    // carry the packet started by the last flag over to the next block
+    uint32_t loc = flag[flag_count - 1];
+    if (flag_type[flag_count - 1] == start_flag)
+      reasm_start(dec, processed + loc, b->processed_len - loc, b->tail_crc);
+    //! [Storing trailing data]
   }
+  // a block made of its head alone leaves the escape state to block_head()
+  if (b->sync < b->raw_len)
+    dec->tail_dle = b->tail_dle;
+
+  // every packet of the block is counted with the latency of the block
+  if (dec->latency_timing && dec->stats.packets_out != packets_out)
+    stats_latency_add(&dec->stats, decoder_clock_ns() - b->read_ns,
+                      dec->stats.packets_out - packets_out);
+  stage_stop(dec, stage_parse, start);
 }
 
 /**
-* \brief Data processing thread function
+* \brief Decode a stream
 *
-* Thread function tasked with reading, decoding and parsing the data. Only one
-* thread can read or parse the data at a time, while the decoding is done
-* concurrently.
+* Reads, decodes and parses the data of a decoder context until its source
+* runs dry. Every thread claims a block of its own, decodes and validates it
+* concurrently with the other threads, then hands it to the parse turn and
+* goes on with the next block in another buffer. The blocks of a memory source
+* are claimed without any locking, so the parse turn is the only point where
+* the threads meet, and a thread only waits there when the block it handed in
+* a buffer ago is still to be parsed. The thread buffers are sized for the
+* largest block, so the block size can change between the ticks.
 *
-* \param[in] tid Thread id.
+* \param dec Pointer to the decoder context.
 * \return
 */
-void *extract_data(void *tid) {
-  uint8_t id = *((uint8_t *)tid);
-  uint8_t processed[BLOCK_SIZE];
+void decoder_run(struct decoder_ctx *dec) {
+  uint8_t processed[DECODER_BLOCK_BUFFERS][MAX_BLOCK_SIZE];
   uint32_t processed_len;
-  uint8_t raw[BLOCK_SIZE];
+  uint8_t scratch[DECODER_BLOCK_BUFFERS][MAX_BLOCK_SIZE];
 
-  uint32_t flag[BLOCK_SIZE];
-  uint8_t flag_type[BLOCK_SIZE];
-  uint32_t flag_count;
-  uint32_t raw_len;
+  uint32_t flag[DECODER_BLOCK_BUFFERS][MAX_BLOCK_SIZE];
+  uint8_t flag_type[DECODER_BLOCK_BUFFERS][MAX_BLOCK_SIZE];
+  uint8_t flag_status[DECODER_BLOCK_BUFFERS][MAX_BLOCK_SIZE];
+  uint32_t flag_crc[MAX_BLOCK_SIZE];
+  uint32_t ticket[DECODER_BLOCK_BUFFERS];
+  bool pending[DECODER_BLOCK_BUFFERS];
   bool hanging_dle = false;
+  struct decoded_block block[DECODER_BLOCK_BUFFERS];
+  for (uint8_t i = 0; i < DECODER_BLOCK_BUFFERS; i++) {
+    block[i].processed = processed[i];
+    block[i].flag = flag[i];
+    block[i].flag_type = flag_type[i];
+    block[i].flag_status = flag_status[i];
+    pending[i] = false;
+  }
 
+  for (uint8_t i = 0;; i = (i + 1) % DECODER_BLOCK_BUFFERS) {
+    struct decoded_block *b = &block[i];
+    // the buffer is free once its last block has been parsed
+    if (pending[i])
+      turn_wait(&dec->parse_turn, ticket[i]);
+    pending[i] = false;
+    data_read(dec, &b->raw, &b->raw_len, scratch[i], &ticket[i]);
 #if DEBUG
-  printf("T%u: starting thread\n", id);
-#endif
-  while (true) {
-    data_read(raw, &raw_len, id);
-#if DEBUG
-    printf("T%u: read %u bytes\n", id, raw_len);
+    printf("B%u: read %u bytes\n", ticket[i], b->raw_len);
 #endif
 
-    if (raw_len == 0)
+    if (b->raw_len == 0)
       // quit once the data is all gone
       break;
-    // escape characters, map flags
-    packet_decode(processed, &processed_len, raw, &raw_len, flag, flag_type,
-                  &flag_count, &hanging_dle);
-    // wait for the right turn and parse
-    data_parse(processed, processed_len, flag, flag_type, &flag_count, id,
-               hanging_dle);
-    // look for valid packets to interpret
+    b->read_ns = dec->latency_timing ? decoder_clock_ns() : 0;
+    // escape characters, map flags, from where the escape state is known
+    uint64_t start = stage_start(dec);
+    b->sync = block_sync(b->raw, b->raw_len);
+    uint32_t len = b->raw_len - b->sync;
+    packet_decode(b->processed, &processed_len, b->raw + b->sync, &len,
+                  b->flag, b->flag_type, flag_crc, &b->flag_count,
+                  &hanging_dle, &b->tail_crc);
+    b->processed_len = processed_len - (hanging_dle ? 1 : 0);
+    b->tail_dle = hanging_dle;
+    stage_stop(dec, stage_decode, start);
+    // check the packets that are complete within the block
+    start = stage_start(dec);
+    block_validate(b->processed, b->flag, b->flag_type, flag_crc,
+                   b->flag_count, b->flag_status);
+    stage_stop(dec, stage_validate, start);
+    // parse in the ticket order
+    turn_run(&dec->parse_turn, ticket[i], data_parse, b, dec);
+    pending[i] = true;
+  }
+  // the buffers are only left once all their blocks have been parsed
+  for (uint8_t i = 0; i < DECODER_BLOCK_BUFFERS; i++) {
+    if (pending[i])
+      turn_wait(&dec->parse_turn, ticket[i]);
+  }
+}
+
+/**
+* \brief Apply the auto-tuner to a decoder context
+*
+* Passes the data read and the time taken by the tick to the tuner, and sets
+* the block size it picks for the next tick. The COM reads are as large as the
+* block, so a block takes a single read when the data is there. Must not be
+* called while a tick is running.
+*
+* \param dec 		Pointer to the decoder context.
+* \param bytes 		Data read by the tick.
+* \param start_ns 	Tick start time.
+* \param end_ns 	Tick end time.
+* \return
+*/
+void decoder_tune(struct decoder_ctx *dec, uint64_t bytes, uint64_t start_ns,
+                  uint64_t end_ns) {
+  dec->block_size =
+      tune_update(&dec->tune, bytes, start_ns, end_ns, dec->n_threads);
+  dec->com_size = dec->block_size;
+}
+
+/**
+* \brief Data processing thread function
+*
+* Pool task decoding the default decoder context stream, shared by all pool
+* threads.
+*
+* \param[in] id 	Thread id, unused.
+* \param[in] arg 	Pointer to the decoder context.
+* \return
+*/
+void extract_data(uint8_t id, void *arg) {
+  (void)id;
+  decoder_run((struct decoder_ctx *)arg);
+}
+
+/**
+ * \brief Set of streams decoded by the pool threads.
+ */
+struct stream_job {
+  struct decoder_ctx **dec;
+  uint32_t count;
+  _Atomic uint32_t next;
+};
+
+/**
+* \brief Stream processing thread function
+*
+* Pool task decoding several streams. Every thread keeps taking the next
+* undecoded stream and decodes it on its own, until none are left. The streams
+* with the auto-tuner on are timed on their own.
+*
+* \param[in] id 	Thread id, unused.
+* \param[in] arg 	Pointer to the stream job.
+* \return
+*/
+void extract_streams(uint8_t id, void *arg) {
+  (void)id;
+  struct stream_job *job = (struct stream_job *)arg;
+  uint32_t i;
+  while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+    struct decoder_ctx *dec = job->dec[i];
+    uint64_t bytes = dec->stats.bytes_in;
+    uint64_t start = dec->tune.on ? decoder_clock_ns() : 0;
+    decoder_run(dec);
+    if (dec->tune.on)
+      decoder_tune(dec, dec->stats.bytes_in - bytes, start, decoder_clock_ns());
+  }
+}
+
+/**
+* \brief Initialize a decoder context
+*
+* \param dec 	Pointer to the decoder context.
+* \param src 	Pointer to the input source, NULL for the COM interface.
+* \return
+*/
+void decoder_init(struct decoder_ctx *dec, struct tsip_source *src) {
+  memset(dec, 0, sizeof(*dec));
+  dec->source = src;
+  pthread_mutex_init(&dec->read_lock, NULL);
+  turn_init(&dec->parse_turn);
+  dec->inter_crc = CRC32_INIT;
+  dec->block_size = BLOCK_SIZE;
+  dec->com_size = MAX_COM_SIZE;
+  tune_init(&dec->tune, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE, BLOCK_SIZE);
+  dec->ready = true;
+}
+
+/**
+* \brief Reset the stream state of a decoder context
+*
+* Drops the packet being reassembled and the DLE the last block ended with,
+* for when the stream doesn't carry on from where it stopped, like after a
+* source change or a seek. Must not be called while a tick is running.
+*
+* \param dec Pointer to the decoder context.
+* \return
+*/
+void decoder_stream_reset(struct decoder_ctx *dec) {
+  reasm_reset(dec);
+  dec->tail_dle = false;
+}
+
+/**
+* \brief Release the decoder context resources
+*
+* \param dec Pointer to the decoder context.
+* \return
+*/
+void decoder_free(struct decoder_ctx *dec) { batch_free(&dec->batch); }
+
+/**
+* \brief Prepare a decoder context for a tick
+*
+* A memory source is consumed up to its end by the tick, so its data is split
+* into blocks here.
+*
+* \param dec 		Pointer to the decoder context.
+* \param n_threads 	Number of threads decoding the stream.
+* \return
+*/
+void decoder_tick_start(struct decoder_ctx *dec, uint8_t n_threads) {
+  if (dec->source == NULL) {
+    source_com_init(&g_com_source, dec->com_size);
+    dec->source = &g_com_source;
+  }
+  if (dec->source == &g_com_source)
+    g_com_source.max_read = dec->com_size;
+  if (source_is_mem(dec->source)) {
+    dec->tick_pos = dec->source->pos;
+    dec->tick_end = dec->source->len;
+    dec->source->pos = dec->source->len;
+  }
+  dec->n_threads = n_threads;
+  dec->packet_counter = 0;
+  batch_reset(&dec->batch);
+  atomic_store(&dec->next_block, 0);
+  turn_reset(&dec->parse_turn);
+}
+
+/**
+* \brief Take a snapshot of the decoder statistics
+*
+* Must not be called while a tick is running.
+*
+* \param dec 		Pointer to the decoder context.
+* \param[out] stats 	Pointer to the snapshot.
+* \return
+*/
+void decoder_stats_snapshot(struct decoder_ctx *dec,
+                            struct decoder_stats *stats) {
+  *stats = dec->stats;
+  pthread_mutex_lock(&dec->read_lock);
+  stats->read_wait_ns = dec->read_wait_ns;
+  pthread_mutex_unlock(&dec->read_lock);
+  pthread_mutex_lock(&dec->parse_turn.lock);
+  stats->parse_wait_ns = dec->parse_turn.wait_ns;
+  pthread_mutex_unlock(&dec->parse_turn.lock);
+}
+
+/**
+* \brief Reset the decoder statistics
+*
+* Must not be called while a tick is running.
+*
+* \param dec Pointer to the decoder context.
+* \return
+*/
+void decoder_stats_reset(struct decoder_ctx *dec) {
+  stats_reset(&dec->stats);
+  pthread_mutex_lock(&dec->read_lock);
+  dec->read_wait_ns = 0;
+  pthread_mutex_unlock(&dec->read_lock);
+  turn_stats_reset(&dec->parse_turn);
+}
+
+/**
+* \brief Start the decoder threads
+*
+* Starts the decoder pool threads unless they are running already.
+*
+* \return
+*/
+void decoder_pool_start() {
+  if (!g_decoder.ready)
+    decoder_init(&g_decoder, NULL);
+  if (!g_decoder_pool.running) {
+    // pick the kernels before the threads need them
+    dle_scan_init();
+    crc32_update_init();
+    pool_start(&g_decoder_pool, g_decoder_threads);
   }
-  return NULL;
 }
 
 /**
 * \brief Decoder task periodic function
 *
-* This function spawns several decoder threads
+* This function wakes the decoder threads and waits until the available data is
+* decoded. The threads are started on the first call and parked between the
+* calls.
 *
 * \return
 */
 void TaskUpLink200Hz() {
-  packet_counter = 0;
-  uint8_t ints[N_THREADS];
-  pthread_t thread[N_THREADS];
   //! [Starting threads]
-  g_data_read_seq = 0;
-  for (uint8_t i = 0; i < N_THREADS; i++) {
-    ints[i] = i;
-    pthread_create(&thread[i], NULL, extract_data, &ints[i]);
-  }
+  decoder_pool_start();
+  decoder_tick_start(&g_decoder, g_decoder_pool.n_threads);
+  uint64_t bytes = g_decoder.stats.bytes_in;
+  uint64_t start = g_decoder.tune.on ? decoder_clock_ns() : 0;
+  pool_run(&g_decoder_pool, extract_data, &g_decoder);
+  packet_counter = g_decoder.packet_counter;
+  if (g_decoder.tune.on)
+    decoder_tune(&g_decoder, g_decoder.stats.bytes_in - bytes, start,
+                 decoder_clock_ns());
   //! [Starting threads]
-  for (uint8_t i = 0; i < N_THREADS; i++) {
-    pthread_join(thread[i], NULL);
+}
+
+/**
+* \brief Decode several streams
+*
+* Periodic function for the processes handling several streams, each with its
+* own decoder context. The decoder threads are shared between the streams, a
+* stream is decoded by a single thread at a time. In the per packet output mode
+* ParseTsipData() may be called from several threads at once.
+*
+* \param[in] dec 	Pointers to the decoder contexts.
+* \param[in] count 	Number of decoder contexts.
+* \return
+*/
+void TaskUpLinkStreams(struct decoder_ctx **dec, uint32_t count) {
+  decoder_pool_start();
+  struct stream_job job;
+  job.dec = dec;
+  job.count = count;
+  atomic_init(&job.next, 0);
+  for (uint32_t i = 0; i < count; i++) {
+    decoder_tick_start(dec[i], 1);
   }
-  printf("Decoded %u packets\n", packet_counter);
+  pool_run(&g_decoder_pool, extract_streams, &job);
 }
 
+/**
+* \brief Set the number of decoder threads
+*
+* The threads are restarted with the new count on the next call of
+* TaskUpLink200Hz(). Must not be called while a tick is running.
+*
+* \param[in] n_threads Number of threads, between 1 and POOL_MAX_THREADS.
+* \return
+*/
+void TaskUpLinkSetThreads(uint8_t n_threads) {
+  if (n_threads < 1)
+    n_threads = 1;
+  if (n_threads > POOL_MAX_THREADS)
+    n_threads = POOL_MAX_THREADS;
+  if (g_decoder_pool.running && g_decoder_pool.n_threads != n_threads) {
+    pool_stop(&g_decoder_pool);
+  }
+  g_decoder_threads = n_threads;
+}
+
+/**
+ * \brief Scheduling of the decoder threads.
+ */
+struct sched_status {
+  uint8_t threads;
+  //! threads pinned to a CPU, and running with a real-time priority
+  uint8_t pinned;
+  uint8_t realtime;
+};
+
+/**
+* \brief Set the scheduling of the decoder threads
+*
+* Pins the decoder threads to the given CPUs in turn, and runs them with the
+* SCHED_FIFO policy at the given priority, so that the other processes can't
+* hold up a tick. Applies to the running threads straight away, and to the
+* threads started later. A setting the process isn't permitted, like a
+* real-time priority without the privileges, is skipped and the threads keep
+* running as before, TaskUpLinkSchedStatus() tells what took effect. Must not
+* be called while a tick is running.
+*
+* \param[in] priority 	SCHED_FIFO priority, 0 for the default policy.
+* \param[in] cpu 		CPUs to pin the threads to, thread i to
+* cpu[i % n_cpus].
+* \param[in] n_cpus 	Number of CPUs, 0 to leave the threads unpinned.
+* \return 				True if all of it took effect on the running threads.
+*/
+bool TaskUpLinkSetSched(int priority, const uint16_t *cpu, uint8_t n_cpus) {
+  struct pool_sched sched;
+  memset(&sched, 0, sizeof(sched));
+  sched.priority = priority;
+  sched.n_cpus = min(n_cpus, (uint8_t)POOL_MAX_THREADS);
+  for (uint8_t i = 0; i < sched.n_cpus; i++) {
+    sched.cpu[i] = cpu[i];
+  }
+  return pool_set_sched(&g_decoder_pool, &sched);
+}
+
+/**
+* \brief Get the scheduling of the decoder threads
+*
+* \param[out] status Pointer to the scheduling, all zero while the threads
+* are not running.
+* \return
+*/
+void TaskUpLinkSchedStatus(struct sched_status *status) {
+  status->threads = g_decoder_pool.running ? g_decoder_pool.n_threads : 0;
+  status->pinned = g_decoder_pool.n_pinned;
+  status->realtime = g_decoder_pool.n_realtime;
+}
+
+/**
+* \brief Switch the low latency mode
+*
+* In the low latency mode every read from the source is decoded as soon as it
+* returns, instead of being gathered into a full block first, so a packet is
+* parsed as soon as the read holding its DLE ETX is done. Meant for a single
+* decoder thread on a live link, where a block takes a while to fill up. Must
+* not be called while a tick is running.
+*
+* \param[in] on Low latency mode switch.
+* \return
+*/
+void TaskUpLinkSetLowLatency(bool on) {
+  if (!g_decoder.ready)
+    decoder_init(&g_decoder, NULL);
+  g_decoder.low_latency = on;
+}
+
+/**
+ * \brief Block sizing of a decoder context.
+ */
+struct block_tuning {
+  uint32_t block_size;
+  uint32_t com_size;
+  bool auto_tune;
+  //! the last tick read enough to count as a bulk tick
+  bool bulk;
+  //! smoothed data rate and the decoder throughput of the last tick, in B/s
+  double rate;
+  double throughput;
+};
+
+/**
+* \brief Set the block size
+*
+* Sets the size of the block decoded by a thread at once, which takes effect on
+* the next tick. Small blocks have their packets parsed sooner, large ones take
+* less effort per byte. With the auto-tuner on, the tuner carries on from
+* the new size. Must not be called while a tick is running.
+*
+* \param[in] block_size Block size, between MIN_BLOCK_SIZE and
+* MAX_BLOCK_SIZE.
+* \return
+*/
+void TaskUpLinkSetBlockSize(uint32_t block_size) {
+  if (!g_decoder.ready)
+    decoder_init(&g_decoder, NULL);
+  g_decoder.block_size = max(min(block_size, (uint32_t)MAX_BLOCK_SIZE),
+                             (uint32_t)MIN_BLOCK_SIZE);
+  g_decoder.tune.k = tune_fit(&g_decoder.tune, g_decoder.block_size);
+}
+
+/**
+* \brief Set the maximum size of a COM read
+*
+* Must not be called while a tick is running.
+*
+* \param[in] com_size Maximum size of a single read from the COM interface,
+* at least 1.
+* \return
+*/
+void TaskUpLinkSetComSize(uint32_t com_size) {
+  if (!g_decoder.ready)
+    decoder_init(&g_decoder, NULL);
+  g_decoder.com_size = max(com_size, 1u);
+}
+
+/**
+* \brief Switch the block size auto-tuner
+*
+* The tuner times every tick and picks the block size for the next one. While
+* the ticks read only a few blocks per thread, as on a live link, the block
+* follows the data read per thread. While they read more, as in a bulk replay,
+* the block is the fastest size found, as long as a thread decodes it within
+* the latency limit. The COM reads follow the block size. Switching the tuner
+* off keeps the last sizes picked. Must not be called while a tick is running.
+*
+* \param[in] on 			Auto-tuner switch.
+* \param[in] latency_ns 	Time a thread may take to decode a block, 0 for no
+* limit.
+* \return
+*/
+void TaskUpLinkSetAutoTune(bool on, uint64_t latency_ns) {
+  if (!g_decoder.ready)
+    decoder_init(&g_decoder, NULL);
+  if (on && !g_decoder.tune.on)
+    tune_init(&g_decoder.tune, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE,
+              g_decoder.block_size);
+  g_decoder.tune.on = on;
+  g_decoder.tune.latency_ns = latency_ns;
+}
+
+/**
+* \brief Get the block sizing of the default decoder context
+*
+* Must not be called while a tick is running.
+*
+* \param[out] tuning Pointer to the block sizing.
+* \return
+*/
+void TaskUpLinkTuning(struct block_tuning *tuning) {
+  if (!g_decoder.ready)
+    decoder_init(&g_decoder, NULL);
+  tuning->block_size = g_decoder.block_size;
+  tuning->com_size = g_decoder.com_size;
+  tuning->auto_tune = g_decoder.tune.on;
+  tuning->bulk = g_decoder.tune.bulk;
+  tuning->rate = g_decoder.tune.rate;
+  tuning->throughput = g_decoder.tune.throughput;
+}
+
+/**
+* \brief Set the decoder input source
+*
+* The new source starts a new stream, so the stream state carried over from
+* the old one is dropped. Must not be called while a tick is running.
+*
+* \param[in] src Pointer to the source, NULL for the COM interface.
+* \return
+*/
+void TaskUpLinkSetSource(struct tsip_source *src) {
+  if (!g_decoder.ready)
+    decoder_init(&g_decoder, NULL);
+  g_decoder.source = src;
+  decoder_stream_reset(&g_decoder);
+}
+
+/**
+* \brief Switch the batch output mode
+*
+* In the batch mode the packets decoded within a tick are collected into a
+* preallocated arena instead of being passed to ParseTsipData() one by one.
+* The arena is emptied at the start of every tick, so the batch returned by
+* TaskUpLinkBatch() stays valid until the next tick. Must not be called while
+* a tick is running.
+*
+* \param[in] data_size 	Size of the packet data arena, at least
+* MAX_DATA_SIZE + 2 to hold the largest valid packet, 0 to switch the batch
+* mode off.
+* \param[in] size 		Maximum number of packets in a batch, at least 1.
+* \param[in] flush 		Handler called from within the tick when the arena
+* fills up, NULL to drop the excess packets.
+* \param[in] user 		Flush handler argument.
+* \return 				True if the batch mode is on.
+*/
+bool TaskUpLinkSetBatch(uint32_t data_size, uint32_t size,
+                        batch_flush_fn flush, void *user) {
+  if (!g_decoder.ready)
+    decoder_init(&g_decoder, NULL);
+  batch_free(&g_decoder.batch);
+  if (data_size < MAX_DATA_SIZE + 2 || size == 0 ||
+      !batch_init(&g_decoder.batch, data_size, size))
+    return false;
+  g_decoder.batch.flush = flush;
+  g_decoder.batch.user = user;
+  return true;
+}
+
+/**
+* \brief Get the packets decoded by the last tick in the batch mode
+*
+* \return Pointer to the batch.
+*/
+const struct packet_batch *TaskUpLinkBatch() { return &g_decoder.batch; }
+
+/**
+* \brief Get the statistics of the default decoder context
+*
+* The counters keep counting across the ticks, so the rates are the
+* differences between two snapshots. Must not be called while a tick is
+* running.
+*
+* \param[out] stats Pointer to the snapshot.
+* \return
+*/
+void TaskUpLinkStats(struct decoder_stats *stats) {
+  if (!g_decoder.ready)
+    decoder_init(&g_decoder, NULL);
+  decoder_stats_snapshot(&g_decoder, stats);
+}
+
+/**
+* \brief Reset the statistics of the default decoder context
+*
+* \param[in] latency Switch for the packet latency histogram, which takes two
+* clock reads per block.
+* \return
+*/
+void TaskUpLinkStatsReset(bool latency) {
+  if (!g_decoder.ready)
+    decoder_init(&g_decoder, NULL);
+  decoder_stats_reset(&g_decoder);
+  g_decoder.latency_timing = latency;
+}
+
+/**
+* \brief Stop the decoder threads
+*
+* Joins the decoder threads started by TaskUpLink200Hz().
+*
+* \return
+*/
+void TaskUpLinkShutdown() { pool_stop(&g_decoder_pool); }
+
 #endif
@@ -0,0 +1,332 @@
+/** @file tsip_frame.h
+ * \brief Header containing the parallel buffer decoder.
+ * Splits a large data buffer into chunks that are framed concurrently, and
+ * stitches the chunk boundaries together in a single serial pass
+*/
+#ifndef TSIP_FRAME_H
+#define TSIP_FRAME_H
+
+#include <stdlib.h>
+
+#include "tsip_decode.h"
+
+/**
+ * \brief Default chunk size of the parallel buffer decoder.
+ */
+#define FRAME_CHUNK_SIZE (1 << 20)
+/**
+ * \brief Maximum raw size of a packet, including the stuffing and the flags.
+ */
+#define FRAME_MAX_RAW (2 * (MAX_DATA_SIZE + 6) + 4)
+
+/**
+ * \brief Location of a framed packet within the framer output.
+ */
+struct frame_packet {
+  uint32_t offset;
+  uint32_t len;
+};
+
+/**
+ * \brief Packet framer state.
+ */
+struct frame_state {
+  bool dle;
+  bool in_packet;
+  uint32_t start;
+  uint8_t *out;
+  uint32_t out_len;
+  struct frame_packet *packet;
+  uint32_t packet_count;
+  uint32_t packet_size;
+  bool has_flag;
+  uint32_t first_flag;
+  uint32_t last_flag;
+  uint8_t first_flag_type;
+  uint8_t last_flag_type;
+};
+
+/**
+ * \brief Data chunk framed by a single thread.
+ */
+struct frame_chunk {
+  const uint8_t *raw;
+  uint32_t len;
+  struct frame_state state;
+};
+
+/**
+ * \brief Parallel framing job shared by the pool threads.
+ */
+struct frame_job {
+  struct frame_chunk *chunk;
+  uint8_t chunk_count;
+};
+
+/**
+* \brief Reset the framer.
+*
+* \param st Pointer to the framer state.
+* \return
+*/
+void frame_reset(struct frame_state *st) {
+  st->dle = false;
+  st->in_packet = false;
+  st->start = 0;
+  st->out_len = 0;
+  st->packet_count = 0;
+  st->has_flag = false;
+}
+
+/**
+* \brief Record a flag found by the framer.
+*
+* \param st 	Pointer to the framer state.
+* \param loc 	Raw data offset of the flag DLE.
+* \param type 	Flag type.
+* \return
+*/
+void frame_flag(struct frame_state *st, uint32_t loc, uint8_t type) {
+  if (!st->has_flag) {
+    st->has_flag = true;
+    st->first_flag = loc;
+    st->first_flag_type = type;
+  }
+  st->last_flag = loc;
+  st->last_flag_type = type;
+}
+
+/**
+* \brief Frame raw data.
+*
+* Removes the escape characters, and validates the packets enclosed by the
+* start and end flags. A packet is validated as soon as its end flag is found,
+* while it's still in the cache. The valid packets are kept in the framer
+* output, while the invalid ones are discarded. The framer state carries over
+* to the next call, so the data can be fed in pieces.
+*
+* \param st 	Pointer to the framer state.
+* \param raw 	Pointer to the raw data.
+* \param len 	Size of the raw data.
+* \param base 	Offset of the raw data, used for the flag locations.
+* \return
+*/
+void frame_feed(struct frame_state *st, const uint8_t *raw, uint32_t len,
+                uint32_t base) {
+  uint32_t i = 0;
+  while (i < len) {
+    if (!st->dle) {
+      // take in the data up to the next DLE
+      uint32_t next = g_dle_scan(raw, i, len);
+      if (st->in_packet) {
+        if (st->out_len - st->start + next - i > MAX_DATA_SIZE + 6) {
+          // too long to be a valid packet
+          st->in_packet = false;
+          st->out_len = st->start;
+        } else {
+          memcpy(st->out + st->out_len, raw + i, next - i);
+          st->out_len += next - i;
+        }
+      }
+      if (next == len)
+        break;
+      st->dle = true;
+      i = next + 1;
+      continue;
+    }
+    uint8_t c = raw[i];
+    st->dle = false;
+    if (c == ETX) {
+      // end of packet
+      frame_flag(st, base + i - 1, end_flag);
+      if (st->in_packet) {
+        st->in_packet = false;
+        uint32_t crc = crc32_update(CRC32_INIT, st->out + st->start,
+                                    st->out_len - st->start);
+        if (validate_packet_crc(st->out, st->start, st->out_len, crc) == 0 &&
+            st->packet_count < st->packet_size) {
+          st->packet[st->packet_count].offset = st->start;
+          st->packet[st->packet_count].len = st->out_len - st->start;
+          st->packet_count++;
+          st->start = st->out_len;
+        } else {
+          st->out_len = st->start;
+        }
+      }
+    } else {
+      if (c != DLE) {
+        // data start, drop the unfinished packet if there's one
+        frame_flag(st, base + i - 1, start_flag);
+        st->in_packet = true;
+        st->out_len = st->start;
+      }
+      if (st->in_packet) {
+        if (st->out_len - st->start == MAX_DATA_SIZE + 6) {
+          // too long to be a valid packet
+          st->in_packet = false;
+          st->out_len = st->start;
+        } else {
+          st->out[st->out_len++] = c;
+        }
+      }
+    }
+    i++;
+  }
+}
+
+/**
+* \brief Parse the framed packets.
+*
+* Passes the valid packets to the parser and clears the framer output. An
+* unfinished packet is moved to the start of the output.
+*
+* \param st Pointer to the framer state.
+* \return
+*/
+void frame_dispatch(struct frame_state *st) {
+  for (uint32_t i = 0; i < st->packet_count; i++) {
+    ParseTsipData(st->out + st->packet[i].offset, st->packet[i].len - 4);
+    packet_counter++;
+  }
+  st->packet_count = 0;
+  if (st->in_packet) {
+    memmove(st->out, st->out + st->start, st->out_len - st->start);
+    st->out_len -= st->start;
+  } else {
+    st->out_len = 0;
+  }
+  st->start = 0;
+}
+
+/**
+* \brief Chunk framing thread function
+*
+* Frames a single chunk. The chunk may start in the middle of a DLE pair, so
+* the framing starts after the first non-DLE byte, where the escape state is
+* the same regardless of the preceding data. The bytes before it are framed
+* by frame_buffer_parallel() once the state is known.
+*
+* \param[in] id 	Thread id.
+* \param[in] arg 	Pointer to the framing job.
+* \return
+*/
+void frame_chunk_task(uint8_t id, void *arg) {
+  struct frame_job *job = (struct frame_job *)arg;
+  if (id >= job->chunk_count)
+    return;
+  struct frame_chunk *chunk = &job->chunk[id];
+  uint32_t sync = 0;
+  while (sync < chunk->len && chunk->raw[sync] == DLE) {
+    sync++;
+  }
+  sync = min(sync + 1, chunk->len);
+  frame_reset(&chunk->state);
+  frame_feed(&chunk->state, chunk->raw + sync, chunk->len - sync, sync);
+}
+
+/**
+* \brief Stitch a framed chunk to the preceding data.
+*
+* Frames the chunk head up to its first flag and passes on the packets found
+* by the chunk thread. The trailing part of the chunk is carried on to the next
+* chunk.
+*
+* \param carry 	Pointer to the state carried between the chunks.
+* \param chunk 	Pointer to the framed chunk.
+* \return
+*/
+void frame_stitch(struct frame_state *carry, struct frame_chunk *chunk) {
+  struct frame_state *st = &chunk->state;
+  if (!st->has_flag) {
+    // nothing to synchronize on, frame the whole chunk in order
+    frame_feed(carry, chunk->raw, chunk->len, 0);
+    frame_dispatch(carry);
+    return;
+  }
+  // frame the chunk head, finishing a packet from the preceding chunk
+  uint32_t head = st->first_flag;
+  if (st->first_flag_type == end_flag)
+    head += 2;
+  frame_feed(carry, chunk->raw, head, 0);
+  frame_dispatch(carry);
+  // from the first flag on the chunk framing is exact
+  frame_dispatch(st);
+  // carry the unfinished packet on to the next chunk
+  frame_reset(carry);
+  if (st->last_flag_type == start_flag &&
+      chunk->len - st->last_flag <= FRAME_MAX_RAW) {
+    frame_feed(carry, chunk->raw + st->last_flag,
+               chunk->len - st->last_flag, 0);
+  } else {
+    carry->dle = st->dle;
+  }
+}
+
+/**
+* \brief Decode a data buffer using all decoder threads
+*
+* Offline counterpart of TaskUpLink200Hz(). The buffer is split into chunks,
+* one per decoder thread, which are framed concurrently. The chunk boundaries
+* are then stitched together serially and the packets are parsed in order.
+*
+* \param[in] buf 		Pointer to the data buffer.
+* \param[in] len 		Size of the data buffer.
+* \param[in] chunk_size 	Chunk size, FRAME_CHUNK_SIZE if 0.
+* \return 				Number of decoded packets, 0 if out of memory.
+*/
+uint32_t frame_buffer_parallel(const uint8_t *buf, const uint64_t len,
+                               uint32_t chunk_size) {
+  if (chunk_size == 0)
+    chunk_size = FRAME_CHUNK_SIZE;
+  packet_counter = 0;
+  decoder_pool_start();
+  uint8_t n_chunks = g_decoder_pool.n_threads;
+
+  struct frame_chunk *chunk =
+      (struct frame_chunk *)calloc(n_chunks, sizeof(struct frame_chunk));
+  if (chunk == NULL)
+    return 0;
+  bool ok = true;
+  for (uint8_t i = 0; i < n_chunks && ok; i++) {
+    chunk[i].state.out = (uint8_t *)malloc(chunk_size + MAX_DATA_SIZE + 6);
+    chunk[i].state.packet_size = chunk_size / 4 + 1;
+    chunk[i].state.packet = (struct frame_packet *)malloc(
+        chunk[i].state.packet_size * sizeof(struct frame_packet));
+    ok = chunk[i].state.out != NULL && chunk[i].state.packet != NULL;
+  }
+  uint8_t carry_out[3 * (MAX_DATA_SIZE + 6)];
+  struct frame_packet carry_packet[2];
+  struct frame_state carry;
+  carry.out = carry_out;
+  carry.packet = carry_packet;
+  carry.packet_size = 2;
+  frame_reset(&carry);
+
+  struct frame_job job;
+  job.chunk = chunk;
+  uint64_t pos = ok ? 0 : len;
+  while (pos < len) {
+    // frame the next round of chunks concurrently
+    job.chunk_count = 0;
+    while (job.chunk_count < n_chunks && pos < len) {
+      chunk[job.chunk_count].raw = buf + pos;
+      chunk[job.chunk_count].len = min((uint64_t)chunk_size, len - pos);
+      pos += chunk[job.chunk_count].len;
+      job.chunk_count++;
+    }
+    pool_run(&g_decoder_pool, frame_chunk_task, &job);
+    // stitch them together in order
+    for (uint8_t i = 0; i < job.chunk_count; i++) {
+      frame_stitch(&carry, &chunk[i]);
+    }
+  }
+
+  for (uint8_t i = 0; i < n_chunks; i++) {
+    free(chunk[i].state.out);
+    free(chunk[i].state.packet);
+  }
+  free(chunk);
+  return packet_counter;
+}
+
+#endif
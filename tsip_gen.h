@@ -0,0 +1,325 @@
+/** @file tsip_gen.h
+ * \brief Header containing the synthetic traffic generator.
+ * Generates stuffed and checksummed TSIP packets with a configurable packet
+ * mix, DLE density and corruption, to a file or straight into the decoder
+*/
+#ifndef TSIP_GEN_H
+#define TSIP_GEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tsip_decode.h"
+
+/**
+ * \brief Maximum size of a generated packet, stuffing and garbage included.
+ */
+#define GEN_MAX_FRAME (2 * (MAX_DATA_SIZE + 6) + 4 + 2 * MAX_DATA_SIZE)
+
+/**
+ * \brief Generated packet type.
+ */
+struct gen_id {
+  uint8_t id1;
+  uint8_t id2;
+  uint16_t min_len;
+  uint16_t max_len;
+  uint32_t weight;
+};
+
+/**
+ * \brief Traffic generator configuration.
+ *
+ * The rates are the probabilities of a packet being corrupted in the given
+ * way.
+ */
+struct gen_config {
+  //! packet types to pick from, by weight
+  const struct gen_id *ids;
+  uint8_t n_ids;
+  //! fraction of the payload bytes set to DLE
+  double dle_fraction;
+  //! single bit flip anywhere in the packet
+  double bit_flip_rate;
+  //! packet cut short at a random point
+  double truncate_rate;
+  //! run of random bytes after the packet
+  double garbage_rate;
+  uint16_t garbage_max;
+  uint64_t seed;
+};
+
+/**
+ * \brief Traffic generator state and statistics.
+ */
+struct gen_state {
+  struct gen_config cfg;
+  uint64_t rng;
+  uint32_t total_weight;
+  //! generated packet, not yet handed out
+  uint8_t frame[GEN_MAX_FRAME];
+  uint32_t frame_len;
+  uint32_t frame_pos;
+  bool frame_intact;
+  //! generated packets, the intact ones among them and the corruptions
+  uint64_t packets;
+  uint64_t intact;
+  uint64_t flipped;
+  uint64_t truncated;
+  uint64_t garbage_bytes;
+};
+
+/**
+ * \brief Packet mix of the sample data.
+ */
+const struct gen_id gen_sample_ids[] = {
+    {0xA5, 0x09, 43, 43, 1},
+    {0xA5, 0x0A, 18, 18, 1},
+    {0x39, 0x02, 8, 8, 1},
+};
+
+/**
+ * \brief Packet mix with every payload size up to MAX_DATA_SIZE.
+ */
+const struct gen_id gen_mixed_ids[] = {
+    {0xA5, 0x09, 43, 43, 4},           {0xA5, 0x0A, 18, 18, 4},
+    {0x39, 0x02, 8, 8, 4},             {0x8F, 0x20, 0, 64, 2},
+    {0x47, 0x01, 64, MAX_DATA_SIZE, 1}, {0x11, DLE, 0, 16, 1},
+};
+
+/**
+* \brief Draw the next pseudo-random number.
+*
+* \param gen Pointer to the generator.
+* \return 	Random number.
+*/
+uint64_t gen_rand(struct gen_state *gen) {
+  // xorshift64*
+  gen->rng ^= gen->rng >> 12;
+  gen->rng ^= gen->rng << 25;
+  gen->rng ^= gen->rng >> 27;
+  return gen->rng * 0x2545F4914F6CDD1Dull;
+}
+
+/**
+* \brief Draw a pseudo-random event.
+*
+* \param gen 	Pointer to the generator.
+* \param p 		Event probability.
+* \return 		True if the event occurs.
+*/
+bool gen_chance(struct gen_state *gen, double p) {
+  return p > 0 && (gen_rand(gen) >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+/**
+* \brief Initialize the generator.
+*
+* \param gen Pointer to the generator.
+* \param cfg Pointer to the configuration.
+* \return
+*/
+void gen_init(struct gen_state *gen, const struct gen_config *cfg) {
+  memset(gen, 0, sizeof(*gen));
+  gen->cfg = *cfg;
+  gen->rng = cfg->seed ? cfg->seed : 1;
+  for (uint8_t i = 0; i < cfg->n_ids; i++) {
+    gen->total_weight += cfg->ids[i].weight;
+  }
+}
+
+/**
+* \brief Append a byte to the packet, stuffing it if it's a DLE.
+*
+* \param out 	Pointer to the packet.
+* \param len 	Packet size.
+* \param c 		Byte.
+* \return
+*/
+void gen_put(uint8_t *out, uint32_t *len, uint8_t c) {
+  out[(*len)++] = c;
+  if (c == DLE)
+    out[(*len)++] = DLE;
+}
+
+/**
+* \brief Generate a packet.
+*
+* Picks a packet type by weight, fills the payload and stuffs the packet, then
+* applies the corruptions drawn for it.
+*
+* \param gen Pointer to the generator.
+* \param out Pointer to the destination, at least GEN_MAX_FRAME bytes.
+* \return 	Size of the packet.
+*/
+uint32_t gen_packet(struct gen_state *gen, uint8_t *out) {
+  const struct gen_config *cfg = &gen->cfg;
+  uint32_t w = gen->total_weight ? gen_rand(gen) % gen->total_weight : 0;
+  uint8_t k = 0;
+  while (k + 1 < cfg->n_ids && w >= cfg->ids[k].weight) {
+    w -= cfg->ids[k].weight;
+    k++;
+  }
+  const struct gen_id *id = &cfg->ids[k];
+  uint32_t payload_len =
+      id->min_len + gen_rand(gen) % (id->max_len - id->min_len + 1);
+  payload_len = min(payload_len, (uint32_t)MAX_DATA_SIZE);
+
+  uint8_t data[MAX_DATA_SIZE + 6];
+  data[0] = id->id1;
+  data[1] = id->id2;
+  for (uint32_t i = 0; i < payload_len; i++) {
+    data[2 + i] =
+        gen_chance(gen, cfg->dle_fraction) ? DLE : gen_rand(gen) & 0xFF;
+  }
+  uint32_t crc = crc32(data, 0, payload_len + 2);
+  for (uint8_t i = 0; i < 4; i++) {
+    data[payload_len + 2 + i] = crc >> (8 * i);
+  }
+
+  uint32_t len = 0;
+  out[len++] = DLE;
+  for (uint32_t i = 0; i < payload_len + 6; i++) {
+    gen_put(out, &len, data[i]);
+  }
+  out[len++] = DLE;
+  out[len++] = ETX;
+
+  gen->packets++;
+  bool intact = true;
+  if (gen_chance(gen, cfg->bit_flip_rate)) {
+    out[gen_rand(gen) % len] ^= 1 << (gen_rand(gen) % 8);
+    gen->flipped++;
+    intact = false;
+  }
+  if (gen_chance(gen, cfg->truncate_rate)) {
+    len = gen_rand(gen) % len;
+    gen->truncated++;
+    intact = false;
+  }
+  if (intact)
+    gen->intact++;
+  gen->frame_intact = intact;
+  if (cfg->garbage_max > 0 && gen_chance(gen, cfg->garbage_rate)) {
+    uint32_t n = 1 + gen_rand(gen) % cfg->garbage_max;
+    n = min(n, (uint32_t)(GEN_MAX_FRAME - len));
+    for (uint32_t i = 0; i < n; i++) {
+      out[len++] = gen_rand(gen) & 0xFF;
+    }
+    gen->garbage_bytes += n;
+  }
+  return len;
+}
+
+/**
+* \brief Fill a buffer with generated packets.
+*
+* \param gen Pointer to the generator.
+* \param buf Pointer to the buffer.
+* \param len Size of the buffer.
+* \return 	Number of bytes written, only whole packets are written.
+*/
+uint64_t gen_fill(struct gen_state *gen, uint8_t *buf, uint64_t len) {
+  uint64_t pos = 0;
+  while (true) {
+    if (gen->frame_pos == gen->frame_len) {
+      gen->frame_len = gen_packet(gen, gen->frame);
+      gen->frame_pos = 0;
+    }
+    // the packet that doesn't fit is kept for the next call
+    if (pos + gen->frame_len > len)
+      break;
+    memcpy(buf + pos, gen->frame, gen->frame_len);
+    pos += gen->frame_len;
+    gen->frame_pos = gen->frame_len;
+  }
+  return pos;
+}
+
+/**
+* \brief Discard the packet kept by gen_fill(), along with its statistics.
+*
+* \param gen Pointer to the generator.
+* \return
+*/
+void gen_drop_pending(struct gen_state *gen) {
+  if (gen->frame_pos == 0 && gen->frame_len > 0) {
+    gen->packets--;
+    if (gen->frame_intact)
+      gen->intact--;
+  }
+  gen->frame_pos = gen->frame_len = 0;
+}
+
+/**
+* \brief Write generated packets to a file.
+*
+* \param gen 	Pointer to the generator.
+* \param fname 	File name.
+* \param len 	Approximate size of the file.
+* \return 		True if the file was written.
+*/
+bool gen_file(struct gen_state *gen, const char *fname, uint64_t len) {
+  FILE *f = fopen(fname, "wb");
+  if (f == NULL)
+    return false;
+  uint8_t buf[64 << 10];
+  uint64_t written = 0;
+  while (written < len) {
+    uint64_t n = gen_fill(gen, buf, min((uint64_t)sizeof(buf), len - written));
+    if (n == 0 || fwrite(buf, 1, n, f) != n)
+      break;
+    written += n;
+  }
+  gen_drop_pending(gen);
+  fclose(f);
+  return written > 0;
+}
+
+/**
+* \brief Read from the traffic generator.
+*
+* \param src 		Pointer to the source.
+* \param scratch 	Pointer to the copy destination.
+* \param data 		Pointer to the read data.
+* \param count 		Maximum number of bytes to be read.
+* \return 			Number of read bytes.
+*/
+uint32_t source_gen_read(struct tsip_source *src, uint8_t *scratch,
+                         const uint8_t **data, uint32_t count) {
+  struct gen_state *gen = (struct gen_state *)src->ctx;
+  count = min((uint64_t)count, src->len - src->pos);
+  uint32_t len = 0;
+  while (len < count) {
+    if (gen->frame_pos == gen->frame_len) {
+      gen->frame_len = gen_packet(gen, gen->frame);
+      gen->frame_pos = 0;
+    }
+    uint32_t n = min(count - len, gen->frame_len - gen->frame_pos);
+    memcpy(scratch + len, gen->frame + gen->frame_pos, n);
+    gen->frame_pos += n;
+    len += n;
+  }
+  *data = scratch;
+  src->pos += len;
+  return len;
+}
+
+/**
+* \brief Set up a source streaming generated packets into the decoder.
+*
+* \param src 	Pointer to the source.
+* \param gen 	Pointer to the generator.
+* \param len 	Number of bytes to stream.
+* \return
+*/
+void source_gen_init(struct tsip_source *src, struct gen_state *gen,
+                     uint64_t len) {
+  source_mem_init(src, NULL, len);
+  src->read = source_gen_read;
+  src->ctx = gen;
+}
+
+#endif
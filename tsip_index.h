@@ -0,0 +1,575 @@
+/** @file tsip_index.h
+ * \brief Header containing the packet offset index.
+ * Scans a raw data buffer once and records the location, ID, size and
+ * validity of every packet, so that selected packets or packet ranges can be
+ * decoded later without rescanning the data
+*/
+#ifndef TSIP_INDEX_H
+#define TSIP_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsip_frame.h"
+
+/**
+ * \brief Index file magic.
+ */
+#define INDEX_MAGIC "TSIPIDX1"
+/**
+ * \brief Index file format version.
+ */
+#define INDEX_VERSION 2
+/**
+ * \brief Byte order mark of the index file header, read back as is on a host
+ * with the byte order of the writer.
+ */
+#define INDEX_BYTE_ORDER 0x01020304
+/**
+ * \brief Packet ID matching any packet in the index queries.
+ */
+#define INDEX_ANY_ID 0xFFFFFFFFu
+
+/**
+ * \brief Packet key of an ID pair, as used by the index queries.
+ */
+#define INDEX_ID(id1, id2) ((uint32_t)(id1) << 8 | (id2))
+
+/**
+ * \brief Index file header, followed by the entries.
+ *
+ * The header and the entries are in the byte order of the writer, given by
+ * byte_order, so they are used straight from a memory mapping.
+ */
+struct index_header {
+  char magic[8];
+  uint32_t version;
+  //! INDEX_BYTE_ORDER in the byte order of the writer
+  uint32_t byte_order;
+  uint32_t entry_size;
+  uint32_t reserved;
+  //! size of the indexed data
+  uint64_t data_len;
+  uint64_t count;
+  //! number of entries passing the validation
+  uint64_t valid;
+};
+
+/**
+ * \brief Index entry of a packet enclosed by a start and an end flag.
+ */
+struct index_entry {
+  //! data offset of the DLE starting the packet
+  uint64_t offset;
+  //! raw size up to and including the DLE ETX
+  uint16_t raw_len;
+  //! packet size without the stuffing, including the checksum
+  uint16_t len;
+  uint8_t id1;
+  uint8_t id2;
+  //! validation error, 0 for a valid packet
+  uint8_t status;
+  uint8_t reserved;
+};
+
+/**
+ * \brief Packet index, built in memory or mapped from a file.
+ */
+struct packet_index {
+  struct index_header hdr;
+  struct index_entry *entry;
+  uint64_t size;
+  //! index file mapping, the entries point into it once loaded
+  struct tsip_source map;
+};
+
+/**
+ * \brief Part of the data indexed by a single thread.
+ *
+ * The part owns the packets starting from begin up to end, and scans past the
+ * end to finish the last one.
+ */
+struct index_part {
+  uint64_t begin;
+  uint64_t end;
+  struct index_entry *entry;
+  uint64_t count;
+  uint64_t size;
+  bool failed;
+};
+
+/**
+ * \brief Parallel indexing job shared by the pool threads.
+ */
+struct index_job {
+  const uint8_t *buf;
+  uint64_t len;
+  struct index_part *part;
+  uint8_t part_count;
+};
+
+/**
+ * \brief Parallel indexed decoding job shared by the pool threads.
+ */
+struct index_decode_job {
+  const uint8_t *buf;
+  const struct packet_index *idx;
+  uint32_t id;
+  //! entry bounds of the parts, one more than the parts
+  uint64_t bound[POOL_MAX_THREADS + 1];
+  struct frame_state *state;
+  uint8_t part_count;
+};
+
+/**
+* \brief Initialize an empty index.
+*
+* \param idx Pointer to the index.
+* \return
+*/
+void index_init(struct packet_index *idx) {
+  memset(idx, 0, sizeof(*idx));
+  memcpy(idx->hdr.magic, INDEX_MAGIC, sizeof(idx->hdr.magic));
+  idx->hdr.version = INDEX_VERSION;
+  idx->hdr.byte_order = INDEX_BYTE_ORDER;
+  idx->hdr.entry_size = sizeof(struct index_entry);
+  source_mem_init(&idx->map, NULL, 0);
+}
+
+/**
+* \brief Free an index, built or loaded.
+*
+* \param idx Pointer to the index.
+* \return
+*/
+void index_free(struct packet_index *idx) {
+  if (idx->map.map != NULL)
+    source_close(&idx->map);
+  else
+    free(idx->entry);
+  index_init(idx);
+}
+
+/**
+* \brief Append entries to a growing entry table.
+*
+* \param table 	Pointer to the table.
+* \param count 	Pointer to the number of entries, increased.
+* \param size 	Pointer to the capacity of the table.
+* \param e 		Pointer to the entries.
+* \param n 		Number of entries.
+* \return 		True if the entries were added.
+*/
+bool index_table_add(struct index_entry **table, uint64_t *count,
+                     uint64_t *size, const struct index_entry *e, uint64_t n) {
+  if (n == 0)
+    return true;
+  if (*count + n > *size) {
+    uint64_t s = *size ? *size : 1024;
+    while (s < *count + n) {
+      s *= 2;
+    }
+    struct index_entry *t =
+        (struct index_entry *)realloc(*table, s * sizeof(*t));
+    if (t == NULL)
+      return false;
+    *table = t;
+    *size = s;
+  }
+  memcpy(*table + *count, e, n * sizeof(*e));
+  *count += n;
+  return true;
+}
+
+/**
+* \brief Find the first data offset with a known escape state.
+*
+* The state after a non-DLE byte is the same regardless of the preceding data,
+* see frame_chunk_task().
+*
+* \param buf 	Pointer to the data.
+* \param len 	Size of the data.
+* \param pos 	Offset to start looking from.
+* \return 		Offset following the first non-DLE byte, the data size if
+* there's none.
+*/
+uint64_t index_sync(const uint8_t *buf, uint64_t len, uint64_t pos) {
+  while (pos < len && buf[pos] == DLE) {
+    pos++;
+  }
+  return min(pos + 1, len);
+}
+
+/**
+* \brief Index the packets of a data part.
+*
+* Follows the same framing rules as frame_feed(): a start flag drops an
+* unfinished packet, and a packet outgrowing the maximum size is dropped. The
+* packets are checked by validate_packet_crc() as soon as they end, and only
+* the ID bytes are kept.
+*
+* \param part 	Pointer to the part.
+* \param buf 	Pointer to the data.
+* \param len 	Size of the data.
+* \return
+*/
+void index_scan(struct index_part *part, const uint8_t *buf, uint64_t len) {
+  uint64_t i = part->begin;
+  uint64_t start = 0;
+  uint32_t dlen = 0;
+  uint32_t crc = 0;
+  uint8_t id[2] = {0};
+  bool dle = false;
+  bool in_packet = false;
+  part->count = 0;
+  part->failed = false;
+  while (i < len) {
+    if (!dle) {
+      // take in the data up to the next DLE, past the end only within a packet
+      uint64_t stop = in_packet ? len : part->end;
+      if (i >= stop)
+        break;
+      uint32_t n = min(stop - i, (uint64_t)FRAME_CHUNK_SIZE);
+      uint32_t next = g_dle_scan(buf + i, 0, n);
+      if (in_packet) {
+        if (dlen + next > MAX_DATA_SIZE + 6) {
+          // too long to be a valid packet
+          in_packet = false;
+        } else {
+          for (uint32_t k = 0; dlen + k < 2 && k < next; k++) {
+            id[dlen + k] = buf[i + k];
+          }
+          crc = crc32_update(crc, buf + i, next);
+          dlen += next;
+        }
+      }
+      i += next;
+      if (next < n) {
+        dle = true;
+        i++;
+      }
+      continue;
+    }
+    uint8_t c = buf[i];
+    dle = false;
+    if (c == ETX) {
+      // end of packet
+      if (in_packet) {
+        in_packet = false;
+        struct index_entry e;
+        e.offset = start;
+        e.raw_len = i + 1 - start;
+        e.len = dlen;
+        e.id1 = id[0];
+        e.id2 = id[1];
+        e.status = validate_packet_crc(id, 0, dlen, crc);
+        e.reserved = 0;
+        if (!index_table_add(&part->entry, &part->count, &part->size, &e, 1))
+          part->failed = true;
+      }
+    } else if (c == DLE) {
+      // escaped DLE
+      if (in_packet) {
+        if (dlen == MAX_DATA_SIZE + 6) {
+          in_packet = false;
+        } else {
+          if (dlen < 2)
+            id[dlen] = c;
+          crc = crc32_byte(crc, c);
+          dlen++;
+        }
+      }
+    } else {
+      // packet start, the parts past the end belong to the next part
+      if (i - 1 >= part->end)
+        break;
+      in_packet = true;
+      start = i - 1;
+      id[0] = c;
+      dlen = 1;
+      crc = crc32_byte(CRC32_INIT, c);
+    }
+    i++;
+  }
+}
+
+/**
+* \brief Part indexing thread function
+*
+* \param[in] id 	Thread id.
+* \param[in] arg 	Pointer to the indexing job.
+* \return
+*/
+void index_scan_task(uint8_t id, void *arg) {
+  struct index_job *job = (struct index_job *)arg;
+  if (id >= job->part_count)
+    return;
+  index_scan(&job->part[id], job->buf, job->len);
+}
+
+/**
+* \brief Build the packet index of a data buffer using all decoder threads
+*
+* The buffer is split into chunks like in frame_buffer_parallel(). Every
+* thread starts indexing its chunk where the escape state is known, and
+* finishes the packet crossing into the next chunk, so the chunks need no
+* stitching and the entries come out in order.
+*
+* \param[out] idx 		Pointer to the index, initialized.
+* \param[in] buf 		Pointer to the data buffer.
+* \param[in] len 		Size of the data buffer.
+* \param[in] chunk_size 	Chunk size, FRAME_CHUNK_SIZE if 0.
+* \return 				True if the index was built.
+*/
+bool index_build(struct packet_index *idx, const uint8_t *buf, uint64_t len,
+                 uint32_t chunk_size) {
+  if (chunk_size == 0)
+    chunk_size = FRAME_CHUNK_SIZE;
+  index_init(idx);
+  idx->hdr.data_len = len;
+  decoder_pool_start();
+  uint8_t n_parts = g_decoder_pool.n_threads;
+  struct index_part part[POOL_MAX_THREADS];
+  memset(part, 0, sizeof(part));
+
+  struct index_job job;
+  job.buf = buf;
+  job.len = len;
+  job.part = part;
+  bool ok = true;
+  // the first part starts in a clean state
+  uint64_t pos = 0;
+  uint64_t begin = 0;
+  while (ok && begin < len) {
+    // index the next round of chunks concurrently
+    job.part_count = 0;
+    while (job.part_count < n_parts && pos < len) {
+      pos = min(pos + chunk_size, len);
+      part[job.part_count].begin = begin;
+      begin = index_sync(buf, len, pos);
+      part[job.part_count].end = begin;
+      job.part_count++;
+    }
+    pool_run(&g_decoder_pool, index_scan_task, &job);
+    for (uint8_t i = 0; i < job.part_count; i++) {
+      ok = ok && !part[i].failed &&
+           index_table_add(&idx->entry, &idx->hdr.count, &idx->size,
+                           part[i].entry, part[i].count);
+    }
+  }
+  for (uint8_t i = 0; i < n_parts; i++) {
+    free(part[i].entry);
+  }
+  for (uint64_t i = 0; i < idx->hdr.count; i++) {
+    idx->hdr.valid += idx->entry[i].status == none;
+  }
+  if (!ok)
+    index_free(idx);
+  return ok;
+}
+
+/**
+* \brief Write an index file.
+*
+* \param idx 	Pointer to the index.
+* \param fname 	File name.
+* \return 		True if the file was written.
+*/
+bool index_save(const struct packet_index *idx, const char *fname) {
+  FILE *f = fopen(fname, "wb");
+  if (f == NULL)
+    return false;
+  bool ok = fwrite(&idx->hdr, sizeof(idx->hdr), 1, f) == 1 &&
+            fwrite(idx->entry, sizeof(struct index_entry), idx->hdr.count,
+                   f) == idx->hdr.count;
+  return fclose(f) == 0 && ok;
+}
+
+/**
+* \brief Map an index file.
+*
+* \param idx 		Pointer to the index.
+* \param fname 		File name.
+* \param data_len 	Size of the indexed data, checked against the index.
+* \return 			True if the file is a valid index of the data, written with
+* the host byte order.
+*/
+bool index_load(struct packet_index *idx, const char *fname,
+                uint64_t data_len) {
+  index_init(idx);
+  if (!source_mmap_open(&idx->map, fname))
+    return false;
+  const struct index_header *h = (const struct index_header *)idx->map.data;
+  uint64_t len = idx->map.len;
+  if (len < sizeof(*h) || memcmp(h->magic, INDEX_MAGIC, 8) != 0 ||
+      h->version != INDEX_VERSION || h->byte_order != INDEX_BYTE_ORDER ||
+      h->entry_size != sizeof(struct index_entry) ||
+      h->data_len != data_len ||
+      h->count > (len - sizeof(*h)) / sizeof(struct index_entry)) {
+    index_free(idx);
+    return false;
+  }
+  idx->hdr = *h;
+  idx->entry = (struct index_entry *)(idx->map.data + sizeof(*h));
+  return true;
+}
+
+/**
+* \brief Find the next packet with a given ID.
+*
+* \param idx 	Pointer to the index.
+* \param from 	Entry to start looking from.
+* \param id 	Packet key, INDEX_ID() of the IDs.
+* \return 		Entry of the packet, the number of entries if there's none.
+*/
+uint64_t index_find(const struct packet_index *idx, uint64_t from,
+                    uint32_t id) {
+  for (uint64_t i = from; i < idx->hdr.count; i++) {
+    if (INDEX_ID(idx->entry[i].id1, idx->entry[i].id2) == id)
+      return i;
+  }
+  return idx->hdr.count;
+}
+
+/**
+* \brief Find the first packet starting at or after a data offset.
+*
+* \param idx 		Pointer to the index.
+* \param offset 	Data offset.
+* \return 			Entry of the packet, the number of entries if there's
+* none.
+*/
+uint64_t index_locate(const struct packet_index *idx, uint64_t offset) {
+  uint64_t lo = 0, hi = idx->hdr.count;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (idx->entry[mid].offset < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+* \brief Split a packet range into parts of about the same data size.
+*
+* \param idx 		Pointer to the index.
+* \param first 		First entry of the range.
+* \param last 		Entry past the range.
+* \param parts 		Number of parts.
+* \param[out] bound Entry bounds of the parts, parts + 1 of them.
+* \return
+*/
+void index_split(const struct packet_index *idx, uint64_t first, uint64_t last,
+                 uint32_t parts, uint64_t *bound) {
+  bound[0] = first;
+  bound[parts] = last;
+  if (first >= last) {
+    for (uint32_t i = 1; i < parts; i++) {
+      bound[i] = last;
+    }
+    return;
+  }
+  uint64_t begin = idx->entry[first].offset;
+  uint64_t span =
+      idx->entry[last - 1].offset + idx->entry[last - 1].raw_len - begin;
+  for (uint32_t i = 1; i < parts; i++) {
+    uint64_t b = index_locate(idx, begin + span * i / parts);
+    bound[i] = min(max(b, first), last);
+  }
+}
+
+/**
+* \brief Indexed decoding thread function
+*
+* Frames the valid packets of a part that match the job ID, straight from
+* their data offsets.
+*
+* \param[in] id 	Thread id.
+* \param[in] arg 	Pointer to the decoding job.
+* \return
+*/
+void index_decode_task(uint8_t id, void *arg) {
+  struct index_decode_job *job = (struct index_decode_job *)arg;
+  if (id >= job->part_count)
+    return;
+  struct frame_state *st = &job->state[id];
+  frame_reset(st);
+  for (uint64_t i = job->bound[id]; i < job->bound[id + 1]; i++) {
+    const struct index_entry *e = &job->idx->entry[i];
+    if (e->status == none &&
+        (job->id == INDEX_ANY_ID || INDEX_ID(e->id1, e->id2) == job->id))
+      frame_feed(st, job->buf + e->offset, e->raw_len, 0);
+  }
+}
+
+/**
+* \brief Decode a packet range using all decoder threads
+*
+* Only the packets of the range are read from the data. Every round of chunks
+* is split evenly between the threads by index_split(), and the framed packets
+* are parsed in order.
+*
+* \param[in] idx 		Pointer to the index.
+* \param[in] buf 		Pointer to the indexed data.
+* \param[in] first 		First entry of the range.
+* \param[in] last 		Entry past the range, clamped to the index.
+* \param[in] id 		Packet key to decode, INDEX_ANY_ID for all of them.
+* \param[in] chunk_size Chunk size, FRAME_CHUNK_SIZE if 0.
+* \return 				Number of decoded packets, 0 if out of memory.
+*/
+uint32_t index_decode(const struct packet_index *idx, const uint8_t *buf,
+                      uint64_t first, uint64_t last, uint32_t id,
+                      uint32_t chunk_size) {
+  if (chunk_size == 0)
+    chunk_size = FRAME_CHUNK_SIZE;
+  last = min(last, idx->hdr.count);
+  packet_counter = 0;
+  decoder_pool_start();
+  uint8_t n_parts = g_decoder_pool.n_threads;
+
+  struct index_decode_job job;
+  job.buf = buf;
+  job.idx = idx;
+  job.id = id;
+  job.state =
+      (struct frame_state *)calloc(n_parts, sizeof(struct frame_state));
+  if (job.state == NULL)
+    return 0;
+  bool ok = true;
+  for (uint8_t i = 0; i < n_parts && ok; i++) {
+    // a part may get a few packets over its share of the round
+    job.state[i].out = (uint8_t *)malloc(chunk_size + 2 * FRAME_MAX_RAW);
+    job.state[i].packet_size = chunk_size / 4 + 1;
+    job.state[i].packet = (struct frame_packet *)malloc(
+        job.state[i].packet_size * sizeof(struct frame_packet));
+    ok = job.state[i].out != NULL && job.state[i].packet != NULL;
+  }
+  uint64_t pos = ok ? first : last;
+  while (pos < last) {
+    // a round holds a chunk of data for every thread
+    uint64_t end = index_locate(
+        idx, idx->entry[pos].offset + (uint64_t)chunk_size * n_parts);
+    end = min(max(end, pos + 1), last);
+    job.part_count = n_parts;
+    index_split(idx, pos, end, n_parts, job.bound);
+    pool_run(&g_decoder_pool, index_decode_task, &job);
+    for (uint8_t i = 0; i < n_parts; i++) {
+      frame_dispatch(&job.state[i]);
+    }
+    pos = end;
+  }
+
+  for (uint8_t i = 0; i < n_parts; i++) {
+    free(job.state[i].out);
+    free(job.state[i].packet);
+  }
+  free(job.state);
+  return packet_counter;
+}
+
+#endif
@@ -0,0 +1,296 @@
+/** @file tsip_offline.h
+ * \brief Header containing the offline batch decoder.
+ * Decodes many data files concurrently, one file per decoder thread at a time,
+ * with the files handed out by a work stealing scheduler
+*/
+#ifndef TSIP_OFFLINE_H
+#define TSIP_OFFLINE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "tsip_column.h"
+#include "tsip_push.h"
+
+/**
+ * \brief Output stream buffer size of a decoded file.
+ */
+#define OFFLINE_OUT_BUFFER (1 << 20)
+
+/**
+ * \brief Data file decoded by the batch decoder.
+ */
+struct offline_file {
+  const char *path;
+  //! decoded output file name, NULL for no output
+  char *out;
+  //! column file name, NULL for no columnar export
+  char *columns;
+  uint64_t size;
+  struct decoder_stats stats;
+  uint64_t wall_ns;
+  //! thread that decoded the file
+  uint8_t worker;
+  bool ok;
+};
+
+/**
+ * \brief Work queue of a batch decoder thread.
+ *
+ * The thread takes its files from the head, the idle threads steal from the
+ * tail. Both ends are packed into a single word, so a file is taken by a
+ * single compare and swap either way.
+ */
+struct offline_queue {
+  _Alignas(64) _Atomic uint64_t range;
+};
+
+/**
+ * \brief Batch decoding job shared by the pool threads.
+ */
+struct offline_job {
+  //! files dealt out to the queues, each queue is a range of them
+  struct offline_file **order;
+  struct offline_queue queue[POOL_MAX_THREADS];
+  uint8_t n_workers;
+  _Atomic uint32_t steals;
+};
+
+/**
+ * \brief Batch decoding totals.
+ */
+struct offline_report {
+  uint32_t files;
+  uint32_t failed;
+  uint32_t steals;
+  uint64_t bytes;
+  uint64_t packets;
+  uint64_t rejects;
+  uint64_t wall_ns;
+};
+
+/**
+* \brief Decode a data file.
+*
+* Maps the file and runs it through a push parser, writing the valid packets
+* out as tsip_print() does in the verbose mode, and exporting them to a column
+* file.
+*
+* \param file Pointer to the file.
+* \return 	True if the file was decoded and its output written.
+*/
+bool offline_decode_file(struct offline_file *file) {
+  uint64_t start = decoder_clock_ns();
+  struct tsip_source src;
+  source_mem_init(&src, NULL, 0);
+  FILE *out = NULL;
+  char *out_buf = NULL;
+  bool ok = source_mmap_open(&src, file->path);
+  if (ok && file->out != NULL) {
+    out = fopen(file->out, "w");
+    out_buf = (char *)malloc(OFFLINE_OUT_BUFFER);
+    ok = out != NULL;
+    if (ok && out_buf != NULL)
+      setvbuf(out, out_buf, _IOFBF, OFFLINE_OUT_BUFFER);
+  }
+  struct column_export exp;
+  bool export = ok && file->columns != NULL;
+  if (export)
+    ok = column_init(&exp);
+  uint8_t buf[PUSH_MIN_BUFFER];
+  struct push_parser p;
+  push_init(&p, buf, sizeof(buf));
+  if (ok) {
+    file->size = src.len;
+    // the push parser takes up to 4 GB at once
+    while (src.pos < src.len) {
+      uint32_t len = min(src.len - src.pos, (uint64_t)UINT32_MAX);
+      const uint8_t *data = src.data + src.pos;
+      src.pos += len;
+      struct push_packet pkt;
+      while (push_next(&p, &data, &len, &pkt)) {
+        if (pkt.status != none)
+          continue;
+        if (out != NULL)
+          tsip_print(out, pkt.data, pkt.len);
+        if (export)
+          column_add(&exp, pkt.data, pkt.len);
+      }
+    }
+  }
+  if (out != NULL)
+    ok = fclose(out) == 0 && ok;
+  if (export && exp.slot != NULL) {
+    ok = ok && column_save(&exp, file->columns);
+    column_free(&exp);
+  }
+  free(out_buf);
+  source_close(&src);
+  file->stats = p.stats;
+  file->ok = ok;
+  file->wall_ns = decoder_clock_ns() - start;
+  return ok;
+}
+
+/**
+* \brief Take a file from the head of a queue.
+*
+* \param q 		Pointer to the queue.
+* \param[out] n 	Position of the file in the job order.
+* \return 		True if the queue wasn't empty.
+*/
+bool offline_pop(struct offline_queue *q, uint32_t *n) {
+  uint64_t r = atomic_load(&q->range);
+  while ((uint32_t)(r >> 32) < (uint32_t)r) {
+    if (atomic_compare_exchange_weak(&q->range, &r, r + (1ull << 32))) {
+      *n = r >> 32;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+* \brief Take a file from the tail of a queue.
+*
+* \param q 		Pointer to the queue.
+* \param[out] n 	Position of the file in the job order.
+* \return 		True if the queue wasn't empty.
+*/
+bool offline_steal(struct offline_queue *q, uint32_t *n) {
+  uint64_t r = atomic_load(&q->range);
+  while ((uint32_t)(r >> 32) < (uint32_t)r) {
+    if (atomic_compare_exchange_weak(&q->range, &r, r - 1)) {
+      *n = (uint32_t)r - 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+* \brief Batch decoder thread function
+*
+* Decodes the files of its own queue, then steals from the queue with the most
+* files left until all of them are empty.
+*
+* \param[in] id 	Thread id.
+* \param[in] arg 	Pointer to the batch decoding job.
+* \return
+*/
+void offline_task(uint8_t id, void *arg) {
+  struct offline_job *job = (struct offline_job *)arg;
+  if (id >= job->n_workers)
+    return;
+  uint32_t n;
+  while (true) {
+    if (!offline_pop(&job->queue[id], &n)) {
+      // find the fullest queue to steal from
+      uint8_t victim = id;
+      uint32_t most = 0;
+      for (uint8_t i = 0; i < job->n_workers; i++) {
+        uint64_t r = atomic_load(&job->queue[i].range);
+        uint32_t left = (uint32_t)r - min((uint32_t)(r >> 32), (uint32_t)r);
+        if (left > most) {
+          most = left;
+          victim = i;
+        }
+      }
+      if (most == 0)
+        return;
+      if (!offline_steal(&job->queue[victim], &n))
+        continue;
+      atomic_fetch_add(&job->steals, 1);
+    }
+    struct offline_file *file = job->order[n];
+    file->worker = id;
+    offline_decode_file(file);
+  }
+}
+
+/**
+* \brief Compare two files by size, for sorting the largest first.
+*
+* \param a Pointer to the first file pointer.
+* \param b Pointer to the second file pointer.
+* \return 	Negative if the first file is larger.
+*/
+int offline_size_cmp(const void *a, const void *b) {
+  uint64_t x = (*(struct offline_file *const *)a)->size;
+  uint64_t y = (*(struct offline_file *const *)b)->size;
+  return (x < y) - (x > y);
+}
+
+/**
+* \brief Decode data files using all decoder threads
+*
+* The files are sorted by size and dealt out to the thread queues in turn, so
+* every thread starts on a large file and the small ones fill in at the end.
+* A thread that runs out of files steals them from the others, so a few huge
+* files don't hold up the rest of the batch.
+*
+* \param[in,out] file 	Pointer to the files, the path and output set.
+* \param[in] count 		Number of files.
+* \param[out] report 	Batch totals.
+* \return 				True if all the files were decoded.
+*/
+bool offline_decode(struct offline_file *file, uint32_t count,
+                    struct offline_report *report) {
+  uint64_t start = decoder_clock_ns();
+  memset(report, 0, sizeof(*report));
+  struct offline_job *job =
+      (struct offline_job *)aligned_alloc(64, sizeof(struct offline_job));
+  struct offline_file **sorted =
+      (struct offline_file **)malloc(count * sizeof(*sorted));
+  struct offline_file **dealt =
+      (struct offline_file **)malloc(count * sizeof(*dealt));
+  if (job == NULL || sorted == NULL || dealt == NULL) {
+    free(job);
+    free(sorted);
+    free(dealt);
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    struct stat st;
+    file[i].size = stat(file[i].path, &st) == 0 ? st.st_size : 0;
+    file[i].ok = false;
+    sorted[i] = &file[i];
+  }
+  qsort(sorted, count, sizeof(*sorted), offline_size_cmp);
+  decoder_pool_start();
+  job->n_workers = g_decoder_pool.n_threads;
+  atomic_init(&job->steals, 0);
+  uint32_t pos = 0;
+  for (uint8_t w = 0; w < job->n_workers; w++) {
+    uint32_t first = pos;
+    for (uint32_t i = w; i < count; i += job->n_workers) {
+      dealt[pos++] = sorted[i];
+    }
+    atomic_init(&job->queue[w].range, (uint64_t)first << 32 | pos);
+  }
+  job->order = dealt;
+  pool_run(&g_decoder_pool, offline_task, job);
+
+  report->files = count;
+  report->steals = atomic_load(&job->steals);
+  for (uint32_t i = 0; i < count; i++) {
+    report->failed += !file[i].ok;
+    report->bytes += file[i].stats.bytes_in;
+    report->packets += file[i].stats.packets_out;
+    for (uint8_t k = 0; k < STATS_REJECT_REASONS; k++) {
+      report->rejects += file[i].stats.rejects[k];
+    }
+  }
+  free(dealt);
+  free(sorted);
+  free(job);
+  report->wall_ns = decoder_clock_ns() - start;
+  return report->failed == 0;
+}
+
+#endif
@@ -0,0 +1,380 @@
+/** @file tsip_packet.h
+ * \brief Header containing the typed packet dispatch.
+ * Decodes the packet payloads into typed structures, looked up by the packet
+ * IDs, and passes them on to the registered handlers
+*/
+#ifndef TSIP_PACKET_H
+#define TSIP_PACKET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * \brief Maximum number of ID1 families with registered decoders.
+ */
+#define DISPATCH_FAMILIES 16
+
+/**
+ * \brief Decoded packet types.
+ */
+enum tsip_packet_type { tsip_raw, tsip_a509, tsip_a50a, tsip_3902 };
+
+/*
+ * The built-in payload layouts are not specified anywhere in this tree. They
+ * were inferred from the sample captures, so the meaning of the fields is
+ * unknown and they are only named by their type and order. The payload offset
+ * of every field is given next to it. A layout may be wrong for packets that
+ * never showed up in the samples.
+ */
+
+/**
+ * \brief Payload of the 0xA5 0x09 packet, 43 bytes, inferred layout.
+ *
+ * The fields are kept in the order they appear in the payload, grouped by
+ * type.
+ */
+struct tsip_msg_a509 {
+  //! payload offsets 0, 4 and 12
+  uint32_t u32[3];
+  //! payload offsets 8 and 37
+  float f32[2];
+  //! payload offsets 16, 18, 20, 23, 25, 27 and 41
+  uint16_t u16[7];
+  //! payload offset 22
+  uint8_t u8[1];
+  //! payload offset 29
+  double f64[1];
+};
+
+/**
+ * \brief Payload of the 0xA5 0x0A packet, 18 bytes, inferred layout.
+ */
+struct tsip_msg_a50a {
+  //! payload offsets 0, 2, 8, 10, 12, 14 and 16
+  uint16_t u16[7];
+  //! payload offset 4
+  float f32[1];
+};
+
+/**
+ * \brief Payload of the 0x39 0x02 packet, 8 bytes, inferred layout.
+ */
+struct tsip_msg_3902 {
+  //! payload offset 0
+  double f64[1];
+};
+
+/**
+ * \brief Dispatched packet.
+ *
+ * The payload points into the decoder buffer and is only valid within the
+ * handler. Raw packets only carry the payload.
+ */
+struct tsip_packet {
+  uint8_t id1;
+  uint8_t id2;
+  uint8_t type;
+  uint16_t len;
+  const uint8_t *payload;
+  union {
+    struct tsip_msg_a509 a509;
+    struct tsip_msg_a50a a50a;
+    struct tsip_msg_3902 m3902;
+  } msg;
+};
+
+/**
+ * \brief Payload decoder, returns false if the payload doesn't fit the layout.
+ */
+typedef bool (*tsip_decoder)(const uint8_t *payload, uint32_t len,
+                             struct tsip_packet *pkt);
+
+/**
+ * \brief Packet handler.
+ */
+typedef void (*tsip_handler)(const struct tsip_packet *pkt, void *user);
+
+/**
+ * \brief Dispatch table entry.
+ */
+struct dispatch_entry {
+  tsip_decoder decode;
+  tsip_handler handler;
+  void *user;
+};
+
+/**
+ * \brief Dispatch tables, indexed by ID2. The first one is left empty for the
+ * ID1 families with no decoders.
+ */
+static struct dispatch_entry g_dispatch_table[DISPATCH_FAMILIES + 1][256];
+/**
+ * \brief Dispatch table index of every ID1 family.
+ */
+static uint8_t g_dispatch_family[256];
+static uint8_t g_dispatch_families = 0;
+/**
+ * \brief Handler of the packets with no decoder.
+ */
+static struct dispatch_entry g_dispatch_raw;
+
+/**
+* \brief Read a little-endian 16 bit field.
+*
+* \param p Pointer to the field.
+* \return 	Field value.
+*/
+uint16_t get_u16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+/**
+* \brief Read a little-endian 32 bit field.
+*
+* \param p Pointer to the field.
+* \return 	Field value.
+*/
+uint32_t get_u32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/**
+* \brief Read a little-endian single precision field.
+*
+* \param p Pointer to the field.
+* \return 	Field value.
+*/
+float get_f32(const uint8_t *p) {
+  uint32_t u = get_u32(p);
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+/**
+* \brief Read a little-endian double precision field.
+*
+* \param p Pointer to the field.
+* \return 	Field value.
+*/
+double get_f64(const uint8_t *p) {
+  uint64_t u = get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+  double d;
+  memcpy(&d, &u, sizeof(d));
+  return d;
+}
+
+/**
+* \brief Decode the 0xA5 0x09 packet payload.
+*
+* \param payload 	Pointer to the payload.
+* \param len 		Payload size.
+* \param pkt 		Pointer to the packet.
+* \return 			True if the payload fits the layout.
+*/
+bool tsip_decode_a509(const uint8_t *payload, uint32_t len,
+                      struct tsip_packet *pkt) {
+  if (len != 43)
+    return false;
+  struct tsip_msg_a509 *m = &pkt->msg.a509;
+  m->u32[0] = get_u32(payload + 0);
+  m->u32[1] = get_u32(payload + 4);
+  m->f32[0] = get_f32(payload + 8);
+  m->u32[2] = get_u32(payload + 12);
+  m->u16[0] = get_u16(payload + 16);
+  m->u16[1] = get_u16(payload + 18);
+  m->u16[2] = get_u16(payload + 20);
+  m->u8[0] = payload[22];
+  m->u16[3] = get_u16(payload + 23);
+  m->u16[4] = get_u16(payload + 25);
+  m->u16[5] = get_u16(payload + 27);
+  m->f64[0] = get_f64(payload + 29);
+  m->f32[1] = get_f32(payload + 37);
+  m->u16[6] = get_u16(payload + 41);
+  pkt->type = tsip_a509;
+  return true;
+}
+
+/**
+* \brief Decode the 0xA5 0x0A packet payload.
+*
+* \param payload 	Pointer to the payload.
+* \param len 		Payload size.
+* \param pkt 		Pointer to the packet.
+* \return 			True if the payload fits the layout.
+*/
+bool tsip_decode_a50a(const uint8_t *payload, uint32_t len,
+                      struct tsip_packet *pkt) {
+  if (len != 18)
+    return false;
+  struct tsip_msg_a50a *m = &pkt->msg.a50a;
+  m->u16[0] = get_u16(payload + 0);
+  m->u16[1] = get_u16(payload + 2);
+  m->f32[0] = get_f32(payload + 4);
+  m->u16[2] = get_u16(payload + 8);
+  m->u16[3] = get_u16(payload + 10);
+  m->u16[4] = get_u16(payload + 12);
+  m->u16[5] = get_u16(payload + 14);
+  m->u16[6] = get_u16(payload + 16);
+  pkt->type = tsip_a50a;
+  return true;
+}
+
+/**
+* \brief Decode the 0x39 0x02 packet payload.
+*
+* \param payload 	Pointer to the payload.
+* \param len 		Payload size.
+* \param pkt 		Pointer to the packet.
+* \return 			True if the payload fits the layout.
+*/
+bool tsip_decode_3902(const uint8_t *payload, uint32_t len,
+                      struct tsip_packet *pkt) {
+  if (len != 8)
+    return false;
+  pkt->msg.m3902.f64[0] = get_f64(payload);
+  pkt->type = tsip_3902;
+  return true;
+}
+
+/**
+* \brief Look up the dispatch table entry of a packet type.
+*
+* Sets up a table for the ID1 family if it has none yet.
+*
+* \param id1 	Packet ID1.
+* \param id2 	Packet ID2.
+* \return 		Pointer to the entry, NULL if there are no free ID1 family
+* tables.
+*/
+struct dispatch_entry *dispatch_entry_get(uint8_t id1, uint8_t id2) {
+  if (g_dispatch_family[id1] == 0) {
+    if (g_dispatch_families == DISPATCH_FAMILIES)
+      return NULL;
+    g_dispatch_family[id1] = ++g_dispatch_families;
+  }
+  return &g_dispatch_table[g_dispatch_family[id1]][id2];
+}
+
+/**
+* \brief Register a packet decoder and its handler.
+*
+* Must not be called while the decoder is running.
+*
+* \param id1 		Packet ID1.
+* \param id2 		Packet ID2.
+* \param decode 	Payload decoder, NULL to pass the payload on raw.
+* \param handler 	Packet handler, NULL to pass the decoded packets on to the
+* raw handler.
+* \param user 		Handler argument.
+* \return 			True if the decoder was registered, false if there are
+* no free ID1 family tables.
+*/
+bool tsip_register(uint8_t id1, uint8_t id2, tsip_decoder decode,
+                   tsip_handler handler, void *user) {
+  struct dispatch_entry *e = dispatch_entry_get(id1, id2);
+  if (e == NULL)
+    return false;
+  e->decode = decode;
+  e->handler = handler;
+  e->user = user;
+  return true;
+}
+
+/**
+* \brief Set the handler of a packet type, keeping its decoder.
+*
+* A packet type with no decoder registered gets its packets raw. Must not be
+* called while the decoder is running.
+*
+* \param id1 		Packet ID1.
+* \param id2 		Packet ID2.
+* \param handler 	Packet handler, NULL to pass the packets on to the raw
+* handler.
+* \param user 		Handler argument.
+* \return 			True if the handler was set, false if there are no
+* free ID1 family tables.
+*/
+bool tsip_set_handler(uint8_t id1, uint8_t id2, tsip_handler handler,
+                      void *user) {
+  struct dispatch_entry *e = dispatch_entry_get(id1, id2);
+  if (e == NULL)
+    return false;
+  e->handler = handler;
+  e->user = user;
+  return true;
+}
+
+/**
+* \brief Register the handler of the packets with no decoder.
+*
+* Also receives the packets with a payload that doesn't fit their layout.
+*
+* \param handler 	Packet handler, NULL to drop them.
+* \param user 		Handler argument.
+* \return
+*/
+void tsip_register_raw(tsip_handler handler, void *user) {
+  g_dispatch_raw.handler = handler;
+  g_dispatch_raw.user = user;
+}
+
+/**
+* \brief Register the decoders of the packets found in the sample data.
+*
+* The packets are decoded and passed on to the raw handler, until a handler of
+* their own is set with tsip_set_handler().
+*
+* \return
+*/
+void tsip_register_builtin() {
+  tsip_register(0xA5, 0x09, tsip_decode_a509, NULL, NULL);
+  tsip_register(0xA5, 0x0A, tsip_decode_a50a, NULL, NULL);
+  tsip_register(0x39, 0x02, tsip_decode_3902, NULL, NULL);
+}
+
+/**
+* \brief Clear the dispatch tables.
+*
+* \return
+*/
+void tsip_dispatch_reset() {
+  memset(g_dispatch_table, 0, sizeof(g_dispatch_table));
+  memset(g_dispatch_family, 0, sizeof(g_dispatch_family));
+  memset(&g_dispatch_raw, 0, sizeof(g_dispatch_raw));
+  g_dispatch_families = 0;
+}
+
+/**
+* \brief Decode a packet and pass it on to its handler.
+*
+* The decoder is looked up directly by the packet IDs. The packet is decoded
+* on the stack, nothing is allocated. A packet with no handler of its own goes
+* to the raw handler, decoded if it has a decoder. A packet with a payload its
+* decoder rejects goes to the raw handler as raw bytes.
+*
+* \param buffer 	Pointer to the packet, starting with the IDs.
+* \param len 		Packet size, checksum excluded.
+* \return 			Decoded packet type.
+*/
+uint8_t tsip_dispatch(const uint8_t *buffer, uint32_t len) {
+  if (len < 2)
+    return tsip_raw;
+  struct tsip_packet pkt;
+  pkt.id1 = buffer[0];
+  pkt.id2 = buffer[1];
+  pkt.type = tsip_raw;
+  pkt.len = len - 2;
+  pkt.payload = buffer + 2;
+  const struct dispatch_entry *e =
+      &g_dispatch_table[g_dispatch_family[pkt.id1]][pkt.id2];
+  bool decoded = e->decode == NULL || e->decode(pkt.payload, pkt.len, &pkt);
+  if (!decoded)
+    pkt.type = tsip_raw;
+  if (e->handler == NULL || !decoded)
+    e = &g_dispatch_raw;
+  if (e->handler != NULL)
+    e->handler(&pkt, e->user);
+  return pkt.type;
+}
+
+#endif
@@ -0,0 +1,456 @@
+/** @file tsip_pool.h
+ * \brief Header containing the persistent worker pool.
+ * The worker threads are started once and parked between the decoder ticks
+*/
+#ifndef TSIP_POOL_H
+#define TSIP_POOL_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * \brief Maximum number of threads in a pool.
+ */
+#define POOL_MAX_THREADS 64
+
+/**
+ * \brief Thread CPU pinning availability flag, the CPU sets are a GNU
+ * extension.
+ */
+#if defined(__linux__) && defined(CPU_SETSIZE)
+#define POOL_AFFINITY 1
+#else
+#define POOL_AFFINITY 0
+#endif
+
+/**
+ * \brief Scheduling settings that took effect on a thread.
+ */
+enum thread_sched_result { sched_pinned = 1, sched_realtime = 2 };
+
+/**
+ * \brief Scheduling of the pool threads.
+ */
+struct pool_sched {
+  //! SCHED_FIFO priority, 0 for the default policy
+  int priority;
+  //! CPUs the threads are pinned to in turn, unpinned if there are none
+  uint16_t cpu[POOL_MAX_THREADS];
+  uint8_t n_cpus;
+};
+
+/**
+ * \brief Task function run by every pool thread once per tick.
+ */
+typedef void (*pool_task)(uint8_t id, void *arg);
+
+struct worker_pool;
+
+/**
+ * \brief Per-thread pool handle.
+ */
+struct pool_worker {
+  struct worker_pool *pool;
+  uint8_t id;
+};
+
+/**
+ * \brief Persistent worker pool.
+ */
+struct worker_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t tick_cond;
+  pthread_cond_t done_cond;
+  pthread_t thread[POOL_MAX_THREADS];
+  struct pool_worker worker[POOL_MAX_THREADS];
+  uint8_t n_threads;
+  uint8_t n_busy;
+  uint32_t tick;
+  bool running;
+  pool_task task;
+  void *arg;
+  //! thread scheduling, and the number of threads it took effect on
+  struct pool_sched sched;
+  uint8_t n_pinned;
+  uint8_t n_realtime;
+};
+
+/**
+ * \brief Maximum number of items handed in to a turn handoff and not yet run.
+ */
+#define TURN_MAX_ITEMS (2 * POOL_MAX_THREADS)
+
+/**
+ * \brief Number of times a thread waiting for an item yields the processor
+ * before it's parked.
+ */
+#define TURN_YIELDS 64
+
+/**
+ * \brief Function run on the items of an ordered turn handoff.
+ */
+typedef void (*turn_fn)(void *item, void *arg);
+
+/**
+ * \brief Ordered turn handoff between the pool threads.
+ *
+ * The items handed in are run in the order of their tickets, numbered from 0
+ * in the order the work was claimed. Whichever thread holds the turn runs all
+ * the items that are next in line, its own and the ones handed in by the
+ * other threads, so the threads hand their items in and carry on with the next
+ * ones without waiting for the turn. A thread only waits, parked on a
+ * condition variable of its own, when it needs an item it handed in back. At
+ * most TURN_MAX_ITEMS consecutive tickets may be handed in and not yet run at
+ * a time.
+ */
+struct turn_seq {
+  pthread_mutex_t lock;
+  void *item[TURN_MAX_ITEMS];
+  //! condition variables of the threads waiting for the items
+  pthread_cond_t *wake[TURN_MAX_ITEMS];
+  _Atomic uint32_t seq;
+  //! a thread is running the items
+  bool running;
+  uint64_t wait_ns;
+  uint32_t wait_count;
+};
+
+/**
+* \brief Initialize a turn handoff.
+*
+* \param turn Pointer to the turn handoff.
+* \return
+*/
+void turn_init(struct turn_seq *turn) {
+  pthread_mutex_init(&turn->lock, NULL);
+  for (uint8_t i = 0; i < TURN_MAX_ITEMS; i++) {
+    turn->item[i] = NULL;
+    turn->wake[i] = NULL;
+  }
+  turn->seq = 0;
+  turn->running = false;
+  turn->wait_ns = 0;
+  turn->wait_count = 0;
+}
+
+/**
+* \brief Reset the turn handoff wait statistics.
+*
+* \param turn Pointer to the turn handoff.
+* \return
+*/
+void turn_stats_reset(struct turn_seq *turn) {
+  pthread_mutex_lock(&turn->lock);
+  turn->wait_ns = 0;
+  turn->wait_count = 0;
+  pthread_mutex_unlock(&turn->lock);
+}
+
+/**
+* \brief Hand an item in to be run in the ticket order.
+*
+* If the turn is the ticket's and no other thread is running the items, the
+* calling thread runs it, along with the items of the following tickets handed
+* in meanwhile. Otherwise the item is left to the holder of the turn, and the
+* call returns straight away. The item must be kept until turn_wait() returns
+* for its ticket.
+*
+* \param turn 		Pointer to the turn handoff.
+* \param ticket 	Ticket number.
+* \param fn 		Function run on the items.
+* \param item 		Item, not NULL.
+* \param arg 		Function argument.
+* \return
+*/
+void turn_run(struct turn_seq *turn, uint32_t ticket, turn_fn fn, void *item,
+              void *arg) {
+  pthread_mutex_lock(&turn->lock);
+  turn->item[ticket % TURN_MAX_ITEMS] = item;
+  if (turn->running || turn->seq != ticket) {
+    // the holder of the turn runs the item
+    pthread_mutex_unlock(&turn->lock);
+    return;
+  }
+  turn->running = true;
+  // the tickets handed in are at most TURN_MAX_ITEMS apart, so the slot of the
+  // turn can only hold the item of its ticket
+  while (turn->item[turn->seq % TURN_MAX_ITEMS] != NULL) {
+    uint8_t i = turn->seq % TURN_MAX_ITEMS;
+    void *next = turn->item[i];
+    turn->item[i] = NULL;
+    pthread_mutex_unlock(&turn->lock);
+    fn(next, arg);
+    pthread_mutex_lock(&turn->lock);
+    turn->seq++;
+    if (turn->wake[i] != NULL) {
+      pthread_cond_signal(turn->wake[i]);
+      turn->wake[i] = NULL;
+    }
+  }
+  turn->running = false;
+  pthread_mutex_unlock(&turn->lock);
+}
+
+/**
+* \brief Wait until the item of a ticket has run.
+*
+* The thread yields the processor a few times before it's parked, as the item
+* is usually run by then, while a wakeup may preempt the holder of the turn
+* when there are more threads than processors. The time spent parked is added
+* to the wait statistics.
+*
+* \param turn 		Pointer to the turn handoff.
+* \param ticket 	Ticket number of an item handed in.
+* \return
+*/
+void turn_wait(struct turn_seq *turn, uint32_t ticket) {
+  for (uint8_t i = 0; i < TURN_YIELDS; i++) {
+    if (atomic_load_explicit(&turn->seq, memory_order_acquire) > ticket)
+      return;
+    sched_yield();
+  }
+  pthread_mutex_lock(&turn->lock);
+  if (turn->seq <= ticket) {
+    pthread_cond_t cond;
+    pthread_cond_init(&cond, NULL);
+    turn->wake[ticket % TURN_MAX_ITEMS] = &cond;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (turn->seq <= ticket) {
+      pthread_cond_wait(&cond, &turn->lock);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_cond_destroy(&cond);
+    turn->wait_ns +=
+        (t1.tv_sec - t0.tv_sec) * 1000000000ll + (t1.tv_nsec - t0.tv_nsec);
+    turn->wait_count++;
+  }
+  pthread_mutex_unlock(&turn->lock);
+}
+
+/**
+* \brief Reset the turn handoff to the first ticket.
+*
+* Only to be called while none of the threads are waiting.
+*
+* \param turn Pointer to the turn handoff.
+* \return
+*/
+void turn_reset(struct turn_seq *turn) {
+  pthread_mutex_lock(&turn->lock);
+  turn->seq = 0;
+  turn->running = false;
+  for (uint8_t i = 0; i < TURN_MAX_ITEMS; i++) {
+    turn->item[i] = NULL;
+    turn->wake[i] = NULL;
+  }
+  pthread_mutex_unlock(&turn->lock);
+}
+
+/**
+* \brief Set the scheduling of a thread.
+*
+* Pins the thread to a CPU, or lets it run on any CPU of the calling thread,
+* and switches it to the SCHED_FIFO policy at the given priority, or back to
+* the default policy. A setting that isn't permitted, like a real-time
+* priority without the privileges, is skipped and the thread keeps its old
+* one.
+*
+* \param thread 	Thread.
+* \param priority 	SCHED_FIFO priority, 0 for the default policy.
+* \param cpu 		CPU to pin the thread to, negative to unpin it.
+* \return 			Settings that took effect, as thread_sched_result flags.
+*/
+uint8_t thread_sched_apply(pthread_t thread, int priority, int cpu) {
+  uint8_t applied = 0;
+#if POOL_AFFINITY
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (cpu >= 0 && cpu < CPU_SETSIZE)
+    CPU_SET(cpu, &set);
+  else
+    sched_getaffinity(0, sizeof(set), &set);
+  if (pthread_setaffinity_np(thread, sizeof(set), &set) == 0 && cpu >= 0)
+    applied |= sched_pinned;
+#endif
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  int policy = SCHED_OTHER;
+  if (priority > 0) {
+    policy = SCHED_FIFO;
+    param.sched_priority = priority;
+    if (priority < sched_get_priority_min(SCHED_FIFO))
+      param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    if (priority > sched_get_priority_max(SCHED_FIFO))
+      param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+  }
+  if (pthread_setschedparam(thread, policy, &param) == 0 && priority > 0)
+    applied |= sched_realtime;
+  return applied;
+}
+
+/**
+* \brief Apply the pool scheduling to a pool thread.
+*
+* \param pool 	Pointer to the pool.
+* \param i 	Thread index.
+* \return
+*/
+void pool_sched_thread(struct worker_pool *pool, uint8_t i) {
+  const struct pool_sched *sched = &pool->sched;
+  int cpu = sched->n_cpus ? sched->cpu[i % sched->n_cpus] : -1;
+  uint8_t applied = thread_sched_apply(pool->thread[i], sched->priority, cpu);
+  pool->n_pinned += (applied & sched_pinned) != 0;
+  pool->n_realtime += (applied & sched_realtime) != 0;
+}
+
+/**
+* \brief Set the scheduling of the pool threads.
+*
+* Applies to the running threads straight away, and to the threads started
+* later. Only to be called between the ticks.
+*
+* \param pool 	Pointer to the pool.
+* \param sched 	Pointer to the scheduling.
+* \return 		True if all of it took effect on the running threads.
+*/
+bool pool_set_sched(struct worker_pool *pool, const struct pool_sched *sched) {
+  pool->sched = *sched;
+  if (pool->sched.n_cpus > POOL_MAX_THREADS)
+    pool->sched.n_cpus = POOL_MAX_THREADS;
+  pool->n_pinned = 0;
+  pool->n_realtime = 0;
+  if (!pool->running)
+    return true;
+  for (uint8_t i = 0; i < pool->n_threads; i++) {
+    pool_sched_thread(pool, i);
+  }
+  return (sched->n_cpus == 0 || pool->n_pinned == pool->n_threads) &&
+         (sched->priority <= 0 || pool->n_realtime == pool->n_threads);
+}
+
+/**
+* \brief Pool thread function
+*
+* Parks the thread until a new tick is issued, runs the tick task and reports
+* back to the pool. Exits once the pool is stopped.
+*
+* \param[in] w Pointer to the pool worker handle.
+* \return
+*/
+void *pool_thread(void *w) {
+  struct pool_worker *worker = (struct pool_worker *)w;
+  struct worker_pool *pool = worker->pool;
+  uint32_t tick = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    // park until there is something to do
+    while (pool->running && pool->tick == tick) {
+      pthread_cond_wait(&pool->tick_cond, &pool->lock);
+    }
+    if (!pool->running)
+      break;
+    tick = pool->tick;
+    pool_task task = pool->task;
+    void *arg = pool->arg;
+    pthread_mutex_unlock(&pool->lock);
+
+    task(worker->id, arg);
+
+    pthread_mutex_lock(&pool->lock);
+    // the last thread to finish wakes the caller
+    if (--pool->n_busy == 0) {
+      pthread_cond_signal(&pool->done_cond);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/**
+* \brief Start the pool threads.
+*
+* The threads are scheduled as set by pool_set_sched().
+*
+* \param pool 		Pointer to the pool.
+* \param n_threads 	Number of threads to start.
+* \return 			Number of threads started.
+*/
+uint8_t pool_start(struct worker_pool *pool, uint8_t n_threads) {
+  if (n_threads > POOL_MAX_THREADS)
+    n_threads = POOL_MAX_THREADS;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->tick_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  pool->n_threads = 0;
+  pool->n_busy = 0;
+  pool->tick = 0;
+  pool->running = true;
+  pool->n_pinned = 0;
+  pool->n_realtime = 0;
+  for (uint8_t i = 0; i < n_threads; i++) {
+    pool->worker[i].pool = pool;
+    pool->worker[i].id = i;
+    if (pthread_create(&pool->thread[i], NULL, pool_thread,
+                       &pool->worker[i]) != 0)
+      break;
+    pool_sched_thread(pool, i);
+    pool->n_threads++;
+  }
+  return pool->n_threads;
+}
+
+/**
+* \brief Run a task on every pool thread.
+*
+* Wakes the parked threads and blocks until all of them have finished the task.
+*
+* \param pool 	Pointer to the pool.
+* \param task 	Task function.
+* \param arg 	Task argument.
+* \return
+*/
+void pool_run(struct worker_pool *pool, pool_task task, void *arg) {
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->arg = arg;
+  pool->n_busy = pool->n_threads;
+  pool->tick++;
+  pthread_cond_broadcast(&pool->tick_cond);
+  while (pool->n_busy > 0) {
+    pthread_cond_wait(&pool->done_cond, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+* \brief Stop the pool threads.
+*
+* \param pool Pointer to the pool.
+* \return
+*/
+void pool_stop(struct worker_pool *pool) {
+  if (!pool->running)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  pool->running = false;
+  pthread_cond_broadcast(&pool->tick_cond);
+  pthread_mutex_unlock(&pool->lock);
+  for (uint8_t i = 0; i < pool->n_threads; i++) {
+    pthread_join(pool->thread[i], NULL);
+  }
+  pool->n_threads = 0;
+  pool->n_pinned = 0;
+  pool->n_realtime = 0;
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->tick_cond);
+  pthread_cond_destroy(&pool->done_cond);
+}
+
+#endif
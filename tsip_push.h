@@ -0,0 +1,200 @@
+/** @file tsip_push.h
+ * \brief Header containing the incremental push parser.
+ * A single-threaded alternative to the decoder threads for low rate links.
+ * The caller pushes any number of bytes and gets the completed packets back
+*/
+#ifndef TSIP_PUSH_H
+#define TSIP_PUSH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tsip_decode.h"
+
+/**
+ * \brief Minimum size of the push parser packet buffer.
+ */
+#define PUSH_MIN_BUFFER (MAX_DATA_SIZE + 6)
+
+/**
+ * \brief Push parser states.
+ */
+enum push_state {
+  push_idle,     //!< outside of a packet
+  push_idle_dle, //!< outside of a packet, after a DLE
+  push_data,     //!< within a packet
+  push_data_dle  //!< within a packet, after a DLE
+};
+
+/**
+ * \brief Incremental push parser.
+ *
+ * Holds no locks and no pointers to static data, so every link can have its
+ * own parser. The packet buffer is provided by the caller.
+ */
+struct push_parser {
+  uint8_t *buf;
+  uint32_t size;
+  uint32_t len;
+  uint32_t crc;
+  uint8_t state;
+  struct decoder_stats stats;
+};
+
+/**
+ * \brief Packet completed by the push parser.
+ *
+ * The data points into the parser buffer, and stays valid until the next
+ * call of the parser.
+ */
+struct push_packet {
+  const uint8_t *data;
+  uint32_t len;
+  uint8_t status;
+};
+
+/**
+* \brief Initialize a push parser.
+*
+* \param p 		Pointer to the parser.
+* \param buf 	Pointer to the packet buffer.
+* \param size 	Size of the packet buffer, at least PUSH_MIN_BUFFER.
+* \return 		True if the buffer is large enough.
+*/
+bool push_init(struct push_parser *p, uint8_t *buf, uint32_t size) {
+  memset(p, 0, sizeof(*p));
+  p->buf = buf;
+  p->size = size;
+  p->crc = CRC32_INIT;
+  p->state = push_idle;
+  return buf != NULL && size >= PUSH_MIN_BUFFER;
+}
+
+/**
+* \brief Append a byte to the packet.
+*
+* Drops the packet if it doesn't fit the buffer.
+*
+* \param p Pointer to the parser.
+* \param c Byte.
+* \return
+*/
+void push_byte(struct push_parser *p, uint8_t c) {
+  if (p->len == p->size) {
+    p->stats.overflow_drops++;
+    p->state = push_idle;
+    return;
+  }
+  p->buf[p->len++] = c;
+  p->crc = crc32_byte(p->crc, c);
+  p->state = push_data;
+}
+
+/**
+* \brief Push data into the parser until a packet is completed.
+*
+* Consumes the data up to and including the next DLE ETX that ends a packet,
+* and advances the data pointer past it. The spans between the DLE characters
+* are located with the vectorized DLE search, copied in bulk and added to the
+* CRC register, and the completed packet is checked by validate_packet_crc().
+*
+* \param p 			Pointer to the parser.
+* \param data 		Pointer to the data, advanced past the consumed bytes.
+* \param len 		Size of the data, reduced by the consumed bytes.
+* \param[out] pkt 	Completed packet, the valid packets without the
+* checksum.
+* \return 			True if a packet was completed, false if all the data was
+* consumed first.
+*/
+bool push_next(struct push_parser *p, const uint8_t **data, uint32_t *len,
+               struct push_packet *pkt) {
+  const uint8_t *raw = *data;
+  uint32_t n = *len;
+  uint32_t i = 0;
+  bool done = false;
+  while (i < n && !done) {
+    switch (p->state) {
+    case push_idle:
+      i = g_dle_scan(raw, i, n);
+      if (i < n) {
+        p->state = push_idle_dle;
+        i++;
+      }
+      break;
+    case push_data: {
+      // copy the data up to the next DLE
+      uint32_t next = g_dle_scan(raw, i, n);
+      if (p->len + next - i > p->size) {
+        p->stats.overflow_drops++;
+        p->state = push_idle;
+        break;
+      }
+      memcpy(p->buf + p->len, raw + i, next - i);
+      p->crc = crc32_update(p->crc, raw + i, next - i);
+      p->len += next - i;
+      i = next;
+      if (i < n) {
+        p->state = push_data_dle;
+        i++;
+      }
+      break;
+    }
+    default: {
+      uint8_t c = raw[i++];
+      if (c == ETX) {
+        if (p->state == push_data_dle) {
+          // end of packet
+          pkt->status = validate_packet_crc(p->buf, 0, p->len, p->crc);
+          pkt->data = p->buf;
+          pkt->len = (pkt->status == none) ? p->len - 4 : p->len;
+          if (pkt->status == none)
+            p->stats.packets_out++;
+          else
+            p->stats.rejects[pkt->status]++;
+          done = true;
+        }
+        p->state = push_idle;
+      } else if (c == DLE) {
+        // escaped DLE, data only within a packet
+        if (p->state == push_data_dle)
+          push_byte(p, c);
+        else
+          p->state = push_idle;
+      } else {
+        // packet start, an unterminated packet is dropped
+        p->len = 0;
+        p->crc = CRC32_INIT;
+        push_byte(p, c);
+      }
+      break;
+    }
+    }
+  }
+  p->stats.bytes_in += i;
+  *data += i;
+  *len -= i;
+  return done;
+}
+
+/**
+* \brief Push data into the parser and dispatch the valid packets.
+*
+* \param p 		Pointer to the parser.
+* \param data 	Pointer to the data.
+* \param len 	Size of the data.
+* \return 		Number of valid packets dispatched.
+*/
+uint32_t push_parse(struct push_parser *p, const uint8_t *data, uint32_t len) {
+  struct push_packet pkt;
+  uint32_t count = 0;
+  while (push_next(p, &data, &len, &pkt)) {
+    if (pkt.status == none) {
+      tsip_dispatch(pkt.data, pkt.len);
+      count++;
+    }
+  }
+  return count;
+}
+
+#endif
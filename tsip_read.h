@@ -6,7 +6,9 @@
 #define TSIP_H 
 
 #include "stdio.h"
+#include "string.h"
 #include "util.h"
+#include "tsip_packet.h"
 #include "stdbool.h"
 /**
  * \brief DLE flag
@@ -55,35 +57,49 @@ uint32_t uavnComRead(uint8_t* const buffer, const uint32_t count) {
     uint32_t end = min(g_test_data_start + count, g_test_data_len);
 
     // fill the buffer from the test data array
-    for (uint32_t i = g_test_data_start; i < end; i++) {
-        buffer[i - g_test_data_start] = g_test_data[i];
-    }
+    memcpy(buffer, g_test_data + g_test_data_start, end - g_test_data_start);
     int32_t len = end - g_test_data_start;
     g_test_data_start = end;
     return len;
 }
 /**
-* \brief Parse a TSIP data.
+* \brief Print a TSIP packet.
+*
+* Prints the IDs and the checksum, followed by the payload bytes in rows of
+* four.
 *
+* \param[in] f Output stream.
 * \param[in] buffer Const pointer where data is located.
-* \param[in] numberOfBytes It is filled with the number bytes in the TSIP
-* packet.
+* \param[in] numberOfBytes Number of bytes in the TSIP packet.
 */
-void ParseTsipData(const uint8_t* const buffer, const uint32_t numberOfBytes) {
-    if(g_verbose_output){
-    printf("ID1: %u ID2: %u CHKSUM: %#08x\n",buffer[0],buffer[1], crc32(buffer,0,numberOfBytes));
+void tsip_print(FILE* f, const uint8_t* const buffer, const uint32_t numberOfBytes) {
+    fprintf(f, "ID1: %u ID2: %u CHKSUM: %#08x\n",buffer[0],buffer[1], crc32(buffer,0,numberOfBytes));
     int style_counter = 0;
     for (int i = 2; i < numberOfBytes; i++) {
-            printf("%02x ", buffer[i]);
+            fprintf(f, "%02x ", buffer[i]);
         style_counter++;
         if(style_counter == 4){
         style_counter = 0;
-    printf("\n");
+    fprintf(f, "\n");
         }
 
     }
-    printf("\n\n");
-
+    fprintf(f, "\n\n");
+}
+/**
+* \brief Parse a TSIP data.
+*
+* Passes the packet on to the typed packet dispatch, and prints it out in the
+* verbose mode.
+*
+* \param[in] buffer Const pointer where data is located.
+* \param[in] numberOfBytes It is filled with the number bytes in the TSIP
+* packet.
+*/
+void ParseTsipData(const uint8_t* const buffer, const uint32_t numberOfBytes) {
+    tsip_dispatch(buffer, numberOfBytes);
+    if(g_verbose_output){
+    tsip_print(stdout, buffer, numberOfBytes);
     }
 }
 #endif
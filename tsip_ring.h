@@ -0,0 +1,379 @@
+/** @file tsip_ring.h
+ * \brief Header containing the COM reader ring buffer.
+ * A dedicated reader thread drains the input source into a lock-free single
+ * producer, single consumer ring buffer, which the decoder consumes
+*/
+#ifndef TSIP_RING_H
+#define TSIP_RING_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tsip_decode.h"
+
+/**
+ * \brief Longest time the reader stays parked on a full ring, in case the
+ * wakeup is missed.
+ */
+#define RING_PARK_NS 1000000
+/**
+ * \brief Time the reader sleeps before polling an empty source again.
+ */
+#define RING_POLL_NS 100000
+
+/**
+ * \brief Ring buffer overflow policies.
+ */
+enum ring_policy {
+  ring_block, //!< the reader waits for the decoder to make room
+  ring_drop   //!< the reader keeps draining the source, dropping the data
+};
+
+/**
+ * \brief Single producer, single consumer byte ring buffer.
+ *
+ * The producer only writes the head and the consumer only writes the tail, so
+ * neither side takes a lock. Each side keeps a cached copy of the other
+ * side's index and only reloads it when the cached one shows the ring full or
+ * empty.
+ */
+struct spsc_ring {
+  uint8_t *buf;
+  uint32_t size;
+  uint32_t mask;
+  _Alignas(64) _Atomic uint64_t head;
+  uint64_t tail_cache;
+  _Alignas(64) _Atomic uint64_t tail;
+  uint64_t head_cache;
+  //! producer parked on a full ring, woken by the consumer
+  _Alignas(64) _Atomic bool parked;
+  pthread_mutex_t park_lock;
+  pthread_cond_t park_cond;
+};
+
+/**
+* \brief Allocate a ring buffer.
+*
+* \param ring 	Pointer to the ring buffer.
+* \param size 	Minimum capacity, rounded up to a power of two.
+* \return 		True if the buffer was allocated, false if it couldn't be or
+* the size is over 2^31.
+*/
+bool ring_init(struct spsc_ring *ring, uint32_t size) {
+  // a larger size has no power of two in range to round up to
+  ring->size = 1;
+  while (ring->size < size && ring->size < 1u << 31) {
+    ring->size <<= 1;
+  }
+  ring->mask = ring->size - 1;
+  ring->buf = size <= 1u << 31 ? (uint8_t *)malloc(ring->size) : NULL;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  ring->tail_cache = 0;
+  ring->head_cache = 0;
+  atomic_init(&ring->parked, false);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&ring->park_lock, NULL);
+  pthread_cond_init(&ring->park_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  return ring->buf != NULL;
+}
+
+/**
+* \brief Release a ring buffer.
+*
+* \param ring Pointer to the ring buffer.
+* \return
+*/
+void ring_free(struct spsc_ring *ring) {
+  free(ring->buf);
+  ring->buf = NULL;
+  pthread_mutex_destroy(&ring->park_lock);
+  pthread_cond_destroy(&ring->park_cond);
+}
+
+/**
+* \brief Number of bytes held by the ring buffer.
+*
+* \param ring Pointer to the ring buffer.
+* \return 	Number of bytes.
+*/
+uint32_t ring_used(struct spsc_ring *ring) {
+  return atomic_load_explicit(&ring->head, memory_order_acquire) -
+         atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+/**
+* \brief Get the contiguous free space of the ring buffer, producer side.
+*
+* \param ring 	Pointer to the ring buffer.
+* \param len 	Size of the free space.
+* \return 		Pointer to the free space.
+*/
+uint8_t *ring_write_ptr(struct spsc_ring *ring, uint32_t *len) {
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - ring->tail_cache == ring->size)
+    ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  uint32_t space = ring->size - (uint32_t)(head - ring->tail_cache);
+  uint32_t offset = head & ring->mask;
+  *len = min(space, ring->size - offset);
+  return ring->buf + offset;
+}
+
+/**
+* \brief Publish data written to the free space, producer side.
+*
+* \param ring 	Pointer to the ring buffer.
+* \param len 	Number of bytes written.
+* \return
+*/
+void ring_commit(struct spsc_ring *ring, uint32_t len) {
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+/**
+* \brief Write data to the ring buffer, producer side.
+*
+* \param ring 	Pointer to the ring buffer.
+* \param data 	Pointer to the data.
+* \param len 	Size of the data.
+* \return 		Number of bytes written, less than len if the ring is full.
+*/
+uint32_t ring_write(struct spsc_ring *ring, const uint8_t *data, uint32_t len) {
+  uint32_t written = 0;
+  while (written < len) {
+    uint32_t space;
+    uint8_t *dst = ring_write_ptr(ring, &space);
+    if (space == 0)
+      break;
+    space = min(space, len - written);
+    memcpy(dst, data + written, space);
+    ring_commit(ring, space);
+    written += space;
+  }
+  return written;
+}
+
+/**
+* \brief Read data from the ring buffer, consumer side.
+*
+* \param ring 	Pointer to the ring buffer.
+* \param data 	Pointer to the destination.
+* \param len 	Maximum number of bytes to be read.
+* \return 		Number of bytes read.
+*/
+uint32_t ring_read(struct spsc_ring *ring, uint8_t *data, uint32_t len) {
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (ring->head_cache - tail < len)
+    ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+  len = min(len, (uint32_t)(ring->head_cache - tail));
+  uint32_t offset = tail & ring->mask;
+  uint32_t first = min(len, ring->size - offset);
+  memcpy(data, ring->buf + offset, first);
+  memcpy(data + first, ring->buf, len - first);
+  atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+  // pairs with the fence in ring_wait_space(), either the producer sees the
+  // room or the consumer sees it parked
+  atomic_thread_fence(memory_order_seq_cst);
+  if (len != 0 && atomic_load_explicit(&ring->parked, memory_order_relaxed)) {
+    pthread_mutex_lock(&ring->park_lock);
+    pthread_cond_signal(&ring->park_cond);
+    pthread_mutex_unlock(&ring->park_lock);
+  }
+  return len;
+}
+
+/**
+* \brief Wait for the consumer to make room in a full ring, producer side.
+*
+* Parks the producer until the consumer reads from the ring, or for
+* RING_PARK_NS at most.
+*
+* \param ring Pointer to the ring buffer.
+* \return
+*/
+void ring_wait_space(struct spsc_ring *ring) {
+  pthread_mutex_lock(&ring->park_lock);
+  atomic_store_explicit(&ring->parked, true, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (ring_used(ring) == ring->size) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += RING_PARK_NS;
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&ring->park_cond, &ring->park_lock, &ts);
+  }
+  atomic_store_explicit(&ring->parked, false, memory_order_relaxed);
+  pthread_mutex_unlock(&ring->park_lock);
+}
+
+/**
+ * \brief Reader thread filling a ring buffer from an input source.
+ */
+struct ring_reader {
+  pthread_t thread;
+  struct tsip_source *src;
+  struct spsc_ring *ring;
+  uint8_t policy;
+  bool stop_at_end;
+  _Atomic bool running;
+  _Atomic bool done;
+  _Atomic uint64_t received;
+  _Atomic uint64_t dropped;
+};
+
+/**
+* \brief Ring reader thread function
+*
+* Reads the source straight into the free space of the ring buffer. Once the
+* ring is full the reader either parks until the decoder makes room, or keeps
+* draining the source and drops the data, so that the port itself never
+* overruns. An empty source that doesn't wait by itself is polled every
+* RING_POLL_NS.
+*
+* \param[in] r Pointer to the reader.
+* \return
+*/
+void *ring_reader_thread(void *r) {
+  struct ring_reader *reader = (struct ring_reader *)r;
+  uint8_t discard[MAX_COM_SIZE];
+  const uint8_t *data;
+  while (atomic_load_explicit(&reader->running, memory_order_relaxed)) {
+    uint32_t space;
+    uint8_t *dst = ring_write_ptr(reader->ring, &space);
+    if (space == 0 && reader->policy == ring_block) {
+      ring_wait_space(reader->ring);
+      continue;
+    }
+    uint32_t len;
+    if (space == 0) {
+      len = reader->src->read(reader->src, discard, &data, MAX_COM_SIZE);
+      atomic_fetch_add_explicit(&reader->dropped, len, memory_order_relaxed);
+    } else {
+      len = reader->src->read(reader->src, dst, &data, space);
+      if (data != dst)
+        memcpy(dst, data, len);
+      ring_commit(reader->ring, len);
+    }
+    atomic_fetch_add_explicit(&reader->received, len, memory_order_relaxed);
+    if (len == 0) {
+      if (reader->stop_at_end)
+        break;
+      // the serial source waits by itself, the others are polled
+      if (reader->src->timeout_ms == 0) {
+        struct timespec ts = {0, RING_POLL_NS};
+        nanosleep(&ts, NULL);
+      }
+    }
+  }
+  atomic_store_explicit(&reader->done, true, memory_order_release);
+  return NULL;
+}
+
+/**
+* \brief Start a ring reader thread.
+*
+* \param reader 		Pointer to the reader.
+* \param src 			Pointer to the input source.
+* \param ring 			Pointer to the ring buffer.
+* \param policy 		Overflow policy.
+* \param stop_at_end 	Stop once the source returns no data, for the
+* finite sources.
+* \return 				True if the thread was started.
+*/
+bool ring_reader_start(struct ring_reader *reader, struct tsip_source *src,
+                       struct spsc_ring *ring, uint8_t policy,
+                       bool stop_at_end) {
+  reader->src = src;
+  reader->ring = ring;
+  reader->policy = policy;
+  reader->stop_at_end = stop_at_end;
+  atomic_init(&reader->running, true);
+  atomic_init(&reader->done, false);
+  atomic_init(&reader->received, 0);
+  atomic_init(&reader->dropped, 0);
+  return pthread_create(&reader->thread, NULL, ring_reader_thread, reader) == 0;
+}
+
+/**
+* \brief Set the scheduling of a ring reader thread.
+*
+* A reader with a real-time priority polls the source, so it should not be
+* given a higher priority than the decoder threads sharing its CPU.
+*
+* \param reader 	Pointer to the reader.
+* \param priority 	SCHED_FIFO priority, 0 for the default policy.
+* \param cpu 		CPU to pin the thread to, negative to unpin it.
+* \return 			Settings that took effect, as thread_sched_result flags.
+*/
+uint8_t ring_reader_set_sched(struct ring_reader *reader, int priority,
+                              int cpu) {
+  return thread_sched_apply(reader->thread, priority, cpu);
+}
+
+/**
+* \brief Check if a ring reader has stopped reading.
+*
+* \param reader Pointer to the reader.
+* \return 		True if the reader thread has exited.
+*/
+bool ring_reader_done(struct ring_reader *reader) {
+  return atomic_load_explicit(&reader->done, memory_order_acquire);
+}
+
+/**
+* \brief Stop a ring reader thread.
+*
+* \param reader Pointer to the reader.
+* \return
+*/
+void ring_reader_stop(struct ring_reader *reader) {
+  atomic_store_explicit(&reader->running, false, memory_order_relaxed);
+  pthread_join(reader->thread, NULL);
+}
+
+/**
+* \brief Read from a ring buffer.
+*
+* \param src 		Pointer to the source.
+* \param scratch 	Pointer to the copy destination.
+* \param data 		Pointer to the read data.
+* \param count 		Maximum number of bytes to be read.
+* \return 			Number of read bytes.
+*/
+uint32_t source_ring_read(struct tsip_source *src, uint8_t *scratch,
+                          const uint8_t **data, uint32_t count) {
+  *data = scratch;
+  uint32_t len = ring_read((struct spsc_ring *)src->ctx, scratch, count);
+  src->pos += len;
+  return len;
+}
+
+/**
+* \brief Set up a source reading from a ring buffer.
+*
+* The decoder is the ring consumer, it takes whatever the reader thread has
+* put in the ring so far.
+*
+* \param src 	Pointer to the source.
+* \param ring 	Pointer to the ring buffer.
+* \return
+*/
+void source_ring_init(struct tsip_source *src, struct spsc_ring *ring) {
+  source_mem_init(src, NULL, 0);
+  src->read = source_ring_read;
+  src->ctx = ring;
+}
+
+#endif
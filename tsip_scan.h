@@ -0,0 +1,157 @@
+/** @file tsip_scan.h
+ * \brief Header containing the DLE scanning functions.
+ * Vectorized DLE search kernels, selected at runtime based on the CPU features
+*/
+#ifndef TSIP_SCAN_H
+#define TSIP_SCAN_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+/**
+ * \brief x86 vector kernels availability flag.
+ */
+#define SCAN_X86 1
+#else
+#define SCAN_X86 0
+#endif
+
+/**
+ * \brief DLE search kernel.
+ *
+ * Returns the offset of the first DLE character in raw[start, end), or end if
+ * there's none.
+ */
+typedef uint32_t (*dle_scan_fn)(const uint8_t *raw, uint32_t start,
+                                uint32_t end);
+
+/**
+* \brief Find the next DLE character, one byte at a time.
+*
+* \param raw 	Pointer to raw data.
+* \param start 	Offset to start the search from.
+* \param end 	Offset to end the search at.
+* \return 		Offset of the first DLE character, end if none is found.
+*/
+uint32_t dle_scan_scalar(const uint8_t *raw, uint32_t start, uint32_t end) {
+  while (start < end && raw[start] != 0x10) {
+    start++;
+  }
+  return start;
+}
+
+#if SCAN_X86
+/**
+* \brief Find the next DLE character, 16 bytes at a time.
+*
+* \param raw 	Pointer to raw data.
+* \param start 	Offset to start the search from.
+* \param end 	Offset to end the search at.
+* \return 		Offset of the first DLE character, end if none is found.
+*/
+__attribute__((target("sse2"))) uint32_t
+dle_scan_sse2(const uint8_t *raw, uint32_t start, uint32_t end) {
+  const __m128i dle = _mm_set1_epi8(0x10);
+  for (; start + 16 <= end; start += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(raw + start));
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, dle));
+    if (mask != 0)
+      return start + __builtin_ctz(mask);
+  }
+  return dle_scan_scalar(raw, start, end);
+}
+
+/**
+* \brief Find the next DLE character, 32 bytes at a time.
+*
+* Packets put a DLE every few dozen bytes, so the first 16 bytes are checked
+* with SSE2 before the wider loads pay off.
+*
+* \param raw 	Pointer to raw data.
+* \param start 	Offset to start the search from.
+* \param end 	Offset to end the search at.
+* \return 		Offset of the first DLE character, end if none is found.
+*/
+__attribute__((target("avx2"))) uint32_t
+dle_scan_avx2(const uint8_t *raw, uint32_t start, uint32_t end) {
+  if (start + 16 <= end) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(raw + start));
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(0x10)));
+    if (mask != 0)
+      return start + __builtin_ctz(mask);
+    start += 16;
+  }
+  const __m256i dle = _mm256_set1_epi8(0x10);
+  for (; start + 32 <= end; start += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(raw + start));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, dle));
+    if (mask != 0)
+      return start + __builtin_ctz(mask);
+  }
+  return dle_scan_sse2(raw, start, end);
+}
+#endif
+
+/**
+* \brief Select the fastest DLE search kernel supported by the CPU.
+*
+* The order follows the DLE scan benchmark: AVX2 is the fastest on sparse DLE
+* data and ties with SSE2 on DLE-heavy data.
+*
+* \return Pointer to the kernel.
+*/
+dle_scan_fn dle_scan_select() {
+#if SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return dle_scan_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return dle_scan_sse2;
+#endif
+  return dle_scan_scalar;
+}
+
+uint32_t dle_scan_resolve(const uint8_t *raw, uint32_t start, uint32_t end);
+
+/**
+ * \brief DLE search kernel in use, selected on the first call.
+ */
+static _Atomic dle_scan_fn g_dle_scan = dle_scan_resolve;
+static pthread_once_t g_dle_scan_once = PTHREAD_ONCE_INIT;
+
+/**
+* \brief Publish the DLE search kernel selected for the CPU.
+*
+* \return
+*/
+void dle_scan_pick() {
+  atomic_store_explicit(&g_dle_scan, dle_scan_select(), memory_order_release);
+}
+
+/**
+* \brief Select the DLE search kernel, once.
+*
+* Safe to call from several threads at a time.
+*
+* \return
+*/
+void dle_scan_init() { pthread_once(&g_dle_scan_once, dle_scan_pick); }
+
+/**
+* \brief Select the DLE search kernel and run it.
+*
+* \param raw 	Pointer to raw data.
+* \param start 	Offset to start the search from.
+* \param end 	Offset to end the search at.
+* \return 		Offset of the first DLE character, end if none is found.
+*/
+uint32_t dle_scan_resolve(const uint8_t *raw, uint32_t start, uint32_t end) {
+  dle_scan_init();
+  dle_scan_fn scan = atomic_load_explicit(&g_dle_scan, memory_order_acquire);
+  return scan(raw, start, end);
+}
+
+#endif
@@ -0,0 +1,331 @@
+/** @file tsip_source.h
+ * \brief Header containing the decoder input sources.
+ * The decoder pulls its raw data from an input source. Memory backed sources
+ * hand out pointers into their data instead of copying it, while the serial
+ * source reads a UART without blocking
+*/
+#ifndef TSIP_SOURCE_H
+#define TSIP_SOURCE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tsip_read.h"
+
+struct tsip_source;
+
+/**
+ * \brief Input source read function.
+ *
+ * Reads up to count bytes and points data at them. A source that has to copy
+ * its data writes it to scratch, which holds at least count bytes, while a
+ * memory backed source points data into its own memory. Returns the number of
+ * bytes read, 0 if no data is available.
+ */
+typedef uint32_t (*source_read_fn)(struct tsip_source *src, uint8_t *scratch,
+                                   const uint8_t **data, uint32_t count);
+
+/**
+ * \brief Decoder input source.
+ */
+struct tsip_source {
+  source_read_fn read;
+  const uint8_t *data;
+  uint64_t len;
+  uint64_t pos;
+  uint32_t max_read;
+  void *map;
+  uint64_t map_len;
+  int fd;
+  int epoll_fd;
+  int timeout_ms;
+  void *ctx;
+};
+
+/**
+* \brief Read from the COM interface.
+*
+* \param src 		Pointer to the source.
+* \param scratch 	Pointer to the copy destination.
+* \param data 		Pointer to the read data.
+* \param count 		Maximum number of bytes to be read.
+* \return 			Number of read bytes.
+*/
+uint32_t source_com_read(struct tsip_source *src, uint8_t *scratch,
+                         const uint8_t **data, uint32_t count) {
+  *data = scratch;
+  return uavnComRead(scratch, min(count, src->max_read));
+}
+
+/**
+* \brief Read from memory, without copying.
+*
+* \param src 		Pointer to the source.
+* \param scratch 	Unused.
+* \param data 		Pointer to the read data.
+* \param count 		Maximum number of bytes to be read.
+* \return 			Number of read bytes.
+*/
+uint32_t source_mem_read(struct tsip_source *src, uint8_t *scratch,
+                         const uint8_t **data, uint32_t count) {
+  (void)scratch;
+  uint32_t len = min((uint64_t)count, src->len - src->pos);
+  *data = src->data + src->pos;
+  src->pos += len;
+  return len;
+}
+
+/**
+* \brief Check if a source reads from memory.
+*
+* All the data of a memory source is there from the start, so it can be split
+* into blocks up front instead of being read.
+*
+* \param src Pointer to the source.
+* \return 	True if the source reads from memory.
+*/
+bool source_is_mem(const struct tsip_source *src) {
+  return src->read == source_mem_read;
+}
+
+/**
+* \brief Set up a source reading from a memory buffer.
+*
+* The buffer has to stay valid while the source is in use.
+*
+* \param src 	Pointer to the source.
+* \param data 	Pointer to the buffer.
+* \param len 	Size of the buffer.
+* \return
+*/
+void source_mem_init(struct tsip_source *src, const uint8_t *data,
+                     uint64_t len) {
+  memset(src, 0, sizeof(*src));
+  src->read = source_mem_read;
+  src->data = data;
+  src->len = len;
+  src->fd = -1;
+  src->epoll_fd = -1;
+}
+
+/**
+* \brief Set up a source reading from the COM interface.
+*
+* \param src 		Pointer to the source.
+* \param max_read 	Maximum size of a single COM read, at least 1.
+* \return 			True if the source was set up.
+*/
+bool source_com_init(struct tsip_source *src, uint32_t max_read) {
+  source_mem_init(src, NULL, 0);
+  if (max_read == 0)
+    return false;
+  src->read = source_com_read;
+  src->max_read = max_read;
+  return true;
+}
+
+/**
+* \brief Set up a source reading from a memory mapped file.
+*
+* The file is mapped read-only and read sequentially, so loading it costs a
+* single page fault pass and no copies.
+*
+* \param src 	Pointer to the source.
+* \param fname 	File name.
+* \return 		True if the file was mapped.
+*/
+bool source_mmap_open(struct tsip_source *src, const char *fname) {
+  source_mem_init(src, NULL, 0);
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  if (st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    src->map = map;
+    src->map_len = st.st_size;
+    src->data = (const uint8_t *)map;
+    src->len = st.st_size;
+  }
+  // the mapping stays valid without the descriptor
+  close(fd);
+  return true;
+}
+
+/**
+* \brief Read from a serial port.
+*
+* Reads the data already received by the port. If there's none, waits for up
+* to the source timeout for the port to become readable. A read or a wait
+* interrupted by a signal is resumed, the wait with the time left of it.
+*
+* \param src 		Pointer to the source.
+* \param scratch 	Pointer to the copy destination.
+* \param data 		Pointer to the read data.
+* \param count 		Maximum number of bytes to be read.
+* \return 			Number of read bytes.
+*/
+uint32_t source_serial_read(struct tsip_source *src, uint8_t *scratch,
+                            const uint8_t **data, uint32_t count) {
+  *data = scratch;
+  count = min(count, src->max_read);
+  ssize_t len;
+  do {
+    len = read(src->fd, scratch, count);
+  } while (len < 0 && errno == EINTR);
+  if (len < 0 && errno == EAGAIN && src->timeout_ms != 0) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t deadline = ts.tv_sec * 1000ll + ts.tv_nsec / 1000000 +
+                       src->timeout_ms;
+    int64_t left = src->timeout_ms;
+    struct epoll_event ev;
+    int n;
+    while ((n = epoll_wait(src->epoll_fd, &ev, 1, (int)left)) < 0 &&
+           errno == EINTR) {
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      left = max(deadline - (ts.tv_sec * 1000ll + ts.tv_nsec / 1000000), 0ll);
+    }
+    if (n > 0) {
+      do {
+        len = read(src->fd, scratch, count);
+      } while (len < 0 && errno == EINTR);
+    }
+  }
+  if (len <= 0)
+    return 0;
+  src->pos += len;
+  return len;
+}
+
+/**
+* \brief Convert a baud rate to a termios speed.
+*
+* \param baud Baud rate.
+* \return 	Termios speed, B0 if the rate is not supported.
+*/
+speed_t serial_speed(uint32_t baud) {
+  switch (baud) {
+  case 9600:
+    return B9600;
+  case 19200:
+    return B19200;
+  case 38400:
+    return B38400;
+  case 57600:
+    return B57600;
+  case 115200:
+    return B115200;
+  case 230400:
+    return B230400;
+  case 460800:
+    return B460800;
+  case 921600:
+    return B921600;
+  default:
+    return B0;
+  }
+}
+
+void source_close(struct tsip_source *src);
+
+/**
+* \brief Set up a source reading from a serial port.
+*
+* Opens the port in non-blocking mode and configures it for raw 8N1 transfer,
+* so that the DLE and ETX characters are passed through untouched.
+*
+* \param src 		Pointer to the source.
+* \param path 		Serial port device path.
+* \param baud 		Baud rate.
+* \param max_read 	Maximum size of a single port read, at least 1.
+* \param timeout_ms 	Time to wait for data once the port is drained, 0 to
+* return straight away.
+* \return 			True if the port was set up.
+*/
+bool source_serial_open(struct tsip_source *src, const char *path,
+                        uint32_t baud, uint32_t max_read, int timeout_ms) {
+  source_mem_init(src, NULL, 0);
+  speed_t speed = serial_speed(baud);
+  // a read of 0 bytes would look like a drained port forever
+  if (speed == B0 || max_read == 0)
+    return false;
+  src->read = source_serial_read;
+  src->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (src->fd < 0)
+    return false;
+  struct termios tio;
+  if (tcgetattr(src->fd, &tio) != 0) {
+    source_close(src);
+    return false;
+  }
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  if (tcsetattr(src->fd, TCSANOW, &tio) != 0) {
+    source_close(src);
+    return false;
+  }
+  tcflush(src->fd, TCIFLUSH);
+  // readiness notification for the waits
+  src->epoll_fd = epoll_create1(0);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = src->fd;
+  if (src->epoll_fd < 0 ||
+      epoll_ctl(src->epoll_fd, EPOLL_CTL_ADD, src->fd, &ev) != 0) {
+    source_close(src);
+    return false;
+  }
+  src->max_read = max_read;
+  src->timeout_ms = timeout_ms;
+  return true;
+}
+
+/**
+* \brief Rewind a memory backed source to the start of its data.
+*
+* \param src Pointer to the source.
+* \return
+*/
+void source_rewind(struct tsip_source *src) { src->pos = 0; }
+
+/**
+* \brief Release the source resources.
+*
+* \param src Pointer to the source.
+* \return
+*/
+void source_close(struct tsip_source *src) {
+  if (src->map != NULL)
+    munmap(src->map, src->map_len);
+  if (src->read == source_serial_read) {
+    if (src->epoll_fd >= 0)
+      close(src->epoll_fd);
+    if (src->fd >= 0)
+      close(src->fd);
+  }
+  source_mem_init(src, NULL, 0);
+}
+
+#endif
@@ -0,0 +1,98 @@
+/** @file tsip_stats.h
+ * \brief Header containing the decoder statistics.
+ * Counters of the data and packets going through a decoder context, and a
+ * packet latency histogram, read out as a snapshot
+*/
+#ifndef TSIP_STATS_H
+#define TSIP_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * \brief Number of reject counters, indexed by the validation error.
+ */
+#define STATS_REJECT_REASONS 4
+/**
+ * \brief Number of latency histogram bins, bin i counts the latencies from
+ * 2^i up to 2^(i+1) ns.
+ */
+#define STATS_LATENCY_BINS 32
+
+/**
+ * \brief Decoder statistics.
+ *
+ * The counters are only written from within the parse turn, so they are plain
+ * integers. They keep counting across the ticks until reset.
+ */
+struct decoder_stats {
+  //! raw bytes read from the source
+  uint64_t bytes_in;
+  //! valid packets passed on
+  uint64_t packets_out;
+  //! invalid packets, by validation error
+  uint64_t rejects[STATS_REJECT_REASONS];
+  //! packet tails dropped because they didn't fit the inter buffer
+  uint64_t overflow_drops;
+  //! packets patched together from the inter buffer
+  uint64_t reassemblies;
+  //! time spent waiting for the read lock and for the blocks to be parsed
+  uint64_t read_wait_ns;
+  uint64_t parse_wait_ns;
+  //! latency from the block read to the packet being passed on
+  uint64_t latency[STATS_LATENCY_BINS];
+};
+
+/**
+* \brief Add packets to the latency histogram.
+*
+* \param stats 	Pointer to the statistics.
+* \param ns 	Packet latency.
+* \param count 	Number of packets.
+* \return
+*/
+void stats_latency_add(struct decoder_stats *stats, uint64_t ns,
+                       uint64_t count) {
+  uint8_t bin = 63 - __builtin_clzll(ns | 1);
+  if (bin >= STATS_LATENCY_BINS)
+    bin = STATS_LATENCY_BINS - 1;
+  stats->latency[bin] += count;
+}
+
+/**
+* \brief Estimate a latency percentile from the histogram.
+*
+* \param stats 	Pointer to the statistics.
+* \param p 		Percentile, between 0 and 1.
+* \return 		Upper bound of the bin holding the percentile in ns, 0 if
+* the histogram is empty.
+*/
+uint64_t stats_latency_percentile(const struct decoder_stats *stats,
+                                  double p) {
+  uint64_t total = 0;
+  for (uint8_t i = 0; i < STATS_LATENCY_BINS; i++) {
+    total += stats->latency[i];
+  }
+  if (total == 0)
+    return 0;
+  uint64_t rank = p * total;
+  uint64_t sum = 0;
+  for (uint8_t i = 0; i < STATS_LATENCY_BINS; i++) {
+    sum += stats->latency[i];
+    if (sum > rank)
+      return 2ull << i;
+  }
+  return 2ull << (STATS_LATENCY_BINS - 1);
+}
+
+/**
+* \brief Reset the statistics.
+*
+* \param stats Pointer to the statistics.
+* \return
+*/
+void stats_reset(struct decoder_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+
+#endif
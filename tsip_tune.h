@@ -0,0 +1,160 @@
+/** @file tsip_tune.h
+ * \brief Header containing the block size auto-tuner.
+ * Picks the decoder block size from the data read and the time taken by every
+ * tick, small blocks for a slow live link and large ones for a bulk replay
+*/
+#ifndef TSIP_TUNE_H
+#define TSIP_TUNE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+
+/**
+ * \brief Maximum number of candidate block sizes, powers of two from the
+ * smallest block size.
+ */
+#define TUNE_MAX_SIZES 16
+/**
+ * \brief Blocks per thread a tick has to read to count as a bulk tick.
+ */
+#define TUNE_BULK_BLOCKS 4
+/**
+ * \brief Bulk ticks between two probes of the same neighbouring block size.
+ */
+#define TUNE_PROBE 16
+
+/**
+ * \brief Block size auto-tuner state.
+ *
+ * A tick that reads only a few blocks per thread is limited by the data rate,
+ * so the block size follows the data read per thread, and a packet doesn't
+ * wait for the rest of the tick data to be decoded. A bulk tick is limited by
+ * the decoder, so the throughput of every candidate size is tracked and the
+ * fastest one is used, while its neighbours are probed now and then.
+ */
+struct block_tuner {
+  bool on;
+  //! time a thread may take to decode a block in the bulk mode, 0 for no limit
+  uint64_t latency_ns;
+  uint32_t min_block;
+  //! number of candidate sizes, and the current one
+  uint8_t sizes;
+  uint8_t k;
+  //! the last tick was a bulk tick
+  bool bulk;
+  uint32_t bulk_ticks;
+  //! smoothed data rate and the decoder throughput of the last tick, in B/s
+  double rate;
+  double throughput;
+  //! smoothed bulk throughput of every candidate size, 0 if not tried yet
+  double size_rate[TUNE_MAX_SIZES];
+  //! start of the last tick
+  uint64_t last_ns;
+};
+
+/**
+* \brief Get the candidate size index fitting a size.
+*
+* \param t 		Pointer to the tuner.
+* \param size 	Size in bytes.
+* \return 		Index of the smallest candidate holding the size, the
+* largest one if none does.
+*/
+uint8_t tune_fit(const struct block_tuner *t, uint64_t size) {
+  uint8_t k = 0;
+  while (k + 1 < t->sizes && ((uint64_t)t->min_block << k) < size) {
+    k++;
+  }
+  return k;
+}
+
+/**
+* \brief Get the block size chosen by the tuner.
+*
+* \param t Pointer to the tuner.
+* \return 	Block size in bytes.
+*/
+uint32_t tune_block(const struct block_tuner *t) {
+  return t->min_block << t->k;
+}
+
+/**
+* \brief Initialize the tuner.
+*
+* \param t 			Pointer to the tuner.
+* \param min_block 	Smallest block size.
+* \param max_block 	Largest block size.
+* \param block 		Block size to start from.
+* \return
+*/
+void tune_init(struct block_tuner *t, uint32_t min_block, uint32_t max_block,
+               uint32_t block) {
+  memset(t, 0, sizeof(*t));
+  t->min_block = min_block;
+  t->sizes = 1;
+  while (t->sizes < TUNE_MAX_SIZES &&
+         ((uint64_t)min_block << t->sizes) <= max_block) {
+    t->sizes++;
+  }
+  t->k = tune_fit(t, block);
+}
+
+/**
+* \brief Update the tuner with the result of a tick.
+*
+* \param t 			Pointer to the tuner.
+* \param bytes 		Data read by the tick.
+* \param start_ns 	Tick start time.
+* \param end_ns 	Tick end time.
+* \param n_threads 	Number of threads decoding the tick.
+* \return 			Block size for the next tick.
+*/
+uint32_t tune_update(struct block_tuner *t, uint64_t bytes, uint64_t start_ns,
+                     uint64_t end_ns, uint8_t n_threads) {
+  if (t->last_ns != 0 && start_ns > t->last_ns) {
+    double rate = bytes * 1e9 / (start_ns - t->last_ns);
+    t->rate = t->rate == 0 ? rate : t->rate + (rate - t->rate) / 4;
+  }
+  t->last_ns = start_ns;
+  if (bytes == 0)
+    return tune_block(t);
+  uint64_t busy_ns = end_ns > start_ns ? end_ns - start_ns : 1;
+  double throughput = bytes * 1e9 / busy_ns;
+  t->throughput = throughput;
+  t->bulk = bytes >= (uint64_t)TUNE_BULK_BLOCKS * n_threads * tune_block(t);
+  if (!t->bulk) {
+    // split the tick data evenly between the threads
+    t->k = tune_fit(t, (bytes + n_threads - 1) / n_threads);
+    return tune_block(t);
+  }
+
+  double *rate = &t->size_rate[t->k];
+  *rate = *rate == 0 ? throughput : *rate + (throughput - *rate) / 4;
+  // largest size a thread decodes within the latency limit
+  uint8_t top = t->sizes - 1;
+  while (t->latency_ns != 0 && top > 0 &&
+         ((double)t->min_block * n_threads * 1e9 / throughput) * (1u << top) >
+             t->latency_ns) {
+    top--;
+  }
+  uint8_t best = min(t->k, top);
+  for (uint8_t i = 0; i <= top; i++) {
+    if (t->size_rate[i] > t->size_rate[best])
+      best = i;
+  }
+  // try the untried neighbours first, then probe them in turn
+  t->bulk_ticks++;
+  t->k = best;
+  if (best < top && (t->size_rate[best + 1] == 0 ||
+                     t->bulk_ticks % TUNE_PROBE == 0))
+    t->k = best + 1;
+  else if (best > 0 && (t->size_rate[best - 1] == 0 ||
+                        t->bulk_ticks % TUNE_PROBE == TUNE_PROBE / 2))
+    t->k = best - 1;
+  return tune_block(t);
+}
+
+#endif
@@ -7,8 +7,23 @@ LIBS += -lpthread
 SOURCES += uavnav_main.c
 HEADERS += \
     util.h \
+    tsip_batch.h \
+    tsip_capture.h \
+    tsip_column.h \
     tsip_decode.h \
-    tsip_read.h
+    tsip_frame.h \
+    tsip_gen.h \
+    tsip_index.h \
+    tsip_offline.h \
+    tsip_packet.h \
+    tsip_pool.h \
+    tsip_push.h \
+    tsip_read.h \
+    tsip_ring.h \
+    tsip_scan.h \
+    tsip_source.h \
+    tsip_stats.h \
+    tsip_tune.h
 
 copydata.commands = $(COPY_DIR) $$PWD/data $$OUT_PWD
 first.depends = $(first) copydata
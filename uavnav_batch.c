@@ -0,0 +1,368 @@
+/** @file uavnav_batch.c
+ * \brief Offline batch decoder application.
+ *  Decodes a list or a directory of data files across all cores, and reports
+ *  the per file and the total counts
+*/
+
+#define _GNU_SOURCE
+#include "tsip_offline.h"
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+unsigned char *g_test_data = NULL;
+uint32_t g_test_data_len;
+uint32_t g_test_data_start;
+bool g_verbose_output;
+
+/**
+ * \brief Files to be decoded.
+ */
+struct batch_list {
+  struct offline_file *file;
+  uint32_t count;
+  uint32_t size;
+};
+
+/**
+* \brief Add a file to the list.
+*
+* \param list Pointer to the list.
+* \param path File path, copied.
+* \return 	True if the file was added.
+*/
+bool batch_add(struct batch_list *list, const char *path) {
+  if (list->count == list->size) {
+    uint32_t n = list->size ? 2 * list->size : 64;
+    struct offline_file *f =
+        (struct offline_file *)realloc(list->file, n * sizeof(*f));
+    if (f == NULL)
+      return false;
+    list->file = f;
+    list->size = n;
+  }
+  struct offline_file *f = &list->file[list->count];
+  memset(f, 0, sizeof(*f));
+  f->path = strdup(path);
+  if (f->path == NULL)
+    return false;
+  list->count++;
+  return true;
+}
+
+/**
+* \brief Compare two names, for sorting a directory listing.
+*
+* \param a Pointer to the first name.
+* \param b Pointer to the second name.
+* \return
+*/
+int batch_name_cmp(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+* \brief Add the regular files of a directory to the list, in name order.
+*
+* \param list Pointer to the list.
+* \param dir 	Directory path.
+* \return 	True if the directory was read.
+*/
+bool batch_add_dir(struct batch_list *list, const char *dir) {
+  DIR *d = opendir(dir);
+  if (d == NULL)
+    return false;
+  char **name = NULL;
+  uint32_t count = 0, size = 0;
+  bool ok = true;
+  struct dirent *e;
+  while (ok && (e = readdir(d)) != NULL) {
+    char *path = (char *)malloc(strlen(dir) + strlen(e->d_name) + 2);
+    struct stat st;
+    if (path == NULL) {
+      ok = false;
+      break;
+    }
+    sprintf(path, "%s/%s", dir, e->d_name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+      free(path);
+      continue;
+    }
+    if (count == size) {
+      size = size ? 2 * size : 64;
+      char **n = (char **)realloc(name, size * sizeof(*n));
+      ok = n != NULL;
+      if (ok)
+        name = n;
+    }
+    if (ok)
+      name[count++] = path;
+    else
+      free(path);
+  }
+  closedir(d);
+  qsort(name, count, sizeof(*name), batch_name_cmp);
+  for (uint32_t i = 0; i < count; i++) {
+    ok = ok && batch_add(list, name[i]);
+    free(name[i]);
+  }
+  free(name);
+  return ok;
+}
+
+/**
+* \brief Add the files named in a list file, one per line.
+*
+* \param list 	Pointer to the list.
+* \param fname 	List file name.
+* \return 		True if the list file was read.
+*/
+bool batch_add_list(struct batch_list *list, const char *fname) {
+  FILE *f = fopen(fname, "r");
+  if (f == NULL)
+    return false;
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+  bool ok = true;
+  while (ok && (n = getline(&line, &cap, f)) >= 0) {
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) {
+      line[--n] = 0;
+    }
+    if (n > 0)
+      ok = batch_add(list, line);
+  }
+  free(line);
+  fclose(f);
+  return ok;
+}
+
+/**
+* \brief Name the output of a file.
+*
+* \param dir 		Output directory.
+* \param path 		Input file path.
+* \param columns 	Name the column file instead of the decoded one.
+* \param n 		Number put in front of the suffix, negative for none.
+* \return 			Output file name, NULL if out of memory.
+*/
+char *batch_output_name(const char *dir, const char *path, bool columns,
+                        int64_t n) {
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  char *out = (char *)malloc(strlen(dir) + strlen(base) + 26);
+  if (out == NULL)
+    return NULL;
+  if (n < 0)
+    sprintf(out, "%s/%s.%s", dir, base, columns ? "col" : "txt");
+  else
+    sprintf(out, "%s/%s.%lld.%s", dir, base, (long long)n,
+            columns ? "col" : "txt");
+  return out;
+}
+
+/**
+ * \brief Output name of a file, for finding the duplicates.
+ */
+struct batch_name {
+  const char *name;
+  uint32_t file;
+};
+
+/**
+* \brief Compare two output names, for sorting.
+*
+* \param a Pointer to the first name.
+* \param b Pointer to the second name.
+* \return
+*/
+int batch_out_cmp(const void *a, const void *b) {
+  return strcmp(((const struct batch_name *)a)->name,
+                ((const struct batch_name *)b)->name);
+}
+
+/**
+* \brief Find the files sharing an output name.
+*
+* \param list 		Pointer to the list.
+* \param columns 	Check the column file names instead of the decoded ones.
+* \param[out] dup 	Set for every file whose output name is shared.
+* \return 			Number of files sharing a name, -1 if out of memory.
+*/
+int64_t batch_find_dups(struct batch_list *list, bool columns, bool *dup) {
+  struct batch_name *name =
+      (struct batch_name *)malloc(list->count * sizeof(*name));
+  if (name == NULL)
+    return -1;
+  for (uint32_t i = 0; i < list->count; i++) {
+    name[i].name = columns ? list->file[i].columns : list->file[i].out;
+    name[i].file = i;
+    dup[i] = false;
+  }
+  qsort(name, list->count, sizeof(*name), batch_out_cmp);
+  int64_t count = 0;
+  for (uint32_t i = 0; i + 1 < list->count; i++) {
+    if (strcmp(name[i].name, name[i + 1].name) != 0)
+      continue;
+    count += !dup[name[i].file] + !dup[name[i + 1].file];
+    dup[name[i].file] = true;
+    dup[name[i + 1].file] = true;
+  }
+  free(name);
+  return count;
+}
+
+/**
+* \brief Set the output file names of every file.
+*
+* The output of a file is its name with a .txt suffix for the decoded packets
+* or a .col suffix for the column file, in the output directory. Files with
+* the same name in different directories get their position in the list put
+* in front of the suffix, so that no two files are written to the same output.
+*
+* \param list 		Pointer to the list.
+* \param dir 		Output directory.
+* \param columns 	Set the column file names instead of the decoded ones.
+* \return 			True if the names were set, false if out of memory or if
+* the names still collide.
+*/
+bool batch_set_output(struct batch_list *list, const char *dir,
+                      bool columns) {
+  for (uint32_t i = 0; i < list->count; i++) {
+    char *out = batch_output_name(dir, list->file[i].path, columns, -1);
+    if (out == NULL)
+      return false;
+    if (columns)
+      list->file[i].columns = out;
+    else
+      list->file[i].out = out;
+  }
+  bool *dup = (bool *)malloc(list->count * sizeof(*dup));
+  if (dup == NULL)
+    return false;
+  int64_t count = batch_find_dups(list, columns, dup);
+  for (uint32_t i = 0; count > 0 && i < list->count; i++) {
+    if (!dup[i])
+      continue;
+    char **out = columns ? &list->file[i].columns : &list->file[i].out;
+    free(*out);
+    *out = batch_output_name(dir, list->file[i].path, columns, i);
+    if (*out == NULL)
+      count = -1;
+  }
+  // a renamed file may still clash with one named like it to begin with
+  if (count > 0)
+    count = batch_find_dups(list, columns, dup);
+  free(dup);
+  return count == 0;
+}
+
+/**
+* \brief Parse a thread count.
+*
+* \param arg 		Thread count argument.
+* \param threads 	Pointer to the thread count.
+* \return 			True if the argument is a number from 1 to
+* POOL_MAX_THREADS.
+*/
+bool batch_parse_threads(const char *arg, long *threads) {
+  char *end;
+  long n = strtol(arg, &end, 10);
+  if (end == arg || *end != '\0' || n < 1 || n > POOL_MAX_THREADS)
+    return false;
+  *threads = n;
+  return true;
+}
+
+/**
+* \brief Main function
+*
+* Decodes the data files given on the command line. A directory stands for the
+* regular files in it, and a name prefixed by @ for the files listed in it.
+* The -j option sets the number of threads, one per online core by default,
+* -o the directory the decoded packets are written to, and -c the directory of
+* the column files.
+*
+* \param[in] argc Number of arguments.
+* \param[in] argv Arguments.
+* \return
+*/
+int main(int argc, char *argv[]) {
+  setbuf(stdout, NULL);
+  const char *out_dir = NULL;
+  const char *col_dir = NULL;
+  // a thread per online core unless told otherwise
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  threads = min(max(threads, 1l), (long)POOL_MAX_THREADS);
+  int opt;
+  while ((opt = getopt(argc, argv, "j:o:c:")) != -1) {
+    if (opt == 'o') {
+      out_dir = optarg;
+    } else if (opt == 'c') {
+      col_dir = optarg;
+    } else if (opt != 'j' || !batch_parse_threads(optarg, &threads)) {
+      printf("Usage: %s [-j threads] [-o output directory] [-c column "
+             "directory] <file|directory|@list>...\n",
+             argv[0]);
+      return 2;
+    }
+  }
+  TaskUpLinkSetThreads((uint8_t)threads);
+  struct batch_list list = {NULL, 0, 0};
+  for (int i = optind; i < argc; i++) {
+    struct stat st;
+    bool ok;
+    if (argv[i][0] == '@')
+      ok = batch_add_list(&list, argv[i] + 1);
+    else if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+      ok = batch_add_dir(&list, argv[i]);
+    else
+      ok = batch_add(&list, argv[i]);
+    if (!ok) {
+      printf("Cannot read %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (list.count == 0) {
+    printf("No files to decode\n");
+    return 2;
+  }
+  if ((out_dir != NULL && !batch_set_output(&list, out_dir, false)) ||
+      (col_dir != NULL && !batch_set_output(&list, col_dir, true))) {
+    printf("Cannot name the output files\n");
+    return 2;
+  }
+
+  struct offline_report report;
+  bool ok = offline_decode(list.file, list.count, &report);
+  for (uint32_t i = 0; i < list.count; i++) {
+    const struct offline_file *f = &list.file[i];
+    printf("%s %s bytes %llu packets %llu rejects size %llu id %llu chksum "
+           "%llu overflow %llu thread %u wall %.2f ms\n",
+           f->ok ? "OK    " : "FAILED", f->path, (unsigned long long)f->size,
+           (unsigned long long)f->stats.packets_out,
+           (unsigned long long)f->stats.rejects[size_mismatch],
+           (unsigned long long)f->stats.rejects[illegal_id],
+           (unsigned long long)f->stats.rejects[chksum_mismatch],
+           (unsigned long long)f->stats.overflow_drops, f->worker,
+           f->wall_ns / 1e6);
+  }
+  printf("Decoded %u files, %u failed, %llu bytes, %llu packets, %llu "
+         "rejects\n",
+         report.files, report.failed, (unsigned long long)report.bytes,
+         (unsigned long long)report.packets,
+         (unsigned long long)report.rejects);
+  printf("Threads %u steals %u wall %.2f ms %.2f MB/s\n",
+         g_decoder_pool.n_threads, report.steals, report.wall_ns / 1e6,
+         report.bytes * 1e3 / report.wall_ns);
+
+  TaskUpLinkShutdown();
+  for (uint32_t i = 0; i < list.count; i++) {
+    free((char *)list.file[i].path);
+    free(list.file[i].out);
+    free(list.file[i].columns);
+  }
+  free(list.file);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,2308 @@
+/** @file uavnav_bench.c
+ * \brief Decoder benchmark application.
+ *  Runs the decoder benchmarks and reports their timings
+*/
+
+#define _GNU_SOURCE
+#include "tsip_capture.h"
+#include "tsip_column.h"
+#include "tsip_frame.h"
+#include "tsip_gen.h"
+#include "tsip_index.h"
+#include "tsip_offline.h"
+#include "tsip_push.h"
+#include "tsip_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+unsigned char *g_test_data = NULL;
+uint32_t g_test_data_len;
+uint32_t g_test_data_start;
+bool g_verbose_output;
+
+/**
+ * \brief Number of decoder ticks timed by the tick overhead benchmark.
+ */
+#define BENCH_TICKS 2000
+/**
+ * \brief Thread counts swept by the thread scaling benchmark.
+ */
+const uint8_t bench_threads[] = {1, 2, 4, 8, 16};
+/**
+ * \brief Number of test data copies decoded by the parallel framing benchmark.
+ */
+#define BENCH_FRAME_COPIES 32
+/**
+ * \brief Input size of the DLE scanning benchmark.
+ */
+#define BENCH_SCAN_SIZE (16 << 20)
+/**
+ * \brief Runs of every DLE search kernel, the fastest one is reported.
+ */
+#define BENCH_SCAN_ROUNDS 7
+/**
+ * \brief Baud rates swept by the serial benchmark, 0 for an unpaced stream.
+ */
+const uint32_t bench_bauds[] = {115200, 460800, 921600, 0};
+/**
+ * \brief Duration of the data streamed by the serial benchmark.
+ */
+#define BENCH_SERIAL_SECONDS 1
+/**
+ * \brief Decoder tick period of the serial benchmark.
+ */
+#define BENCH_SERIAL_TICK_NS 5000000
+/**
+ * \brief Data size streamed through the ring buffer benchmark.
+ */
+#define BENCH_RING_BYTES (256u << 20)
+/**
+ * \brief Ring buffer size of the ring buffer benchmark.
+ */
+#define BENCH_RING_SIZE (64 << 10)
+/**
+ * \brief Number of passes over the test data packets timed by the dispatch
+ * benchmark.
+ */
+#define BENCH_DISPATCH_ROUNDS 100
+/**
+ * \brief Stream counts swept by the stream scaling benchmark.
+ */
+const uint8_t bench_streams[] = {1, 2, 4, 8, 16, 32, 64};
+/**
+ * \brief Number of decoder threads shared by the streams.
+ */
+#define BENCH_STREAM_THREADS 4
+/**
+ * \brief Number of untimed warmup runs of every suite configuration.
+ */
+#define SUITE_WARMUP 3
+/**
+ * \brief Number of timed runs of every suite configuration.
+ */
+#define SUITE_RUNS 21
+/**
+ * \brief Number of runs of every suite configuration with the stage timers.
+ */
+#define SUITE_STAGE_RUNS 5
+/**
+ * \brief Thread counts swept by the benchmark suite.
+ */
+const uint8_t suite_threads[] = {1, 2, 4, 8};
+/**
+ * \brief Corpus sizes swept by the benchmark suite, in test data copies.
+ */
+const uint8_t suite_copies[] = {1, 4, 16};
+/**
+ * \brief Data pushed per call in the push parser benchmark, the whole data
+ * last.
+ */
+const uint32_t bench_push_chunks[] = {16, 64, 512, 2048, 16384, 0};
+/**
+ * \brief COM read sizes of the reassembly benchmark.
+ */
+const uint32_t bench_read_sizes[] = {1, 8, 64, MAX_COM_SIZE};
+/**
+ * \brief Baud rate the raw dumps are converted to captures at.
+ */
+#define BENCH_CAPTURE_BAUD 921600
+/**
+ * \brief Replay speed and duration of the paced capture replay.
+ */
+#define BENCH_CAPTURE_SPEED 20.0
+#define BENCH_CAPTURE_PACED_NS 200000000ull
+/**
+ * \brief Number of files decoded by the batch decoder benchmark.
+ */
+#define BENCH_OFFLINE_FILES 64
+/**
+ * \brief Block sizes compared with the auto-tuner, and the number of bulk
+ * ticks it gets to pick one.
+ */
+const uint32_t bench_tune_blocks[] = {256, 512, 1024, 2048, 4096, 8192, 16384};
+#define BENCH_TUNE_TICKS 64
+/**
+ * \brief Baud rates of the paced auto-tuner runs, and their duration.
+ */
+const uint32_t bench_tune_bauds[] = {115200, 921600, 10000000};
+#define BENCH_TUNE_PACED_NS 500000000ull
+/**
+ * \brief Number of 200 Hz ticks timed per jitter benchmark configuration, and
+ * the data decoded by every tick.
+ */
+#define BENCH_JITTER_TICKS 400
+#define BENCH_JITTER_BYTES 13500
+/**
+ * \brief SCHED_FIFO priority of the real-time jitter benchmark configuration.
+ */
+#define BENCH_JITTER_PRIORITY 50
+/**
+ * \brief Size of the generated traffic decoded per profile.
+ */
+#define BENCH_GEN_SIZE (16 << 20)
+/**
+ * \brief Generated traffic profiles, the clean one first.
+ */
+const struct gen_config bench_gen_profiles[] = {
+    {gen_mixed_ids, 6, 0.05, 0, 0, 0, 0, 1},
+    {gen_sample_ids, 3, 0.05, 0, 0, 0, 0, 2},
+    {gen_mixed_ids, 6, 0.5, 0, 0, 0, 0, 3},
+    {gen_mixed_ids, 6, 1.0, 0, 0, 0, 0, 4},
+    {gen_mixed_ids, 6, 0.05, 0.1, 0.1, 0.1, 64, 5},
+    {gen_mixed_ids, 6, 0.5, 0.3, 0.3, 0.3, 256, 6},
+};
+const char *bench_gen_names[] = {"clean", "sample", "dle-half",
+                                 "dle-all", "errors", "storm"};
+
+/**
+ * \brief Pseudo-terminal stream fed by the serial benchmark writer.
+ */
+struct serial_feed {
+  int master;
+  const uint8_t *data;
+  uint32_t len;
+  uint32_t baud;
+  uint64_t *sent_ns;
+  volatile bool done;
+};
+
+/**
+* \brief Read the monotonic wall clock.
+*
+* \return Wall clock time in nanoseconds.
+*/
+uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+* \brief Compare two timings, for sorting.
+*
+* \param[in] a Pointer to the first timing.
+* \param[in] b Pointer to the second timing.
+* \return 	Comparison result.
+*/
+int bench_cmp(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+* \brief Measure the fixed cost of a decoder tick.
+*
+* Runs the decoder on an empty input, so that the measured time is the thread
+* management overhead of TaskUpLink200Hz() alone.
+*
+* \return
+*/
+void bench_tick_overhead() {
+  g_test_data_len = 0;
+  g_test_data_start = 0;
+  g_verbose_output = false;
+
+  uint64_t start = bench_now_ns();
+  for (uint32_t i = 0; i < BENCH_TICKS; i++) {
+    TaskUpLink200Hz();
+  }
+  uint64_t diff = bench_now_ns() - start;
+  printf("Tick overhead: %u ticks, %.2f us per tick\n", BENCH_TICKS,
+         diff / 1000.0 / BENCH_TICKS);
+}
+
+/**
+* \brief Load a benchmark data file
+*
+* \param[in] fname File name.
+* \return          True if the file was loaded.
+*/
+bool bench_load(const char *fname) {
+  FILE *f = fopen(fname, "rb");
+  if (f == NULL) {
+    printf("File %s not found\n", fname);
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  g_test_data_len = ftell(f);
+  rewind(f);
+  free(g_test_data);
+  g_test_data = (unsigned char *)malloc(g_test_data_len);
+  g_test_data_len = fread(g_test_data, 1, g_test_data_len, f);
+  g_test_data_start = 0;
+  fclose(f);
+  return true;
+}
+
+/**
+* \brief Measure the decoder throughput for several thread counts.
+*
+* Reports the wall time, the process CPU time and the time the threads spent
+* waiting for the read lock and for their blocks to be parsed. The memory
+* source takes no read lock, so the threads only meet in the parse turn.
+*
+* \return
+*/
+void bench_thread_scaling() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  struct tsip_source src;
+  source_mem_init(&src, g_test_data, g_test_data_len);
+  TaskUpLinkSetSource(&src);
+  for (uint8_t i = 0; i < sizeof(bench_threads); i++) {
+    TaskUpLinkSetThreads(bench_threads[i]);
+    // start the threads ahead of the timed tick
+    src.pos = src.len;
+    TaskUpLink200Hz();
+    source_rewind(&src);
+    decoder_stats_reset(&g_decoder);
+
+    clock_t cpu = clock();
+    uint64_t start = bench_now_ns();
+    TaskUpLink200Hz();
+    uint64_t wall = bench_now_ns() - start;
+    cpu = clock() - cpu;
+    struct decoder_stats stats;
+    decoder_stats_snapshot(&g_decoder, &stats);
+
+    printf("Threads: %2u packets %u wall %8.2f ms cpu %8.2f ms %7.2f MB/s "
+           "read wait %8.2f ms parse wait %8.2f ms\n",
+           g_decoder_pool.n_threads, packet_counter, wall / 1e6,
+           cpu * 1000.0 / CLOCKS_PER_SEC, g_test_data_len * 1e3 / wall,
+           stats.read_wait_ns / 1e6, stats.parse_wait_ns / 1e6);
+  }
+  TaskUpLinkSetSource(NULL);
+}
+
+/**
+* \brief Measure the cost of loading and feeding a large capture.
+*
+* Writes several copies of the test data to a temporary file, then loads and
+* decodes it by reading it into memory and feeding it through the COM
+* interface, and by feeding it straight from a memory mapping.
+*
+* \return
+*/
+void bench_sources() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  char fname[] = "/tmp/tsip_bench_XXXXXX";
+  int fd = mkstemp(fname);
+  if (fd < 0)
+    return;
+  FILE *f = fdopen(fd, "wb");
+  for (uint32_t i = 0; i < BENCH_FRAME_COPIES; i++) {
+    fwrite(g_test_data, 1, g_test_data_len, f);
+  }
+  fclose(f);
+  TaskUpLinkSetThreads(1);
+
+  // read the file into memory and copy it through the COM interface
+  uint64_t start = bench_now_ns();
+  bench_load(fname);
+  TaskUpLink200Hz();
+  uint64_t wall = bench_now_ns() - start;
+  printf("Source: %-6s packets %u wall %8.2f ms %7.2f MB/s\n", "com",
+         packet_counter, wall / 1e6, g_test_data_len * 1e3 / wall);
+
+  // decode the file in place
+  struct tsip_source src;
+  start = bench_now_ns();
+  source_mmap_open(&src, fname);
+  TaskUpLinkSetSource(&src);
+  TaskUpLink200Hz();
+  wall = bench_now_ns() - start;
+  printf("Source: %-6s packets %u wall %8.2f ms %7.2f MB/s\n", "mmap",
+         packet_counter, wall / 1e6, src.len * 1e3 / wall);
+  TaskUpLinkSetSource(NULL);
+  source_close(&src);
+  unlink(fname);
+}
+
+/**
+* \brief Serial benchmark writer thread function
+*
+* Writes the data to the pseudo-terminal master in 1 ms slices, paced to the
+* baud rate, and records the time every byte was sent.
+*
+* \param[in] arg Pointer to the stream.
+* \return
+*/
+void *bench_serial_writer(void *arg) {
+  struct serial_feed *feed = (struct serial_feed *)arg;
+  uint32_t slice = feed->baud ? max(feed->baud / 10 / 1000, 1u) : 4096;
+  uint64_t start = bench_now_ns();
+  uint32_t pos = 0;
+  while (pos < feed->len) {
+    if (feed->baud != 0) {
+      // 10 bits per byte on the line
+      uint64_t due = start + (uint64_t)pos * 10 * 1000000000ull / feed->baud;
+      struct timespec ts = {due / 1000000000ull, due % 1000000000ull};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    uint32_t len = min(slice, feed->len - pos);
+    uint64_t now = bench_now_ns();
+    for (uint32_t i = pos; i < pos + len; i++) {
+      feed->sent_ns[i] = now;
+    }
+    ssize_t res = write(feed->master, feed->data + pos, len);
+    if (res < 0)
+      break;
+    pos += res;
+  }
+  feed->done = true;
+  return NULL;
+}
+
+/**
+* \brief Measure the serial source throughput and latency.
+*
+* Streams the data through a pseudo-terminal at the given baud rate, and runs
+* the decoder on the terminal slave at 200 Hz. The latency of a tick is the
+* age of the oldest byte it decoded.
+*
+* \param[in] fname 	Data file name.
+* \param[in] baud 	Baud rate, 0 to stream as fast as possible.
+* \return
+*/
+void bench_serial(const char *fname, uint32_t baud) {
+  if (!bench_load(fname))
+    return;
+  g_verbose_output = false;
+  struct serial_feed feed;
+  feed.data = g_test_data;
+  feed.len = g_test_data_len;
+  if (baud != 0)
+    feed.len = min(feed.len, baud / 10 * BENCH_SERIAL_SECONDS);
+  feed.baud = baud;
+  feed.done = false;
+  feed.sent_ns = (uint64_t *)malloc(feed.len * sizeof(uint64_t));
+  feed.master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (feed.master < 0 || grantpt(feed.master) != 0 ||
+      unlockpt(feed.master) != 0) {
+    printf("Pseudo-terminal not available\n");
+    free(feed.sent_ns);
+    return;
+  }
+  struct tsip_source src;
+  if (!source_serial_open(&src, ptsname(feed.master), baud ? baud : 921600,
+                          MAX_COM_SIZE, 0)) {
+    printf("Serial port setup failed\n");
+    close(feed.master);
+    free(feed.sent_ns);
+    return;
+  }
+  TaskUpLinkSetThreads(1);
+  TaskUpLinkSetSource(&src);
+
+  pthread_t writer;
+  uint64_t start = bench_now_ns();
+  pthread_create(&writer, NULL, bench_serial_writer, &feed);
+  uint64_t tick = start;
+  uint64_t latency_sum = 0, latency_max = 0, busy_max = 0;
+  uint32_t packets = 0, n_ticks = 0, idle = 0;
+  // keep ticking until the stream is drained
+  while (idle < 2) {
+    tick += BENCH_SERIAL_TICK_NS;
+    struct timespec ts = {tick / 1000000000ull, tick % 1000000000ull};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    bool done = feed.done;
+    uint64_t pos = src.pos;
+    uint64_t t0 = bench_now_ns();
+    TaskUpLink200Hz();
+    uint64_t t1 = bench_now_ns();
+    packets += packet_counter;
+    busy_max = max(busy_max, t1 - t0);
+    if (src.pos == pos) {
+      idle = done ? idle + 1 : 0;
+      continue;
+    }
+    uint64_t latency = t1 - feed.sent_ns[pos];
+    latency_sum += latency;
+    latency_max = max(latency_max, latency);
+    n_ticks++;
+  }
+  uint64_t wall = bench_now_ns() - start;
+  pthread_join(writer, NULL);
+
+  printf("Serial baud: %6u bytes %7u/%7u packets %6u %7.2f MB/s latency "
+         "mean %6.2f ms max %6.2f ms tick max %6.2f ms\n",
+         baud, (uint32_t)src.pos, feed.len, packets, src.pos * 1e3 / wall,
+         n_ticks ? latency_sum / 1e6 / n_ticks : 0.0, latency_max / 1e6,
+         busy_max / 1e6);
+  TaskUpLinkSetSource(NULL);
+  source_close(&src);
+  close(feed.master);
+  free(feed.sent_ns);
+}
+
+/**
+ * \brief Valid packet of a serial benchmark stream.
+ */
+struct latency_packet {
+  uint32_t end;
+  uint16_t len;
+  uint8_t id1;
+  uint8_t id2;
+};
+
+/**
+ * \brief Packet latency recorder of the latency benchmark.
+ */
+struct latency_probe {
+  const uint64_t *sent_ns;
+  struct latency_packet *packet;
+  uint32_t n_packets;
+  uint32_t next;
+  uint64_t *latency;
+  uint32_t count;
+};
+
+/**
+* \brief Locate the valid packets of a stream.
+*
+* Frames the raw data on its own and records the offset of the ETX of every
+* packet with a valid checksum, which is when the packet has fully arrived.
+*
+* \param[in] data 	Pointer to the raw data.
+* \param[in] len 	Size of the raw data.
+* \param[out] packet 	Pointer to the packets, at least len / 8 of them.
+* \return 			Number of packets.
+*/
+uint32_t bench_latency_packets(const uint8_t *data, uint32_t len,
+                               struct latency_packet *packet) {
+  uint8_t buf[MAX_DATA_SIZE + 6];
+  uint32_t n = 0, count = 0;
+  bool in_packet = false;
+  for (uint32_t i = 0; i < len; i++) {
+    uint8_t c = data[i];
+    if (c == DLE && i + 1 < len) {
+      c = data[++i];
+      if (c == ETX) {
+        if (in_packet && n >= 6 &&
+            crc32(buf, 0, n - 4) == arr_to_int(buf + n - 4, 4)) {
+          packet[count].end = i;
+          packet[count].len = n - 6;
+          packet[count].id1 = buf[0];
+          packet[count].id2 = buf[1];
+          count++;
+        }
+        in_packet = false;
+        continue;
+      }
+      if (c != DLE) {
+        in_packet = true;
+        n = 0;
+      }
+    }
+    if (in_packet && n == sizeof(buf))
+      in_packet = false;
+    if (in_packet)
+      buf[n++] = c;
+  }
+  return count;
+}
+
+/**
+* \brief Latency benchmark packet handler
+*
+* Matches the packet to the next valid packet of the stream with the same IDs
+* and size, skipping the lost ones, and records the time since its ETX was
+* sent.
+*
+* \param[in] pkt 	Pointer to the packet.
+* \param[in] user 	Pointer to the latency probe.
+* \return
+*/
+void bench_latency_handler(const struct tsip_packet *pkt, void *user) {
+  uint64_t now = bench_now_ns();
+  struct latency_probe *probe = (struct latency_probe *)user;
+  while (probe->next < probe->n_packets) {
+    const struct latency_packet *p = &probe->packet[probe->next++];
+    if (p->id1 == pkt->id1 && p->id2 == pkt->id2 && p->len == pkt->len) {
+      probe->latency[probe->count++] = now - probe->sent_ns[p->end];
+      break;
+    }
+  }
+}
+
+/**
+* \brief Measure the packet latency in the block and low latency modes.
+*
+* Streams the data through a pseudo-terminal at the given baud rate, with the
+* decoder running continuously on the terminal slave and waiting on the port
+* once it's drained. Reports the time from the arrival of the last byte of a
+* packet to the packet handler call.
+*
+* \param[in] fname 	Data file name.
+* \param[in] baud 	Baud rate.
+* \return
+*/
+void bench_latency(const char *fname, uint32_t baud) {
+  if (!bench_load(fname))
+    return;
+  g_verbose_output = false;
+  struct serial_feed feed;
+  feed.data = g_test_data;
+  feed.len = min(g_test_data_len, baud / 10 * BENCH_SERIAL_SECONDS);
+  feed.baud = baud;
+  feed.sent_ns = (uint64_t *)malloc(feed.len * sizeof(uint64_t));
+  struct latency_probe probe;
+  probe.sent_ns = feed.sent_ns;
+  probe.packet = (struct latency_packet *)malloc(
+      (feed.len / 8 + 1) * sizeof(struct latency_packet));
+  probe.n_packets = bench_latency_packets(feed.data, feed.len, probe.packet);
+  probe.latency = (uint64_t *)malloc((probe.n_packets + 1) * sizeof(uint64_t));
+  tsip_dispatch_reset();
+  tsip_register_raw(bench_latency_handler, &probe);
+  TaskUpLinkSetThreads(1);
+  const char *name[] = {"block", "low"};
+  for (uint8_t mode = 0; mode < 2; mode++) {
+    feed.done = false;
+    feed.master = posix_openpt(O_RDWR | O_NOCTTY);
+    struct tsip_source src;
+    if (feed.master < 0 || grantpt(feed.master) != 0 ||
+        unlockpt(feed.master) != 0 ||
+        !source_serial_open(&src, ptsname(feed.master), baud, MAX_COM_SIZE,
+                            BENCH_SERIAL_TICK_NS / 1000000)) {
+      printf("Pseudo-terminal not available\n");
+      if (feed.master >= 0)
+        close(feed.master);
+      break;
+    }
+    TaskUpLinkSetSource(&src);
+    TaskUpLinkSetLowLatency(mode == 1);
+    probe.next = 0;
+    probe.count = 0;
+    pthread_t writer;
+    pthread_create(&writer, NULL, bench_serial_writer, &feed);
+    // a tick only returns once the port has been quiet for the timeout
+    uint32_t idle = 0;
+    while (idle < 2) {
+      bool done = feed.done;
+      uint64_t pos = src.pos;
+      TaskUpLink200Hz();
+      idle = (done && src.pos == pos) ? idle + 1 : 0;
+    }
+    pthread_join(writer, NULL);
+
+    qsort(probe.latency, probe.count, sizeof(uint64_t), bench_cmp);
+    uint32_t n = probe.count;
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      sum += probe.latency[i];
+    }
+    printf("Latency: %-5s baud %6u packets %5u/%5u mean %7.3f ms p50 %7.3f "
+           "ms p99 %7.3f ms max %7.3f ms\n",
+           name[mode], baud, n, probe.n_packets,
+           n ? sum / 1e6 / n : 0.0,
+           n ? probe.latency[n / 2] / 1e6 : 0.0,
+           n ? probe.latency[(n * 99 + 99) / 100 - 1] / 1e6 : 0.0,
+           n ? probe.latency[n - 1] / 1e6 : 0.0);
+    TaskUpLinkSetSource(NULL);
+    source_close(&src);
+    close(feed.master);
+  }
+  TaskUpLinkSetLowLatency(false);
+  tsip_dispatch_reset();
+  free(probe.latency);
+  free(probe.packet);
+  free(feed.sent_ns);
+}
+
+/**
+* \brief Ring buffer benchmark producer thread function
+*
+* Writes BENCH_RING_BYTES of a counting pattern, waiting whenever the ring is
+* full.
+*
+* \param[in] arg Pointer to the ring buffer.
+* \return
+*/
+void *bench_ring_producer(void *arg) {
+  struct spsc_ring *ring = (struct spsc_ring *)arg;
+  uint8_t block[BLOCK_SIZE];
+  for (uint32_t i = 0; i < BLOCK_SIZE; i++) {
+    block[i] = i;
+  }
+  uint64_t sent = 0;
+  while (sent < BENCH_RING_BYTES) {
+    uint32_t len = ring_write(ring, block + sent % 256, BLOCK_SIZE - 256);
+    if (len == 0)
+      sched_yield();
+    sent += len;
+  }
+  return NULL;
+}
+
+/**
+* \brief Check the ring buffer and measure its throughput.
+*
+* Checks the ring capacity, the rejection of a capacity over 2^31, the
+* wrap-around and both overflow policies, then measures the sustained
+* throughput between two threads and the decoder throughput with the data read
+* by a ring reader thread.
+*
+* \return
+*/
+void bench_ring() {
+  struct spsc_ring ring;
+  uint8_t in[3000], out[3000];
+  for (uint32_t i = 0; i < sizeof(in); i++) {
+    in[i] = i * 7;
+  }
+  // capacity and wrap-around
+  ring_init(&ring, 1000);
+  bool ok = ring.size == 1024;
+  ok = ok && ring_write(&ring, in, 2000) == 1024 && ring_used(&ring) == 1024;
+  ok = ok && ring_read(&ring, out, 100) == 100 && memcmp(in, out, 100) == 0;
+  ok = ok && ring_write(&ring, in + 1024, 200) == 100;
+  ok = ok && ring_read(&ring, out + 100, 3000) == 1024;
+  ok = ok && memcmp(in, out, 1124) == 0 && ring_used(&ring) == 0;
+  ok = ok && ring_read(&ring, out, 10) == 0;
+  // no power of two to round up to
+  struct spsc_ring huge;
+  bool rejected = !ring_init(&huge, (1u << 31) + 1);
+  ring_free(&huge);
+  ok = ok && rejected;
+  printf("Ring capacity and wrap-around: %s\n", ok ? "ok" : "FAILED");
+
+  // overflow with no consumer, dropping keeps the oldest data
+  struct tsip_source src;
+  struct ring_reader reader;
+  source_mem_init(&src, in, sizeof(in));
+  ring_reader_start(&reader, &src, &ring, ring_drop, true);
+  // the reader stops by itself once the source is drained
+  while (!ring_reader_done(&reader)) {
+    sched_yield();
+  }
+  ring_reader_stop(&reader);
+  ok = reader.received == sizeof(in) && reader.dropped == sizeof(in) - 1024;
+  ok = ok && ring_read(&ring, out, 3000) == 1024 && memcmp(in, out, 1024) == 0;
+  printf("Ring overflow drop: %s, %u dropped\n", ok ? "ok" : "FAILED",
+         (uint32_t)reader.dropped);
+  // blocking waits for the consumer and loses nothing
+  source_mem_init(&src, in, sizeof(in));
+  ring_reader_start(&reader, &src, &ring, ring_block, true);
+  uint32_t len = 0;
+  while (!ring_reader_done(&reader) || ring_used(&ring) > 0) {
+    len += ring_read(&ring, out + len, sizeof(out) - len);
+  }
+  ring_reader_stop(&reader);
+  ok = reader.dropped == 0 && len == sizeof(in) &&
+       memcmp(in, out, sizeof(in)) == 0;
+  printf("Ring overflow block: %s\n", ok ? "ok" : "FAILED");
+  ring_free(&ring);
+
+  // sustained throughput between a producer and a consumer thread
+  ring_init(&ring, BENCH_RING_SIZE);
+  pthread_t producer;
+  uint64_t start = bench_now_ns();
+  pthread_create(&producer, NULL, bench_ring_producer, &ring);
+  uint64_t received = 0;
+  uint8_t block[BLOCK_SIZE];
+  ok = true;
+  while (received < BENCH_RING_BYTES) {
+    len = ring_read(&ring, block, BLOCK_SIZE);
+    if (len == 0)
+      sched_yield();
+    for (uint32_t i = 0; i < len; i += 64) {
+      ok = ok && block[i] == (uint8_t)(received + i);
+    }
+    received += len;
+  }
+  uint64_t wall = bench_now_ns() - start;
+  pthread_join(producer, NULL);
+  printf("Ring throughput: %u MB %7.2f MB/s data %s\n", BENCH_RING_BYTES >> 20,
+         BENCH_RING_BYTES * 1e3 / wall, ok ? "ok" : "FAILED");
+  ring_free(&ring);
+
+  // decoder fed by a ring reader thread
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  struct tsip_source ring_src;
+  ring_init(&ring, BENCH_RING_SIZE);
+  source_mem_init(&src, g_test_data, g_test_data_len);
+  source_ring_init(&ring_src, &ring);
+  TaskUpLinkSetThreads(1);
+  TaskUpLinkSetSource(&ring_src);
+  uint32_t packets = 0;
+  start = bench_now_ns();
+  ring_reader_start(&reader, &src, &ring, ring_block, true);
+  while (!ring_reader_done(&reader) || ring_used(&ring) > 0) {
+    TaskUpLink200Hz();
+    packets += packet_counter;
+  }
+  wall = bench_now_ns() - start;
+  ring_reader_stop(&reader);
+  printf("Ring decoder: packets %u wall %8.2f ms %7.2f MB/s\n", packets,
+         wall / 1e6, ring_src.pos * 1e3 / wall);
+  TaskUpLinkSetSource(NULL);
+  ring_free(&ring);
+}
+
+/**
+* \brief Dispatch benchmark packet handler
+*
+* Counts the packets by type and folds a field into a checksum, so that the
+* decoded fields are used.
+*
+* \param[in] pkt 	Pointer to the packet.
+* \param[in] user 	Pointer to the counters.
+* \return
+*/
+void bench_dispatch_handler(const struct tsip_packet *pkt, void *user) {
+  uint64_t *count = (uint64_t *)user;
+  count[pkt->type]++;
+  switch (pkt->type) {
+  case tsip_a509:
+    count[4] += pkt->msg.a509.u16[6];
+    break;
+  case tsip_a50a:
+    count[4] += pkt->msg.a50a.u16[6];
+    break;
+  case tsip_3902:
+    count[4] += (uint64_t)pkt->msg.m3902.f64[0];
+    break;
+  default:
+    count[4] += pkt->len;
+  }
+}
+
+/**
+* \brief Measure the typed packet dispatch cost.
+*
+* Frames the test data packets into memory, then dispatches them repeatedly,
+* once with the decoders of the sample packet types registered and once with
+* every packet passed on raw. Checks that a handler registered with no decoder
+* gets its packets raw, and that the built-in decoders run for the packets
+* passed on to the raw handler and are kept by tsip_set_handler().
+*
+* \return
+*/
+void bench_dispatch() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  struct frame_state st;
+  st.out = (uint8_t *)malloc(g_test_data_len);
+  st.packet_size = g_test_data_len / 4;
+  st.packet = (struct frame_packet *)malloc(st.packet_size *
+                                            sizeof(struct frame_packet));
+  frame_reset(&st);
+  frame_feed(&st, g_test_data, g_test_data_len, 0);
+
+  const char *name[] = {"typed", "raw"};
+  uint64_t typed_a509 = 0;
+  for (uint8_t k = 0; k < 2; k++) {
+    uint64_t count[5] = {0};
+    tsip_dispatch_reset();
+    if (k == 0) {
+      tsip_register(0xA5, 0x09, tsip_decode_a509, bench_dispatch_handler,
+                    count);
+      tsip_register(0xA5, 0x0A, tsip_decode_a50a, bench_dispatch_handler,
+                    count);
+      tsip_register(0x39, 0x02, tsip_decode_3902, bench_dispatch_handler,
+                    count);
+    }
+    tsip_register_raw(bench_dispatch_handler, count);
+    uint64_t start = bench_now_ns();
+    for (uint32_t r = 0; r < BENCH_DISPATCH_ROUNDS; r++) {
+      for (uint32_t i = 0; i < st.packet_count; i++) {
+        tsip_dispatch(st.out + st.packet[i].offset, st.packet[i].len - 4);
+      }
+    }
+    uint64_t wall = bench_now_ns() - start;
+    uint64_t n = (uint64_t)st.packet_count * BENCH_DISPATCH_ROUNDS;
+    printf("Dispatch: %-5s %6.2f ns/packet a509 %llu a50a %llu 3902 %llu raw "
+           "%llu\n",
+           name[k], (double)wall / n,
+           (unsigned long long)count[tsip_a509] / BENCH_DISPATCH_ROUNDS,
+           (unsigned long long)count[tsip_a50a] / BENCH_DISPATCH_ROUNDS,
+           (unsigned long long)count[tsip_3902] / BENCH_DISPATCH_ROUNDS,
+           (unsigned long long)count[tsip_raw] / BENCH_DISPATCH_ROUNDS);
+    if (k == 0)
+      typed_a509 = count[tsip_a509] / BENCH_DISPATCH_ROUNDS;
+  }
+
+  // a handler registered with no decoder gets its packets raw
+  uint64_t count[5] = {0};
+  tsip_dispatch_reset();
+  tsip_register(0xA5, 0x09, NULL, bench_dispatch_handler, count);
+  for (uint32_t i = 0; i < st.packet_count; i++) {
+    tsip_dispatch(st.out + st.packet[i].offset, st.packet[i].len - 4);
+  }
+  printf("Dispatch: no decoder a509 raw %llu of %llu %s\n",
+         (unsigned long long)count[tsip_raw], (unsigned long long)typed_a509,
+         count[tsip_raw] == typed_a509 && typed_a509 != 0 ? "ok" : "FAILED");
+
+  // the built-in decoders still decode the packets passed on to the raw
+  // handler, and a handler set later keeps them
+  uint64_t builtin[5] = {0};
+  uint64_t set[5] = {0};
+  tsip_dispatch_reset();
+  tsip_register_builtin();
+  tsip_register_raw(bench_dispatch_handler, builtin);
+  for (uint32_t i = 0; i < st.packet_count; i++) {
+    tsip_dispatch(st.out + st.packet[i].offset, st.packet[i].len - 4);
+  }
+  tsip_set_handler(0xA5, 0x09, bench_dispatch_handler, set);
+  for (uint32_t i = 0; i < st.packet_count; i++) {
+    tsip_dispatch(st.out + st.packet[i].offset, st.packet[i].len - 4);
+  }
+  printf("Dispatch: built-in a509 typed %llu set handler typed %llu of %llu "
+         "%s\n",
+         (unsigned long long)builtin[tsip_a509],
+         (unsigned long long)set[tsip_a509], (unsigned long long)typed_a509,
+         builtin[tsip_a509] == typed_a509 && set[tsip_a509] == typed_a509 &&
+                 typed_a509 != 0
+             ? "ok"
+             : "FAILED");
+  tsip_dispatch_reset();
+  free(st.out);
+  free(st.packet);
+}
+
+/**
+* \brief Batch benchmark packet consumer
+*
+* Stands in for a slow downstream consumer, running a few CRC passes over the
+* packet.
+*
+* \param[in] pkt 	Pointer to the packet.
+* \param[in] user 	Pointer to the consumer checksum.
+* \return
+*/
+void bench_batch_consumer(const struct tsip_packet *pkt, void *user) {
+  uint32_t *sum = (uint32_t *)user;
+  for (uint8_t i = 0; i < 8; i++) {
+    *sum = crc32_update(*sum, pkt->payload, pkt->len);
+  }
+}
+
+/**
+* \brief Batch flush handler counting the flushes.
+*
+* \param[in] batch 	Pointer to the batch.
+* \param[in] user 	Pointer to the flush count.
+* \return
+*/
+void bench_batch_flush(const struct packet_batch *batch, void *user) {
+  (void)batch;
+  (*(uint32_t *)user)++;
+}
+
+/**
+* \brief Measure the batch output mode with a slow consumer.
+*
+* Decodes the test data passing every packet to the consumer from within the
+* parse turn, then in the batch mode with the consumer run over the batch
+* after the tick. Reports the decoder tick time, during which the parse turn
+* is held, and the total time. Checks that the arenas too small for a valid
+* packet are rejected, and that a packet too large for the arena is dropped.
+*
+* \return
+*/
+void bench_batch() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  struct tsip_source src;
+  source_mem_init(&src, g_test_data, g_test_data_len);
+  TaskUpLinkSetSource(&src);
+  TaskUpLinkSetThreads(1);
+  tsip_dispatch_reset();
+  const char *name[] = {"parse", "batch"};
+  for (uint8_t k = 0; k < 2; k++) {
+    uint32_t sum = 0;
+    if (k == 0)
+      tsip_register_raw(bench_batch_consumer, &sum);
+    else
+      TaskUpLinkSetBatch(2 * g_test_data_len, g_test_data_len / 8, NULL, NULL);
+    source_rewind(&src);
+    uint64_t start = bench_now_ns();
+    TaskUpLink200Hz();
+    uint64_t tick = bench_now_ns() - start;
+    const struct packet_batch *batch = TaskUpLinkBatch();
+    for (uint32_t i = 0; i < batch->count; i++) {
+      struct tsip_packet pkt;
+      pkt.len = batch->view[i].len - 2;
+      pkt.payload = batch_packet(batch, i) + 2;
+      bench_batch_consumer(&pkt, &sum);
+    }
+    uint64_t wall = bench_now_ns() - start;
+    printf("Batch mode: %s packets %u tick %8.2f ms total %8.2f ms overflow "
+           "%u checksum %08x\n",
+           name[k], packet_counter, tick / 1e6, wall / 1e6, batch->overflow,
+           sum);
+    tsip_dispatch_reset();
+  }
+  TaskUpLinkSetBatch(0, 0, NULL, NULL);
+  TaskUpLinkSetSource(NULL);
+
+  bool ok = !TaskUpLinkSetBatch(64, 16, NULL, NULL) &&
+            !TaskUpLinkSetBatch(MAX_DATA_SIZE + 2, 0, NULL, NULL);
+  struct packet_batch small;
+  uint32_t flushes = 0;
+  uint8_t packet[MAX_DATA_SIZE + 2] = {0x8f, 0xa5};
+  ok = ok && batch_init(&small, 64, 4);
+  if (small.data != NULL) {
+    small.flush = bench_batch_flush;
+    small.user = &flushes;
+    ok = ok && batch_append(&small, packet, 32, none) &&
+         !batch_append(&small, packet, sizeof(packet), none) &&
+         small.overflow == 1 && flushes == 1;
+    batch_free(&small);
+  }
+  printf("Batch mode: arena size checks %s\n", ok ? "ok" : "FAILED");
+}
+
+/**
+* \brief Measure the aggregate throughput of several streams.
+*
+* Decodes the test data on several streams at once, each with its own decoder
+* context and input source, sharing the decoder threads.
+*
+* \return
+*/
+void bench_stream_scaling() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  uint8_t n_max = bench_streams[sizeof(bench_streams) - 1];
+  struct decoder_ctx *ctx =
+      (struct decoder_ctx *)malloc(n_max * sizeof(struct decoder_ctx));
+  struct decoder_ctx **dec =
+      (struct decoder_ctx **)malloc(n_max * sizeof(struct decoder_ctx *));
+  struct tsip_source *src =
+      (struct tsip_source *)malloc(n_max * sizeof(struct tsip_source));
+  for (uint8_t i = 0; i < n_max; i++) {
+    source_mem_init(&src[i], g_test_data, g_test_data_len);
+    decoder_init(&ctx[i], &src[i]);
+    dec[i] = &ctx[i];
+  }
+  TaskUpLinkSetThreads(BENCH_STREAM_THREADS);
+  for (uint8_t k = 0; k < sizeof(bench_streams); k++) {
+    uint8_t n = bench_streams[k];
+    for (uint8_t i = 0; i < n; i++) {
+      source_rewind(&src[i]);
+    }
+    uint64_t start = bench_now_ns();
+    TaskUpLinkStreams(dec, n);
+    uint64_t wall = bench_now_ns() - start;
+    uint32_t packets = 0;
+    bool same = true;
+    for (uint8_t i = 0; i < n; i++) {
+      packets += ctx[i].packet_counter;
+      same = same && ctx[i].packet_counter == ctx[0].packet_counter;
+    }
+    printf("Streams: %2u threads %u packets %7u wall %8.2f ms %7.2f MB/s "
+           "per stream %s\n",
+           n, g_decoder_pool.n_threads, packets, wall / 1e6,
+           (double)n * g_test_data_len * 1e3 / wall,
+           same ? "identical" : "MISMATCH");
+  }
+  for (uint8_t i = 0; i < n_max; i++) {
+    decoder_free(&ctx[i]);
+  }
+  free(ctx);
+  free(dec);
+  free(src);
+}
+
+/**
+* \brief Run the decoder benchmark suite.
+*
+* Decodes corpora of several sizes with several thread counts. Every
+* configuration gets warmup runs, then timed runs reporting the median and
+* 99th percentile wall time, and finally runs with the stage timers on, which
+* report the mean time spent reading, decoding, validating and parsing, summed
+* over the threads. The stage timers are kept off during the timed runs. The
+* results are also written to a file as JSON lines, one per configuration.
+*
+* \param[in] fname JSON output file name, NULL for none.
+* \return
+*/
+void bench_suite(const char *fname) {
+  struct block_tuning tuning;
+  TaskUpLinkTuning(&tuning);
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  FILE *json = NULL;
+  if (fname != NULL && (json = fopen(fname, "a")) == NULL) {
+    printf("File %s could not be opened\n", fname);
+    return;
+  }
+  uint8_t max_copies = suite_copies[sizeof(suite_copies) - 1];
+  uint64_t max_len = (uint64_t)g_test_data_len * max_copies;
+  uint8_t *buf = (uint8_t *)malloc(max_len);
+  for (uint32_t i = 0; i < max_copies; i++) {
+    memcpy(buf + (uint64_t)i * g_test_data_len, g_test_data, g_test_data_len);
+  }
+  const char *stage_name[] = {"read", "decode", "validate", "parse"};
+  struct tsip_source src;
+  uint64_t wall[SUITE_RUNS];
+  for (uint8_t c = 0; c < sizeof(suite_copies); c++) {
+    uint64_t len = (uint64_t)g_test_data_len * suite_copies[c];
+    source_mem_init(&src, buf, len);
+    TaskUpLinkSetSource(&src);
+    for (uint8_t t = 0; t < sizeof(suite_threads); t++) {
+      TaskUpLinkSetThreads(suite_threads[t]);
+      for (uint32_t r = 0; r < SUITE_WARMUP + SUITE_RUNS; r++) {
+        source_rewind(&src);
+        uint64_t start = bench_now_ns();
+        TaskUpLink200Hz();
+        if (r >= SUITE_WARMUP)
+          wall[r - SUITE_WARMUP] = bench_now_ns() - start;
+      }
+      qsort(wall, SUITE_RUNS, sizeof(wall[0]), bench_cmp);
+      double median = wall[SUITE_RUNS / 2] / 1e6;
+      double p99 = wall[(SUITE_RUNS * 99 + 99) / 100 - 1] / 1e6;
+      uint32_t packets = packet_counter;
+
+      g_decoder.stage_timing = true;
+      stage_reset(&g_decoder);
+      for (uint32_t r = 0; r < SUITE_STAGE_RUNS; r++) {
+        source_rewind(&src);
+        TaskUpLink200Hz();
+      }
+      g_decoder.stage_timing = false;
+      double stage[stage_count];
+      for (uint8_t k = 0; k < stage_count; k++) {
+        stage[k] = g_decoder.stage_ns[k] / 1e6 / SUITE_STAGE_RUNS;
+      }
+
+      printf("Suite: block %u threads %u corpus %6.2f MB median %8.2f ms p99 "
+             "%8.2f ms %7.2f MB/s %6.2f Mpackets/s stages ms",
+             tuning.block_size, g_decoder_pool.n_threads, len / 1e6, median,
+             p99,
+             len / 1e3 / median, packets / 1e3 / median);
+      for (uint8_t k = 0; k < stage_count; k++) {
+        printf(" %s %.2f", stage_name[k], stage[k]);
+      }
+      printf("\n");
+      if (json != NULL) {
+        fprintf(json,
+                "{\"bench\":\"decode\",\"block_size\":%u,\"threads\":%u,"
+                "\"corpus_bytes\":%llu,\"runs\":%u,\"packets\":%u,"
+                "\"median_ms\":%.4f,\"p99_ms\":%.4f,\"mb_s\":%.2f,"
+                "\"packets_s\":%.0f,\"stage_ms\":{",
+                tuning.block_size, g_decoder_pool.n_threads,
+                (unsigned long long)len,
+                SUITE_RUNS, packets, median, p99, len / 1e3 / median,
+                packets * 1e3 / median);
+        for (uint8_t k = 0; k < stage_count; k++) {
+          fprintf(json, "%s\"%s\":%.4f", k ? "," : "", stage_name[k], stage[k]);
+        }
+        fprintf(json, "}}\n");
+      }
+    }
+  }
+  TaskUpLinkSetSource(NULL);
+  if (json != NULL)
+    fclose(json);
+  free(buf);
+}
+
+/**
+* \brief Measure the parallel buffer decoder throughput.
+*
+* Decodes several back to back copies of the test data with
+* frame_buffer_parallel() for several thread counts.
+*
+* \return
+*/
+void bench_parallel_framing() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  uint64_t len = (uint64_t)g_test_data_len * BENCH_FRAME_COPIES;
+  uint8_t *buf = (uint8_t *)malloc(len);
+  for (uint32_t i = 0; i < BENCH_FRAME_COPIES; i++) {
+    memcpy(buf + (uint64_t)i * g_test_data_len, g_test_data, g_test_data_len);
+  }
+  for (uint8_t i = 0; i < sizeof(bench_threads); i++) {
+    TaskUpLinkSetThreads(bench_threads[i]);
+    uint64_t start = bench_now_ns();
+    uint32_t packets = frame_buffer_parallel(buf, len, 0);
+    uint64_t wall = bench_now_ns() - start;
+    printf("Parallel framing threads: %2u packets %u wall %8.2f ms %7.2f "
+           "MB/s\n",
+           g_decoder_pool.n_threads, packets, wall / 1e6, len * 1e3 / wall);
+  }
+  free(buf);
+}
+
+/**
+* \brief Decode a buffer block by block with a given DLE search kernel.
+*
+* \param[in] buf 	Pointer to the raw data.
+* \param[in] len 	Size of the raw data.
+* \param[in] scan 	DLE search kernel.
+* \param[out] hash 	Hash of the decoded data and flags.
+* \return 			Decoding wall time in nanoseconds.
+*/
+uint64_t bench_decode_blocks(uint8_t *buf, uint32_t len, dle_scan_fn scan,
+                             uint32_t *hash) {
+  static uint8_t processed[BLOCK_SIZE];
+  static uint32_t flag[BLOCK_SIZE];
+  static uint8_t flag_type[BLOCK_SIZE];
+  static uint32_t flag_crc[BLOCK_SIZE];
+  uint32_t processed_len, flag_count, raw_len, tail_crc;
+  bool hanging_dle;
+  dle_scan_fn saved = g_dle_scan;
+  g_dle_scan = scan;
+  *hash = 0;
+  uint64_t diff = 0;
+  for (uint32_t pos = 0; pos < len; pos += BLOCK_SIZE) {
+    raw_len = min((uint32_t)BLOCK_SIZE, len - pos);
+    uint64_t start = bench_now_ns();
+    packet_decode(processed, &processed_len, buf + pos, &raw_len, flag,
+                  flag_type, flag_crc, &flag_count, &hanging_dle, &tail_crc);
+    diff += bench_now_ns() - start;
+    *hash = *hash * 31 + crc32(processed, 0, processed_len);
+    *hash = *hash * 31 + crc32((uint8_t *)flag, 0, flag_count * 4);
+    *hash = *hash * 31 + crc32(flag_type, 0, flag_count) + hanging_dle;
+  }
+  g_dle_scan = saved;
+  return diff;
+}
+
+/**
+* \brief Measure the DLE scanning and escape removal throughput.
+*
+* Runs packet_decode() with every DLE search kernel on an input with almost no
+* DLE characters, on the test data and on a DLE-heavy input, and checks that
+* all the kernels produce the same output. Each kernel reports its fastest of
+* BENCH_SCAN_ROUNDS runs.
+*
+* \return
+*/
+void bench_dle_scan() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  const char *input_name[] = {"low", "typical", "heavy"};
+  const char *scan_name[] = {"scalar", "sse2", "avx2"};
+  dle_scan_fn scan[] = {dle_scan_scalar, dle_scan_scalar, dle_scan_scalar};
+  uint8_t n_scan = 1;
+#if SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    scan[n_scan++] = dle_scan_sse2;
+  if (__builtin_cpu_supports("avx2"))
+    scan[n_scan++] = dle_scan_avx2;
+#endif
+  uint8_t *buf = (uint8_t *)malloc(BENCH_SCAN_SIZE);
+  srand(1);
+  for (uint8_t input = 0; input < 3; input++) {
+    for (uint32_t i = 0; i < BENCH_SCAN_SIZE; i++) {
+      if (input == 0) {
+        buf[i] = rand() & 0xFF;
+        if (buf[i] == DLE)
+          buf[i]++;
+      } else if (input == 1) {
+        buf[i] = g_test_data[i % g_test_data_len];
+      } else {
+        buf[i] = (rand() % 4 == 0) ? DLE : rand() & 0xFF;
+      }
+    }
+    // the kernels take turns so a slow spell of the machine hits them all
+    uint64_t best[3] = {UINT64_MAX, UINT64_MAX, UINT64_MAX};
+    uint32_t hash[3];
+    for (uint8_t round = 0; round < BENCH_SCAN_ROUNDS; round++) {
+      for (uint8_t k = 0; k < n_scan; k++) {
+        best[k] = min(best[k], bench_decode_blocks(buf, BENCH_SCAN_SIZE,
+                                                   scan[k], &hash[k]));
+      }
+    }
+    for (uint8_t k = 0; k < n_scan; k++) {
+      printf("DLE scan input: %-8s kernel: %-6s %6.2f GB/s output %s\n",
+             input_name[input], scan_name[k],
+             (double)BENCH_SCAN_SIZE / best[k],
+             hash[k] == hash[0] ? "identical" : "MISMATCH");
+    }
+  }
+  free(buf);
+}
+
+/**
+* \brief Measure the CRC throughput for the TSIP packet sizes.
+*
+* Runs every CRC update function over packet sized buffers, from the smallest
+* to the largest valid packet, and checks the results against the byte-wise
+* table lookup.
+*
+* \return
+*/
+void bench_crc() {
+  const uint32_t sizes[] = {6, 16, 32, 64, 128, MAX_DATA_SIZE + 6};
+  const char *name[] = {"table", "slice8", "pclmul"};
+  crc32_update_fn update[] = {crc32_update_table, crc32_update_slice8,
+                              crc32_update_slice8};
+  uint8_t n_update = 2;
+  crc32_slice_init();
+#if CRC_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+    update[n_update++] = crc32_update_pclmul;
+#endif
+  // packets laid out back to back in a buffer larger than the cache
+  const uint32_t buf_len = 8 << 20;
+  uint8_t *buf = (uint8_t *)malloc(buf_len);
+  srand(2);
+  for (uint32_t i = 0; i < buf_len; i++) {
+    buf[i] = rand() & 0xFF;
+  }
+  for (uint8_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    uint32_t n_packets = buf_len / sizes[s];
+    uint32_t ref = 0;
+    for (uint8_t k = 0; k < n_update; k++) {
+      uint32_t acc = 0;
+      uint64_t start = bench_now_ns();
+      for (uint32_t p = 0; p < n_packets; p++) {
+        acc ^= update[k](0xFFFFFFFF, buf + p * sizes[s], sizes[s]);
+      }
+      uint64_t wall = bench_now_ns() - start;
+      if (k == 0)
+        ref = acc;
+      printf("CRC size: %3u engine: %-6s %7.2f ns/packet %6.2f GB/s %s\n",
+             sizes[s], name[k], (double)wall / n_packets,
+             (double)n_packets * sizes[s] / wall,
+             acc == ref ? "match" : "MISMATCH");
+    }
+  }
+  free(buf);
+}
+
+/**
+* \brief Measure the decoder on generated traffic.
+*
+* Decodes every traffic profile from memory, then streams the clean profile
+* straight from the generator. Reports the decoded packets against the intact
+* ones sent, which only match for the whole packets that don't straddle a
+* block boundary.
+*
+* \return
+*/
+void bench_gen() {
+  g_verbose_output = false;
+  uint8_t *buf = (uint8_t *)malloc(BENCH_GEN_SIZE);
+  struct gen_state *gen = (struct gen_state *)malloc(sizeof(struct gen_state));
+  if (buf == NULL || gen == NULL) {
+    free(buf);
+    free(gen);
+    return;
+  }
+  struct tsip_source src;
+  TaskUpLinkSetThreads(1);
+  for (uint8_t k = 0; k < sizeof(bench_gen_names) / sizeof(char *); k++) {
+    gen_init(gen, &bench_gen_profiles[k]);
+    uint64_t len = gen_fill(gen, buf, BENCH_GEN_SIZE);
+    gen_drop_pending(gen);
+    source_mem_init(&src, buf, len);
+    TaskUpLinkSetSource(&src);
+    uint64_t start = bench_now_ns();
+    TaskUpLink200Hz();
+    uint64_t wall = bench_now_ns() - start;
+    printf("Generator: %-8s packets %u of %llu intact (%llu flipped %llu "
+           "truncated %llu garbage bytes) wall %8.2f ms %7.2f MB/s\n",
+           bench_gen_names[k], packet_counter,
+           (unsigned long long)gen->intact, (unsigned long long)gen->flipped,
+           (unsigned long long)gen->truncated,
+           (unsigned long long)gen->garbage_bytes, wall / 1e6,
+           len * 1e3 / wall);
+  }
+
+  // no buffer in between, the generator is the decoder input
+  gen_init(gen, &bench_gen_profiles[0]);
+  source_gen_init(&src, gen, BENCH_GEN_SIZE);
+  TaskUpLinkSetSource(&src);
+  uint64_t start = bench_now_ns();
+  TaskUpLink200Hz();
+  uint64_t wall = bench_now_ns() - start;
+  printf("Generator: %-8s packets %u of %llu intact wall %8.2f ms %7.2f "
+         "MB/s\n",
+         "stream", packet_counter, (unsigned long long)gen->intact, wall / 1e6,
+         src.len * 1e3 / wall);
+  TaskUpLinkSetSource(NULL);
+  free(gen);
+  free(buf);
+}
+
+/**
+* \brief Write generated traffic to a file.
+*
+* \param fname 	File name.
+* \param len 		Approximate size of the file.
+* \param profile 	Traffic profile name, the clean one if NULL.
+* \return 			True if the file was written.
+*/
+bool bench_gen_file(const char *fname, uint64_t len, const char *profile) {
+  uint8_t k = 0;
+  while (profile != NULL && strcmp(bench_gen_names[k], profile) != 0) {
+    if (++k == sizeof(bench_gen_names) / sizeof(char *)) {
+      printf("Unknown traffic profile %s\n", profile);
+      return false;
+    }
+  }
+  struct gen_state *gen = (struct gen_state *)malloc(sizeof(struct gen_state));
+  if (gen == NULL)
+    return false;
+  gen_init(gen, &bench_gen_profiles[k]);
+  bool ok = gen_file(gen, fname, len);
+  if (ok)
+    printf("Generated %s: %llu packets, %llu intact\n", fname,
+           (unsigned long long)gen->packets, (unsigned long long)gen->intact);
+  free(gen);
+  return ok;
+}
+
+/**
+* \brief Print a decoder statistics snapshot.
+*
+* \param[in] name 	Snapshot name.
+* \param[in] stats 	Pointer to the snapshot.
+* \return
+*/
+void bench_stats_print(const char *name, const struct decoder_stats *stats) {
+  printf("Stats: %-7s bytes %llu packets %llu rejects size %llu id %llu "
+         "chksum %llu overflow %llu reassembled %llu wait read %.2f ms parse "
+         "%.2f ms latency p50 %llu ns p99 %llu ns\n",
+         name, (unsigned long long)stats->bytes_in,
+         (unsigned long long)stats->packets_out,
+         (unsigned long long)stats->rejects[size_mismatch],
+         (unsigned long long)stats->rejects[illegal_id],
+         (unsigned long long)stats->rejects[chksum_mismatch],
+         (unsigned long long)stats->overflow_drops,
+         (unsigned long long)stats->reassemblies, stats->read_wait_ns / 1e6,
+         stats->parse_wait_ns / 1e6,
+         (unsigned long long)stats_latency_percentile(stats, 0.5),
+         (unsigned long long)stats_latency_percentile(stats, 0.99));
+}
+
+/**
+* \brief Measure the cost of the decoder statistics.
+*
+* Times the decoding of the test data with the latency histogram off and on,
+* then prints the statistics of the test data and of an error storm.
+*
+* \return
+*/
+void bench_stats() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  struct tsip_source src;
+  struct decoder_stats stats;
+  source_mem_init(&src, g_test_data, g_test_data_len);
+  TaskUpLinkSetSource(&src);
+  TaskUpLinkSetThreads(1);
+  uint64_t wall[SUITE_RUNS];
+  for (uint8_t latency = 0; latency < 2; latency++) {
+    for (uint32_t r = 0; r < SUITE_WARMUP + SUITE_RUNS; r++) {
+      TaskUpLinkStatsReset(latency);
+      source_rewind(&src);
+      uint64_t start = bench_now_ns();
+      TaskUpLink200Hz();
+      if (r >= SUITE_WARMUP)
+        wall[r - SUITE_WARMUP] = bench_now_ns() - start;
+    }
+    qsort(wall, SUITE_RUNS, sizeof(wall[0]), bench_cmp);
+    printf("Stats: latency %-3s median %8.2f ms %7.2f MB/s\n",
+           latency ? "on" : "off", wall[SUITE_RUNS / 2] / 1e6,
+           g_test_data_len * 1e3 / wall[SUITE_RUNS / 2]);
+  }
+  TaskUpLinkStats(&stats);
+  bench_stats_print("sample", &stats);
+
+  struct gen_state *gen = (struct gen_state *)malloc(sizeof(struct gen_state));
+  uint8_t *buf = (uint8_t *)malloc(BENCH_GEN_SIZE);
+  if (gen != NULL && buf != NULL) {
+    gen_init(gen, &bench_gen_profiles[5]);
+    source_mem_init(&src, buf, gen_fill(gen, buf, BENCH_GEN_SIZE));
+    TaskUpLinkStatsReset(true);
+    TaskUpLink200Hz();
+    TaskUpLinkStats(&stats);
+    bench_stats_print(bench_gen_names[5], &stats);
+  }
+  TaskUpLinkStatsReset(false);
+  TaskUpLinkSetSource(NULL);
+  free(buf);
+  free(gen);
+}
+
+/**
+* \brief Measure the packet reassembly with small COM reads.
+*
+* Feeds the test data through the COM interface a few bytes per read, in the
+* block mode, where the reads are gathered into full blocks, and in the low
+* latency mode, where every read is a block of its own and nearly every packet
+* is reassembled from several of them.
+*
+* \return
+*/
+void bench_read_sizes_run() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  struct tsip_source src;
+  struct decoder_stats stats;
+  TaskUpLinkSetThreads(1);
+  const char *name[] = {"block", "low"};
+  for (uint8_t mode = 0; mode < 2; mode++) {
+    TaskUpLinkSetLowLatency(mode == 1);
+    for (uint8_t k = 0; k < sizeof(bench_read_sizes) / sizeof(uint32_t); k++) {
+      source_com_init(&src, bench_read_sizes[k]);
+      TaskUpLinkSetSource(&src);
+      g_test_data_start = 0;
+      TaskUpLinkStatsReset(false);
+      uint64_t start = bench_now_ns();
+      TaskUpLink200Hz();
+      uint64_t wall = bench_now_ns() - start;
+      TaskUpLinkStats(&stats);
+      printf("Read size: %-5s %3u bytes packets %u reassembled %llu overflow "
+             "%llu wall %8.2f ms %7.2f MB/s\n",
+             name[mode], bench_read_sizes[k], packet_counter,
+             (unsigned long long)stats.reassemblies,
+             (unsigned long long)stats.overflow_drops, wall / 1e6,
+             g_test_data_len * 1e3 / wall);
+    }
+  }
+  TaskUpLinkSetLowLatency(false);
+  TaskUpLinkSetSource(NULL);
+}
+
+/**
+* \brief Check if a capture with the given header opens.
+*
+* \param h Pointer to the header, written to a file on its own.
+* \return 	True if the capture opened.
+*/
+bool bench_capture_open_header(const struct capture_header *h) {
+  char name[] = "/tmp/tsip_bench_hdr_XXXXXX";
+  int fd = mkstemp(name);
+  if (fd < 0)
+    return false;
+  bool ok = write(fd, h, sizeof(*h)) == (ssize_t)sizeof(*h);
+  close(fd);
+  struct capture cap;
+  ok = ok && capture_open(&cap, name);
+  if (ok)
+    capture_close(&cap);
+  unlink(name);
+  return ok;
+}
+
+/**
+* \brief Check that the captures with a damaged header are rejected.
+*
+* Opens an empty capture, then the same capture with the section sizes that
+* wrap around the file size, with a misaligned index and with a foreign byte
+* order.
+*
+* \return
+*/
+void bench_capture_headers() {
+  struct capture_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+  h.version = CAPTURE_VERSION;
+  h.byte_order = CAPTURE_BYTE_ORDER;
+  h.header_size = sizeof(h);
+  h.data_offset = h.chunk_offset = h.index_offset = 8;
+  bool ok = bench_capture_open_header(&h);
+  struct capture_header bad = h;
+  bad.data_offset = UINT64_MAX;
+  bad.data_len = 2;
+  ok = ok && !bench_capture_open_header(&bad);
+  bad = h;
+  bad.chunk_count = UINT64_MAX / sizeof(struct capture_chunk) + 1;
+  ok = ok && !bench_capture_open_header(&bad);
+  bad = h;
+  bad.index_count = UINT64_MAX / sizeof(struct capture_index) + 1;
+  ok = ok && !bench_capture_open_header(&bad);
+  bad = h;
+  bad.index_offset = 9;
+  ok = ok && !bench_capture_open_header(&bad);
+  bad = h;
+  bad.byte_order = __builtin_bswap32(CAPTURE_BYTE_ORDER);
+  ok = ok && !bench_capture_open_header(&bad);
+  printf("Capture: damaged headers rejected %s\n", ok ? "ok" : "FAILED");
+}
+
+/**
+* \brief Measure the capture replay and seeks.
+*
+* Converts several copies of the test data into a capture, then replays it as
+* fast as possible, seeks into it at several points and decodes the rest, and
+* replays it paced at a multiple of real time. Then checks the damaged
+* capture headers.
+*
+* \return
+*/
+void bench_capture() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  char raw_name[] = "/tmp/tsip_bench_XXXXXX";
+  int fd = mkstemp(raw_name);
+  if (fd < 0)
+    return;
+  FILE *f = fdopen(fd, "wb");
+  for (uint32_t i = 0; i < BENCH_FRAME_COPIES; i++) {
+    fwrite(g_test_data, 1, g_test_data_len, f);
+  }
+  fclose(f);
+  char cap_name[] = "/tmp/tsip_bench_cap_XXXXXX";
+  fd = mkstemp(cap_name);
+  if (fd >= 0)
+    close(fd);
+  uint64_t start = bench_now_ns();
+  bool ok = fd >= 0 && capture_convert(raw_name, cap_name, BENCH_CAPTURE_BAUD,
+                                       MAX_COM_SIZE);
+  uint64_t wall = bench_now_ns() - start;
+  unlink(raw_name);
+  struct capture cap;
+  if (!ok || !capture_open(&cap, cap_name)) {
+    printf("Capture: conversion failed\n");
+    unlink(cap_name);
+    return;
+  }
+  printf("Capture: %llu bytes %llu chunks %llu index entries %.1f s of data "
+         "converted in %8.2f ms\n",
+         (unsigned long long)cap.hdr->data_len,
+         (unsigned long long)cap.hdr->chunk_count,
+         (unsigned long long)cap.hdr->index_count,
+         capture_duration(&cap) / 1e9, wall / 1e6);
+
+  struct tsip_source src;
+  struct capture_replay replay;
+  struct decoder_stats stats;
+  TaskUpLinkSetThreads(1);
+  source_capture_init(&src, &replay, &cap, 0);
+  TaskUpLinkSetSource(&src);
+  start = bench_now_ns();
+  TaskUpLink200Hz();
+  wall = bench_now_ns() - start;
+  printf("Capture: replay  packets %u wall %8.2f ms %7.2f MB/s\n",
+         packet_counter, wall / 1e6, src.len * 1e3 / wall);
+
+  // seek and decode the rest of the flight
+  for (uint8_t k = 1; k < 4; k++) {
+    uint64_t t = capture_duration(&cap) * k / 4;
+    start = bench_now_ns();
+    uint64_t at = capture_seek(&src, t);
+    uint64_t seek = bench_now_ns() - start;
+    TaskUpLinkSetSource(&src);
+    TaskUpLinkStatsReset(false);
+    TaskUpLink200Hz();
+    TaskUpLinkStats(&stats);
+    printf("Capture: seek %6.1f s to %6.1f s offset %8llu in %6.2f us packets "
+           "%u checksum rejects %llu\n",
+           t / 1e9, at / 1e9, (unsigned long long)(src.len - stats.bytes_in),
+           seek / 1e3, packet_counter,
+           (unsigned long long)stats.rejects[chksum_mismatch]);
+  }
+
+  // paced replay, the decoder polls at 200 Hz
+  source_capture_init(&src, &replay, &cap, BENCH_CAPTURE_SPEED);
+  TaskUpLinkSetSource(&src);
+  uint32_t packets = 0;
+  start = bench_now_ns();
+  uint64_t tick = start;
+  while (bench_now_ns() - start < BENCH_CAPTURE_PACED_NS) {
+    tick += BENCH_SERIAL_TICK_NS;
+    struct timespec ts = {tick / 1000000000ull, tick % 1000000000ull};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    TaskUpLink200Hz();
+    packets += packet_counter;
+  }
+  wall = bench_now_ns() - start;
+  printf("Capture: paced %.0fx bytes %llu expected %.0f packets %u\n",
+         BENCH_CAPTURE_SPEED, (unsigned long long)src.pos,
+         wall * BENCH_CAPTURE_SPEED * BENCH_CAPTURE_BAUD / 10 / 1e9, packets);
+  TaskUpLinkSetSource(NULL);
+  capture_close(&cap);
+  unlink(cap_name);
+  bench_capture_headers();
+}
+
+/**
+* \brief Compare the push parser with the threaded decoder.
+*
+* Feeds the test data to both in chunks of several sizes, as a link would hand
+* it over, with a decoder tick or a parser call per chunk. Checks that the
+* packets decoded by the push parser match the checksummed ones of every
+* generated traffic profile.
+*
+* \return
+*/
+void bench_push() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  uint8_t buf[PUSH_MIN_BUFFER];
+  struct push_parser p;
+  struct tsip_source src;
+  source_mem_init(&src, g_test_data, 0);
+  TaskUpLinkSetSource(&src);
+  TaskUpLinkSetThreads(1);
+  for (uint8_t k = 0; k < sizeof(bench_push_chunks) / sizeof(uint32_t); k++) {
+    uint32_t chunk = bench_push_chunks[k] ? bench_push_chunks[k]
+                                          : g_test_data_len;
+    // the threaded decoder, a tick per chunk
+    uint32_t threaded = 0;
+    src.pos = 0;
+    src.len = 0;
+    uint64_t start = bench_now_ns();
+    while (src.len < g_test_data_len) {
+      src.len = min((uint64_t)g_test_data_len, src.len + chunk);
+      TaskUpLink200Hz();
+      threaded += packet_counter;
+    }
+    uint64_t wall_threaded = bench_now_ns() - start;
+    // the push parser, a call per chunk
+    uint32_t pushed = 0;
+    push_init(&p, buf, sizeof(buf));
+    start = bench_now_ns();
+    for (uint32_t pos = 0; pos < g_test_data_len; pos += chunk) {
+      pushed += push_parse(&p, g_test_data + pos,
+                           min(chunk, g_test_data_len - pos));
+    }
+    uint64_t wall_push = bench_now_ns() - start;
+    uint32_t calls = (g_test_data_len + chunk - 1) / chunk;
+    printf("Push parser: chunk %7u threaded packets %5u %8.2f ms %8.2f "
+           "us/call push packets %5u %8.2f ms %8.2f us/call\n",
+           chunk, threaded, wall_threaded / 1e6, wall_threaded / 1e3 / calls,
+           pushed, wall_push / 1e6, wall_push / 1e3 / calls);
+  }
+  TaskUpLinkSetSource(NULL);
+
+  struct gen_state *gen = (struct gen_state *)malloc(sizeof(struct gen_state));
+  uint8_t *data = (uint8_t *)malloc(BENCH_GEN_SIZE);
+  if (gen == NULL || data == NULL) {
+    free(gen);
+    free(data);
+    return;
+  }
+  for (uint8_t k = 0; k < sizeof(bench_gen_names) / sizeof(char *); k++) {
+    gen_init(gen, &bench_gen_profiles[k]);
+    uint64_t len = gen_fill(gen, data, BENCH_GEN_SIZE);
+    gen_drop_pending(gen);
+    push_init(&p, buf, sizeof(buf));
+    uint32_t pushed = 0;
+    // odd sized pushes, to split the packets everywhere
+    for (uint64_t pos = 0; pos < len; pos += 61) {
+      pushed += push_parse(&p, data + pos, min((uint64_t)61, len - pos));
+    }
+    printf("Push parser: %-8s packets %u of %llu intact\n",
+           bench_gen_names[k], pushed, (unsigned long long)gen->intact);
+  }
+  free(gen);
+  free(data);
+}
+
+/**
+* \brief Measure the packet index build and the indexed decoding.
+*
+* Indexes several copies of the test data with every thread count and checks
+* that the entries don't depend on it, then decodes all the packets, a single
+* packet ID and a tenth of the packets through the index, and compares them
+* with decoding the whole buffer.
+*
+* \return
+*/
+void bench_index() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  uint64_t len = (uint64_t)g_test_data_len * BENCH_FRAME_COPIES;
+  uint8_t *buf = (uint8_t *)malloc(len);
+  for (uint32_t i = 0; i < BENCH_FRAME_COPIES; i++) {
+    memcpy(buf + (uint64_t)i * g_test_data_len, g_test_data, g_test_data_len);
+  }
+  struct packet_index ref, idx;
+  TaskUpLinkSetThreads(1);
+  if (!index_build(&ref, buf, len, 0)) {
+    free(buf);
+    return;
+  }
+  for (uint8_t i = 0; i < sizeof(bench_threads); i++) {
+    TaskUpLinkSetThreads(bench_threads[i]);
+    uint64_t start = bench_now_ns();
+    bool ok = index_build(&idx, buf, len, 0);
+    uint64_t wall = bench_now_ns() - start;
+    bool same = ok && idx.hdr.count == ref.hdr.count &&
+                memcmp(idx.entry, ref.entry,
+                       idx.hdr.count * sizeof(struct index_entry)) == 0;
+    printf("Index build threads: %2u entries %llu valid %llu wall %8.2f ms "
+           "%7.2f MB/s %s\n",
+           g_decoder_pool.n_threads, (unsigned long long)idx.hdr.count,
+           (unsigned long long)idx.hdr.valid, wall / 1e6, len * 1e3 / wall,
+           same ? "identical" : "MISMATCH");
+    index_free(&idx);
+  }
+
+  // round trip through a file
+  char name[] = "/tmp/tsip_bench_idx_XXXXXX";
+  int fd = mkstemp(name);
+  if (fd >= 0)
+    close(fd);
+  bool loaded =
+      fd >= 0 && index_save(&ref, name) && index_load(&idx, name, len);
+  unlink(name);
+  if (!loaded) {
+    printf("Index: file round trip failed\n");
+    index_free(&ref);
+    free(buf);
+    return;
+  }
+
+  // an entry count wrapping around the file size, and a foreign byte order
+  struct index_header bad[2] = {ref.hdr, ref.hdr};
+  bad[0].count = UINT64_MAX / sizeof(struct index_entry) + 1;
+  bad[1].byte_order = __builtin_bswap32(INDEX_BYTE_ORDER);
+  bool rejected = true;
+  for (uint8_t i = 0; i < 2; i++) {
+    struct packet_index wrap;
+    char bad_name[] = "/tmp/tsip_bench_idx_XXXXXX";
+    fd = mkstemp(bad_name);
+    bool ok = fd >= 0;
+    if (fd >= 0) {
+      ok = write(fd, &bad[i], sizeof(bad[i])) == (ssize_t)sizeof(bad[i]);
+      close(fd);
+      ok = ok && !index_load(&wrap, bad_name, len);
+      unlink(bad_name);
+    }
+    rejected = rejected && ok;
+  }
+  printf("Index: damaged headers rejected %s\n", rejected ? "ok" : "FAILED");
+
+  uint64_t count = idx.hdr.count;
+  uint64_t first = count / 2, last = count / 2 + count / 10;
+  uint32_t a50a = INDEX_ID(0xA5, 0x0A);
+  uint64_t matches = 0;
+  for (uint64_t i = index_find(&idx, 0, a50a); i < count;
+       i = index_find(&idx, i + 1, a50a)) {
+    matches += idx.entry[i].status == none;
+  }
+  for (uint8_t i = 0; i < sizeof(bench_threads); i++) {
+    TaskUpLinkSetThreads(bench_threads[i]);
+    uint64_t start = bench_now_ns();
+    uint32_t full = frame_buffer_parallel(buf, len, 0);
+    uint64_t t_full = bench_now_ns() - start;
+    start = bench_now_ns();
+    uint32_t all = index_decode(&idx, buf, 0, count, INDEX_ANY_ID, 0);
+    uint64_t t_all = bench_now_ns() - start;
+    start = bench_now_ns();
+    uint32_t id = index_decode(&idx, buf, 0, count, a50a, 0);
+    uint64_t t_id = bench_now_ns() - start;
+    start = bench_now_ns();
+    uint32_t range = index_decode(&idx, buf, first, last, INDEX_ANY_ID, 0);
+    uint64_t t_range = bench_now_ns() - start;
+    printf("Index decode threads: %2u full %u %7.2f ms indexed %u %7.2f ms "
+           "A5 0A %u of %llu %7.2f ms range %u %7.2f ms\n",
+           g_decoder_pool.n_threads, full, t_full / 1e6, all, t_all / 1e6, id,
+           (unsigned long long)matches, t_id / 1e6, range, t_range / 1e6);
+  }
+  index_free(&idx);
+  index_free(&ref);
+  free(buf);
+}
+
+/**
+* \brief Measure the offline batch decoder.
+*
+* Writes files of uneven sizes, from a few packets to several copies of the
+* test data, and decodes them with every thread count.
+*
+* \return
+*/
+void bench_offline() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  char dir[] = "/tmp/tsip_bench_batch_XXXXXX";
+  if (mkdtemp(dir) == NULL)
+    return;
+  struct offline_file file[BENCH_OFFLINE_FILES];
+  char name[BENCH_OFFLINE_FILES][sizeof(dir) + 16];
+  struct gen_state *gen = (struct gen_state *)malloc(sizeof(*gen));
+  gen_init(gen, &bench_gen_profiles[0]);
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < BENCH_OFFLINE_FILES; i++) {
+    // a few large files among many small ones
+    uint64_t len = (i % 16 == 0) ? (uint64_t)g_test_data_len * 8
+                                 : gen_rand(gen) % g_test_data_len;
+    snprintf(name[i], sizeof(name[i]), "%s/f%u", dir, i);
+    FILE *f = fopen(name[i], "wb");
+    for (uint64_t pos = 0; f != NULL && pos < len; pos += g_test_data_len) {
+      fwrite(g_test_data, 1, min(len - pos, (uint64_t)g_test_data_len), f);
+    }
+    if (f != NULL)
+      fclose(f);
+    memset(&file[i], 0, sizeof(file[i]));
+    file[i].path = name[i];
+    total += len;
+  }
+  free(gen);
+  for (uint8_t i = 0; i < sizeof(bench_threads); i++) {
+    TaskUpLinkSetThreads(bench_threads[i]);
+    struct offline_report report;
+    offline_decode(file, BENCH_OFFLINE_FILES, &report);
+    printf("Batch decoder threads: %2u files %u failed %u bytes %llu of %llu "
+           "packets %llu steals %u wall %8.2f ms %7.2f MB/s\n",
+           g_decoder_pool.n_threads, report.files, report.failed,
+           (unsigned long long)report.bytes, (unsigned long long)total,
+           (unsigned long long)report.packets, report.steals,
+           report.wall_ns / 1e6, report.bytes * 1e3 / report.wall_ns);
+  }
+  for (uint32_t i = 0; i < BENCH_OFFLINE_FILES; i++) {
+    unlink(name[i]);
+  }
+  rmdir(dir);
+}
+
+/**
+* \brief Sum up a field of every typed packet.
+*
+* \param pkt 	Pointer to the packet.
+* \param user 	Pointer to the sums, by packet type.
+* \return
+*/
+void bench_column_handler(const struct tsip_packet *pkt, void *user) {
+  double *sum = (double *)user;
+  if (pkt->type == tsip_a509)
+    sum[tsip_a509] += pkt->msg.a509.f64[0];
+  else if (pkt->type == tsip_a50a)
+    sum[tsip_a50a] += pkt->msg.a50a.u16[0];
+  else if (pkt->type == tsip_3902)
+    sum[tsip_3902] += pkt->msg.m3902.f64[0];
+}
+
+/**
+* \brief Measure the columnar export.
+*
+* Decodes several copies of the test data with and without the export, writes
+* the column file, and checks a column of every packet type against the
+* fields decoded by the typed dispatch, and that a packet not fitting its
+* schema is kept in the raw columns of its table.
+*
+* \return
+*/
+void bench_column() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  uint64_t len = (uint64_t)g_test_data_len * BENCH_FRAME_COPIES;
+  uint8_t *buf = (uint8_t *)malloc(len);
+  for (uint32_t i = 0; i < BENCH_FRAME_COPIES; i++) {
+    memcpy(buf + (uint64_t)i * g_test_data_len, g_test_data, g_test_data_len);
+  }
+  TaskUpLinkSetThreads(1);
+  double sum[4] = {0};
+  tsip_dispatch_reset();
+  tsip_register(0xA5, 0x09, tsip_decode_a509, bench_column_handler, sum);
+  tsip_register(0xA5, 0x0A, tsip_decode_a50a, bench_column_handler, sum);
+  tsip_register(0x39, 0x02, tsip_decode_3902, bench_column_handler, sum);
+  uint64_t start = bench_now_ns();
+  uint32_t packets = frame_buffer_parallel(buf, len, 0);
+  uint64_t t_decode = bench_now_ns() - start;
+
+  struct column_export exp;
+  if (!column_init(&exp)) {
+    free(buf);
+    return;
+  }
+  column_register(&exp);
+  start = bench_now_ns();
+  frame_buffer_parallel(buf, len, 0);
+  uint64_t t_export = bench_now_ns() - start;
+  // too short for its schema, so kept in the raw columns of its table
+  const uint8_t short_a509[] = {0xA5, 0x09, 1, 2, 3};
+  column_add(&exp, short_a509, sizeof(short_a509));
+  char name[] = "/tmp/tsip_bench_col_XXXXXX";
+  int fd = mkstemp(name);
+  if (fd >= 0)
+    close(fd);
+  start = bench_now_ns();
+  bool ok = fd >= 0 && column_save(&exp, name);
+  uint64_t t_save = bench_now_ns() - start;
+  tsip_dispatch_reset();
+  printf("Column export: packets %u tables %u decode %7.2f ms with export "
+         "%7.2f ms save %7.2f ms %7.2f MB/s of data\n",
+         packets, exp.table_count, t_decode / 1e6, t_export / 1e6,
+         t_save / 1e6, len * 1e3 / (t_export + t_save));
+
+  // compare the columns with the dispatched fields
+  struct column_file cf;
+  if (ok && column_open(&cf, name)) {
+    const char *field[] = {NULL, "f64[0]", "u16[0]", "f64[0]"};
+    const uint8_t ids[][2] = {{0, 0}, {0xA5, 0x09}, {0xA5, 0x0A}, {0x39, 0x02}};
+    for (uint8_t k = tsip_a509; k <= tsip_3902; k++) {
+      const struct column_dir_column *c;
+      const void *v = column_find(&cf, ids[k][0], ids[k][1], field[k], &c);
+      double s = 0;
+      for (uint64_t i = 0; v != NULL && i < c->count; i++) {
+        s += c->type == col_f64 ? ((const double *)v)[i]
+                                : ((const uint16_t *)v)[i];
+      }
+      printf("Column export: %02X %02X %-6s rows %llu %s\n", ids[k][0],
+             ids[k][1], field[k], v ? (unsigned long long)c->count : 0ull,
+             v != NULL && s == sum[k] ? "matches" : "MISMATCH");
+    }
+    const struct column_dir_column *c_len, *c_payload;
+    const uint16_t *raw_len =
+        (const uint16_t *)column_find(&cf, 0xA5, 0x09, "len", &c_len);
+    const uint8_t *raw_payload =
+        (const uint8_t *)column_find(&cf, 0xA5, 0x09, "payload", &c_payload);
+    bool raw_ok = raw_len != NULL && raw_payload != NULL &&
+                  c_len->count == 1 && raw_len[0] == 3 &&
+                  c_payload->count == 3 &&
+                  memcmp(raw_payload, short_a509 + 2, 3) == 0;
+    printf("Column export: A5 09 raw    rows %llu mismatched %llu %s\n",
+           raw_len ? (unsigned long long)c_len->count : 0ull,
+           (unsigned long long)exp.mismatched, raw_ok ? "kept" : "MISMATCH");
+    column_close(&cf);
+  } else {
+    printf("Column export: writing the file failed\n");
+  }
+  unlink(name);
+  column_free(&exp);
+  free(buf);
+}
+
+/**
+* \brief Measure the block size auto-tuner.
+*
+* Times the bulk decoding of several copies of the test data with every fixed
+* block size, then lets the tuner pick one over repeated bulk ticks. Then feeds
+* the test data paced to several baud rates, polled at 200 Hz, and reports the
+* sizes picked for a live link. The rest of the data is decoded at the end, to
+* check that no packet is lost while the block size changes.
+*
+* \return
+*/
+void bench_autotune() {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  uint8_t copies = 4;
+  uint64_t len = (uint64_t)g_test_data_len * copies;
+  uint8_t *buf = (uint8_t *)malloc(len);
+  if (buf == NULL)
+    return;
+  for (uint8_t i = 0; i < copies; i++) {
+    memcpy(buf + (uint64_t)i * g_test_data_len, g_test_data, g_test_data_len);
+  }
+  struct tsip_source src;
+  struct block_tuning tuning;
+  source_mem_init(&src, buf, len);
+  TaskUpLinkSetSource(&src);
+  TaskUpLinkSetThreads(2);
+  uint64_t wall[BENCH_TUNE_TICKS];
+  for (uint8_t b = 0; b < sizeof(bench_tune_blocks) / sizeof(uint32_t); b++) {
+    TaskUpLinkSetBlockSize(bench_tune_blocks[b]);
+    for (uint32_t r = 0; r < SUITE_WARMUP + SUITE_RUNS; r++) {
+      source_rewind(&src);
+      uint64_t start = bench_now_ns();
+      TaskUpLink200Hz();
+      if (r >= SUITE_WARMUP)
+        wall[r - SUITE_WARMUP] = bench_now_ns() - start;
+    }
+    qsort(wall, SUITE_RUNS, sizeof(wall[0]), bench_cmp);
+    printf("Autotune: fixed block %5u median %8.2f ms %7.2f MB/s\n",
+           bench_tune_blocks[b], wall[SUITE_RUNS / 2] / 1e6,
+           len * 1e3 / wall[SUITE_RUNS / 2]);
+  }
+
+  // bulk replay, the tuner starts from the default block size
+  TaskUpLinkSetBlockSize(BLOCK_SIZE);
+  TaskUpLinkSetAutoTune(true, 0);
+  uint32_t lost = 0;
+  for (uint32_t r = 0; r < BENCH_TUNE_TICKS; r++) {
+    source_rewind(&src);
+    uint64_t start = bench_now_ns();
+    TaskUpLink200Hz();
+    wall[r] = bench_now_ns() - start;
+    lost += packet_counter != 30000u * copies;
+  }
+  TaskUpLinkTuning(&tuning);
+  // the last half, once the tuner has settled
+  qsort(wall + BENCH_TUNE_TICKS / 2, BENCH_TUNE_TICKS / 2, sizeof(wall[0]),
+        bench_cmp);
+  uint64_t median = wall[BENCH_TUNE_TICKS / 2 + BENCH_TUNE_TICKS / 4];
+  printf("Autotune: bulk  block %5u com %5u median %8.2f ms %7.2f MB/s ticks "
+         "short of packets %u\n",
+         tuning.block_size, tuning.com_size, median / 1e6,
+         len * 1e3 / median, lost);
+
+  // live link, the data arrives at the baud rate
+  for (uint8_t i = 0; i < sizeof(bench_tune_bauds) / sizeof(uint32_t); i++) {
+    source_mem_init(&src, g_test_data, 0);
+    TaskUpLinkSetSource(&src);
+    TaskUpLinkSetBlockSize(BLOCK_SIZE);
+    TaskUpLinkSetAutoTune(false, 0);
+    TaskUpLinkSetAutoTune(true, 0);
+    TaskUpLinkStatsReset(true);
+    uint32_t packets = 0;
+    uint64_t start = bench_now_ns();
+    uint64_t tick = start;
+    while (tick - start < BENCH_TUNE_PACED_NS) {
+      tick += BENCH_SERIAL_TICK_NS;
+      struct timespec ts = {tick / 1000000000ull, tick % 1000000000ull};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      // 10 bits per byte on the line
+      src.len = min((bench_now_ns() - start) * bench_tune_bauds[i] / 10 /
+                        1000000000ull,
+                    (uint64_t)g_test_data_len);
+      TaskUpLink200Hz();
+      packets += packet_counter;
+    }
+    TaskUpLinkTuning(&tuning);
+    struct decoder_stats stats;
+    TaskUpLinkStats(&stats);
+    uint64_t live = src.len;
+    src.len = g_test_data_len;
+    TaskUpLink200Hz();
+    packets += packet_counter;
+    printf("Autotune: %8u baud block %5u com %5u rate %8.0f B/s bytes %7llu "
+           "latency p99 %7llu ns packets %u of 30000\n",
+           bench_tune_bauds[i], tuning.block_size, tuning.com_size,
+           tuning.rate, (unsigned long long)live,
+           (unsigned long long)stats_latency_percentile(&stats, 0.99),
+           packets);
+  }
+  TaskUpLinkSetAutoTune(false, 0);
+  TaskUpLinkSetBlockSize(BLOCK_SIZE);
+  TaskUpLinkSetComSize(MAX_COM_SIZE);
+  TaskUpLinkStatsReset(false);
+  TaskUpLinkSetSource(NULL);
+  free(buf);
+}
+
+/**
+ * \brief Competing CPU load of the jitter benchmark.
+ */
+struct cpu_hog {
+  pthread_t thread[POOL_MAX_THREADS];
+  uint8_t n_threads;
+  _Atomic bool running;
+};
+
+/**
+* \brief Competing load thread function
+*
+* Spins at the default priority until the load is stopped.
+*
+* \param[in] arg Pointer to the load.
+* \return
+*/
+void *bench_hog_thread(void *arg) {
+  struct cpu_hog *hog = (struct cpu_hog *)arg;
+  volatile uint64_t spin = 0;
+  while (atomic_load_explicit(&hog->running, memory_order_relaxed)) {
+    spin++;
+  }
+  return NULL;
+}
+
+/**
+* \brief Start the competing load threads.
+*
+* \param hog 		Pointer to the load.
+* \param n_threads 	Number of threads.
+* \return
+*/
+void bench_hog_start(struct cpu_hog *hog, uint8_t n_threads) {
+  atomic_init(&hog->running, true);
+  hog->n_threads = 0;
+  for (uint8_t i = 0; i < min(n_threads, (uint8_t)POOL_MAX_THREADS); i++) {
+    if (pthread_create(&hog->thread[i], NULL, bench_hog_thread, hog) != 0)
+      break;
+    hog->n_threads++;
+  }
+}
+
+/**
+* \brief Stop the competing load threads.
+*
+* \param hog Pointer to the load.
+* \return
+*/
+void bench_hog_stop(struct cpu_hog *hog) {
+  atomic_store(&hog->running, false);
+  for (uint8_t i = 0; i < hog->n_threads; i++) {
+    pthread_join(hog->thread[i], NULL);
+  }
+  hog->n_threads = 0;
+}
+
+/**
+* \brief Measure the tick jitter under a competing CPU load.
+*
+* Runs 200 Hz ticks decoding a slice of the test data, idle, then with twice
+* as many spinning threads as there are CPUs, first with the default
+* scheduling, then with the decoder threads pinned to the CPUs of the process
+* in turn, then pinned and with the SCHED_FIFO policy, for the decoder threads
+* and the calling thread alike. Reports the distributions of the tick wall time
+* and of the tick wake up delay. Without the privileges for a real-time
+* priority the last run keeps the default policy, and says so.
+*
+* \param priority SCHED_FIFO priority of the real-time run.
+* \return
+*/
+void bench_jitter(int priority) {
+  if (!bench_load("data/tsip_sample_ext"))
+    return;
+  g_verbose_output = false;
+  struct tsip_source src;
+  source_mem_init(&src, g_test_data,
+                  min((uint32_t)BENCH_JITTER_BYTES, g_test_data_len));
+  TaskUpLinkSetSource(&src);
+  TaskUpLinkSetThreads(2);
+  uint16_t cpu[POOL_MAX_THREADS];
+  uint8_t n_cpus = 0;
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int i = 0; i < CPU_SETSIZE && n_cpus < POOL_MAX_THREADS; i++) {
+      if (CPU_ISSET(i, &set))
+        cpu[n_cpus++] = i;
+    }
+  }
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  uint8_t n_hogs = min(2 * max(online, 1l), (long)POOL_MAX_THREADS);
+  const char *name[] = {"idle", "load", "pinned", "realtime"};
+  uint64_t wall[BENCH_JITTER_TICKS];
+  uint64_t late[BENCH_JITTER_TICKS];
+  struct cpu_hog hog;
+  for (uint8_t c = 0; c < 4; c++) {
+    if (c > 0)
+      bench_hog_start(&hog, n_hogs);
+    TaskUpLinkSetSched(c == 3 ? priority : 0, cpu, c >= 2 ? n_cpus : 0);
+    // the caller wakes the decoder threads up, so it needs the same priority
+    uint8_t caller = 0;
+    if (c == 3)
+      caller = thread_sched_apply(pthread_self(), priority, -1);
+    source_rewind(&src);
+    TaskUpLink200Hz();
+    struct sched_status status;
+    TaskUpLinkSchedStatus(&status);
+
+    uint64_t tick = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_JITTER_TICKS; i++) {
+      tick += BENCH_SERIAL_TICK_NS;
+      struct timespec ts = {tick / 1000000000ull, tick % 1000000000ull};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      uint64_t start = bench_now_ns();
+      late[i] = start > tick ? start - tick : 0;
+      source_rewind(&src);
+      TaskUpLink200Hz();
+      wall[i] = bench_now_ns() - start;
+    }
+    if (c == 3)
+      thread_sched_apply(pthread_self(), 0, -1);
+    TaskUpLinkSetSched(0, NULL, 0);
+    if (c > 0)
+      bench_hog_stop(&hog);
+
+    qsort(wall, BENCH_JITTER_TICKS, sizeof(wall[0]), bench_cmp);
+    qsort(late, BENCH_JITTER_TICKS, sizeof(late[0]), bench_cmp);
+    uint32_t p99 = (BENCH_JITTER_TICKS * 99 + 99) / 100 - 1;
+    printf("Jitter: %-8s load %2u pinned %u/%u realtime %u/%u tick p50 %8.1f "
+           "us p99 %8.1f us max %8.1f us wake late p50 %8.1f us p99 %8.1f us "
+           "max %8.1f us\n",
+           name[c], c > 0 ? n_hogs : 0, status.pinned, status.threads,
+           status.realtime, status.threads, wall[BENCH_JITTER_TICKS / 2] / 1e3,
+           wall[p99] / 1e3, wall[BENCH_JITTER_TICKS - 1] / 1e3,
+           late[BENCH_JITTER_TICKS / 2] / 1e3, late[p99] / 1e3,
+           late[BENCH_JITTER_TICKS - 1] / 1e3);
+    if (c == 3 && (status.realtime < status.threads ||
+                   !(caller & sched_realtime)))
+      printf("Jitter: real-time priority not permitted, the realtime run kept "
+             "the default policy\n");
+  }
+  TaskUpLinkSetSource(NULL);
+}
+
+/**
+* \brief Main function
+*
+* Runs the benchmarks. Given the serial option, a data file name and a baud
+* rate, only streams the file through the serial benchmark. Given the suite
+* option, only runs the benchmark suite, appending the results to the JSON
+* file given after it, with the block size given after the file. Given the gen
+* option, a file name, a size and optionally a traffic profile, only writes
+* generated traffic to the file. Given the capture option, a raw data file
+* name, a capture file name and a baud rate, only converts the raw data into a
+* capture. Given the jitter option and optionally a priority, only runs the
+* jitter benchmark.
+*
+* \param[in] argc Number of arguments.
+* \param[in] argv Arguments.
+* \return
+*/
+int main(int argc, char *argv[]) {
+  setbuf(stdout, NULL);
+  if (argc > 3 && strcmp(argv[1], "serial") == 0) {
+    bench_serial(argv[2], atoi(argv[3]));
+    TaskUpLinkShutdown();
+    return 0;
+  }
+  if (argc > 3 && strcmp(argv[1], "gen") == 0) {
+    return bench_gen_file(argv[2], strtoull(argv[3], NULL, 0),
+                          argc > 4 ? argv[4] : NULL)
+               ? 0
+               : 1;
+  }
+  if (argc > 4 && strcmp(argv[1], "capture") == 0) {
+    return capture_convert(argv[2], argv[3], atoi(argv[4]), MAX_COM_SIZE) ? 0
+                                                                        : 1;
+  }
+  if (argc > 1 && strcmp(argv[1], "jitter") == 0) {
+    bench_jitter(argc > 2 ? atoi(argv[2]) : BENCH_JITTER_PRIORITY);
+    TaskUpLinkShutdown();
+    return 0;
+  }
+  if (argc > 1 && strcmp(argv[1], "suite") == 0) {
+    if (argc > 3)
+      TaskUpLinkSetBlockSize(atoi(argv[3]));
+    bench_suite(argc > 2 ? argv[2] : NULL);
+    TaskUpLinkShutdown();
+    return 0;
+  }
+  bench_tick_overhead();
+  bench_thread_scaling();
+  bench_stream_scaling();
+  bench_sources();
+  bench_ring();
+  for (size_t i = 0; i < sizeof(bench_bauds) / sizeof(bench_bauds[0]); i++) {
+    bench_serial("data/tsip_sample_ext", bench_bauds[i]);
+  }
+  for (size_t i = 0; i + 1 < sizeof(bench_bauds) / sizeof(bench_bauds[0]);
+       i++) {
+    bench_latency("data/tsip_sample_ext", bench_bauds[i]);
+  }
+  bench_parallel_framing();
+  bench_dle_scan();
+  bench_crc();
+  bench_dispatch();
+  bench_batch();
+  bench_gen();
+  bench_stats();
+  bench_push();
+  bench_read_sizes_run();
+  bench_capture();
+  bench_index();
+  bench_offline();
+  bench_column();
+  bench_autotune();
+  bench_jitter(BENCH_JITTER_PRIORITY);
+  bench_suite(NULL);
+  TaskUpLinkShutdown();
+  return 0;
+}
@@ -0,0 +1,154 @@
+/** @file uavnav_index.c
+ * \brief Packet index application.
+ *  Builds the packet index of a data file, reports what it holds, and decodes
+ *  a packet range through it
+*/
+
+#define _GNU_SOURCE
+#include "tsip_index.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+unsigned char *g_test_data = NULL;
+uint32_t g_test_data_len;
+uint32_t g_test_data_start;
+bool g_verbose_output;
+
+/**
+* \brief Parse a number argument.
+*
+* \param arg 		Number argument.
+* \param base 		Number base.
+* \param limit 		Largest value accepted.
+* \param[out] n 	Number.
+* \return 			True if the argument is a number up to the limit.
+*/
+bool index_cmd_number(const char *arg, int base, uint64_t limit, uint64_t *n) {
+  char *end;
+  errno = 0;
+  unsigned long long v = strtoull(arg, &end, base);
+  if (end == arg || *end != '\0' || arg[0] == '-' || errno != 0 || v > limit)
+    return false;
+  *n = v;
+  return true;
+}
+
+/**
+* \brief Index a data file and write the index to a file.
+*
+* \param[in] src 	Mapped data file.
+* \param[in] out 	Index file name.
+* \return 			True if the index was written.
+*/
+bool index_cmd_build(const struct tsip_source *src, const char *out) {
+  struct packet_index idx;
+  uint64_t start = decoder_clock_ns();
+  bool ok = index_build(&idx, src->data, src->len, 0);
+  uint64_t wall = decoder_clock_ns() - start;
+  ok = ok && index_save(&idx, out);
+  if (ok)
+    printf("Indexed %llu packets, %llu valid, in %.2f ms\n",
+           (unsigned long long)idx.hdr.count,
+           (unsigned long long)idx.hdr.valid, wall / 1e6);
+  index_free(&idx);
+  return ok;
+}
+
+/**
+* \brief Print the packet counts of an index by ID.
+*
+* \param[in] idx Pointer to the index.
+* \return 		True if the counts were printed.
+*/
+bool index_cmd_info(const struct packet_index *idx) {
+  uint64_t *valid = (uint64_t *)calloc(1 << 16, sizeof(uint64_t));
+  uint64_t *all = (uint64_t *)calloc(1 << 16, sizeof(uint64_t));
+  bool ok = valid != NULL && all != NULL;
+  for (uint64_t i = 0; ok && i < idx->hdr.count; i++) {
+    uint32_t id = INDEX_ID(idx->entry[i].id1, idx->entry[i].id2);
+    all[id]++;
+    valid[id] += idx->entry[i].status == none;
+  }
+  if (ok) {
+    printf("Entries %llu valid %llu data %llu bytes\n",
+           (unsigned long long)idx->hdr.count,
+           (unsigned long long)idx->hdr.valid,
+           (unsigned long long)idx->hdr.data_len);
+    for (uint32_t id = 0; id < 1 << 16; id++) {
+      if (all[id] != 0)
+        printf("%02X %02X entries %llu valid %llu\n", id >> 8, id & 0xFF,
+               (unsigned long long)all[id], (unsigned long long)valid[id]);
+    }
+  }
+  free(valid);
+  free(all);
+  return ok;
+}
+
+/**
+* \brief Main function
+*
+* Given the build option, a data file name and an index file name, writes the
+* packet index of the data. Given the info option and the same names, prints
+* the entry counts of the index by packet ID. Given the decode option, the same
+* names and optionally a first entry, an entry past the range and a packet ID
+* as four hex digits, decodes the valid packets of the range, of that ID only
+* if given, and prints them.
+*
+* \param[in] argc Number of arguments.
+* \param[in] argv Arguments.
+* \return
+*/
+int main(int argc, char *argv[]) {
+  setbuf(stdout, NULL);
+  uint64_t first = 0, last = UINT64_MAX, id = INDEX_ANY_ID;
+  bool build = argc == 4 && strcmp(argv[1], "build") == 0;
+  bool info = argc == 4 && strcmp(argv[1], "info") == 0;
+  bool decode = argc >= 4 && argc <= 7 && strcmp(argv[1], "decode") == 0;
+  if (decode && argc > 4)
+    decode = index_cmd_number(argv[4], 10, UINT64_MAX, &first);
+  if (decode && argc > 5)
+    decode = index_cmd_number(argv[5], 10, UINT64_MAX, &last);
+  if (decode && argc > 6)
+    decode = index_cmd_number(argv[6], 16, 0xFFFF, &id);
+  if (!build && !info && !decode) {
+    printf("Usage: %s build|info <data file> <index file>\n"
+           "       %s decode <data file> <index file> [first [last [id]]]\n",
+           argv[0], argv[0]);
+    return 2;
+  }
+  struct tsip_source src;
+  if (!source_mmap_open(&src, argv[2])) {
+    printf("Cannot read %s\n", argv[2]);
+    return 2;
+  }
+  // a thread per online core, as in the batch decoder
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  threads = min(max(threads, 1l), (long)POOL_MAX_THREADS);
+  TaskUpLinkSetThreads((uint8_t)threads);
+  bool ok;
+  if (build) {
+    ok = index_cmd_build(&src, argv[3]);
+  } else {
+    struct packet_index idx;
+    ok = index_load(&idx, argv[3], src.len);
+    if (!ok) {
+      printf("%s is not an index of %s\n", argv[3], argv[2]);
+    } else if (info) {
+      ok = index_cmd_info(&idx);
+    } else {
+      tsip_register_builtin();
+      g_verbose_output = true;
+      last = min(last, idx.hdr.count);
+      uint32_t packets =
+          first < last ? index_decode(&idx, src.data, first, last, id, 0) : 0;
+      printf("Decoded %u packets of entries %llu to %llu\n", packets,
+             (unsigned long long)first, (unsigned long long)last);
+    }
+    index_free(&idx);
+  }
+  source_close(&src);
+  TaskUpLinkShutdown();
+  return ok ? 0 : 1;
+}
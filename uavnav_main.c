@@ -3,6 +3,7 @@
  *  Loads the test data files, runs tests, outputs the
 */
 
+#define _GNU_SOURCE
 #include "tsip_decode.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,52 +14,36 @@ uint32_t g_test_data_len;
 uint32_t g_test_data_start;
 bool g_verbose_output;
 
+/**
+ * \brief Test data input source.
+ */
+struct tsip_source g_test_source;
+
 /**
 * \brief Load a test data file
 *
-* Loads a tester data file into workspace.
+* Maps a tester data file into memory and sets it as the decoder input source.
 *
 * \param[in] fname File name.
 * \return
 */
 void test_data_load(const char *fname) {
-  FILE *f;
-  f = fopen(fname, "rb");
-  if (f == NULL) {
+  source_close(&g_test_source);
+  if (!source_mmap_open(&g_test_source, fname)) {
     printf("File %s not found\n", fname);
     return;
   } else {
     printf("Loaded file %s\n", fname);
   }
-  uint8_t num = 0;
-  uint32_t size = 0;
-  // Get the file size
-  while (fread(&num, sizeof(num), 1, f) > 0) {
-    size++;
-  }
-  rewind(f);
-  // Load the data into memory
-  g_test_data_len = size;
-  if (g_test_data == NULL) {
-    g_test_data = (unsigned char *)malloc(size);
-  } else {
-    free(g_test_data);
-    g_test_data = (unsigned char *)malloc(size);
-  }
-  g_test_data_start = 0;
-
-  printf("Size: %u\n", size);
-
-  for (uint32_t i = 0; i < g_test_data_len; i++) {
-    fread(&g_test_data[i], sizeof(unsigned char), 1, f);
-  }
-  fclose(f);
+  printf("Size: %u\n", (uint32_t)g_test_source.len);
+  TaskUpLinkSetSource(&g_test_source);
 }
 
 /**
 * \brief Main function
 *
-* Loads a tester data file, runs tests.
+* Loads a tester data file, runs tests. The optional second parameter sets the
+* number of decoder threads, from 1 to POOL_MAX_THREADS.
 *
 * \param[in] argc Number of arguments.
 * \param[in] argv Arguments.
@@ -66,6 +51,18 @@ void test_data_load(const char *fname) {
 */
 int main(int argc, char *argv[]) {
   setbuf(stdout, NULL);
+  long threads = 0;
+  if (argc > 2) {
+    char *end;
+    threads = strtol(argv[2], &end, 10);
+    if (end == argv[2] || *end != '\0' || threads < 1 ||
+        threads > POOL_MAX_THREADS) {
+      printf("Usage: %s [file] [threads, 1 to %d]\n", argv[0],
+             POOL_MAX_THREADS);
+      return 2;
+    }
+  }
+  tsip_register_builtin();
   // Load the test file
   printf("Running verbose test\n");
     //! [Loading a test file]
@@ -77,10 +74,15 @@ int main(int argc, char *argv[]) {
     test_data_load("data/tsip_sample");
   }
     //! [Loading a test file]
+  if (threads != 0) {
+    // optional decoder thread count
+    TaskUpLinkSetThreads((uint8_t)threads);
+  }
     //! [Running a verbose test]
   // Run the decoder in verbose mode
   g_verbose_output = true;
   TaskUpLink200Hz();
+  printf("Decoded %u packets\n", packet_counter);
     //! [Running a verbose test]
 
   printf("\nRunning a timed test\n");
@@ -89,14 +91,17 @@ int main(int argc, char *argv[]) {
   g_verbose_output = false;
   // load a large file
   test_data_load("data/tsip_sample_ext");
-  clock_t start = clock(), diff;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
   TaskUpLink200Hz();
-  diff = clock() - start;
-  int msec = diff * 1000 / CLOCKS_PER_SEC;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("Decoded %u packets\n", packet_counter);
+  int msec = (end.tv_sec - start.tv_sec) * 1000 +
+             (end.tv_nsec - start.tv_nsec) / 1000000;
   printf("Time taken %d seconds %d milliseconds\n", msec / 1000, msec % 1000);
     //! [Running a timed test]
 
-  free(g_test_data);
-  g_test_data = NULL;
+  TaskUpLinkShutdown();
+  source_close(&g_test_source);
   return 0;
 }
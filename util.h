@@ -5,7 +5,21 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+/**
+ * \brief x86 carry-less multiplication CRC availability flag.
+ */
+#define CRC_X86 1
+#else
+#define CRC_X86 0
+#endif
 
 #define max(a, b)                                                              \
   ({                                                                           \
@@ -69,6 +83,263 @@ const uint32_t crc32_table[] = {
     0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
     0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D};
 
+/**
+ * \brief Initial CRC register value.
+ */
+#define CRC32_INIT 0xFFFFFFFF
+/**
+ * \brief CRC register value after processing a message followed by its CRC.
+ */
+#define CRC32_RESIDUE 0xDEBB20E3
+
+/**
+ * \brief Slice-by-8 CRC tables, built from crc32_table on first use.
+ */
+static uint32_t crc32_slice_table[8][256];
+static pthread_once_t crc32_slice_once = PTHREAD_ONCE_INIT;
+
+/**
+ * \brief CRC update function.
+ *
+ * Updates the CRC register, without the initial and final inversion.
+ */
+typedef uint32_t (*crc32_update_fn)(uint32_t crc, const uint8_t *buf,
+                                    uint32_t len);
+
+/**
+ * \brief CRC update, one byte at a time.
+ *
+ * \param crc 	CRC register value.
+ * \param buf 	Pointer to data to process.
+ * \param len 	Number of bytes to process.
+ * \return 		Updated CRC register value.
+ */
+uint32_t crc32_update_table(uint32_t crc, const uint8_t *buf, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    crc = (crc >> 8) ^ crc32_table[(crc ^ buf[i]) & 0xFF];
+  }
+  return crc;
+}
+
+/**
+ * \brief CRC update with a single byte.
+ *
+ * \param crc 	CRC register value.
+ * \param b 	Byte to process.
+ * \return 		Updated CRC register value.
+ */
+static inline uint32_t crc32_byte(uint32_t crc, uint8_t b) {
+  return (crc >> 8) ^ crc32_table[(crc ^ b) & 0xFF];
+}
+
+/**
+ * \brief Fill in the slice-by-8 CRC tables.
+ *
+ * \return
+ */
+void crc32_slice_build() {
+  for (uint32_t i = 0; i < 256; i++) {
+    crc32_slice_table[0][i] = crc32_table[i];
+  }
+  for (uint32_t k = 1; k < 8; k++) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = crc32_slice_table[k - 1][i];
+      crc32_slice_table[k][i] = (c >> 8) ^ crc32_table[c & 0xFF];
+    }
+  }
+}
+
+/**
+ * \brief Build the slice-by-8 CRC tables, once.
+ *
+ * Safe to call from several threads at a time, the tables are filled in by
+ * the first caller and visible to all of them once it returns.
+ *
+ * \return
+ */
+void crc32_slice_init() { pthread_once(&crc32_slice_once, crc32_slice_build); }
+
+/**
+ * \brief CRC update, eight bytes at a time.
+ *
+ * \param crc 	CRC register value.
+ * \param buf 	Pointer to data to process.
+ * \param len 	Number of bytes to process.
+ * \return 		Updated CRC register value.
+ */
+uint32_t crc32_update_slice8(uint32_t crc, const uint8_t *buf, uint32_t len) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const uint32_t(*t)[256] = crc32_slice_table;
+  while (len >= 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, buf, 4);
+    memcpy(&hi, buf + 4, 4);
+    lo ^= crc;
+    crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^
+          t[4][lo >> 24] ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+          t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    buf += 8;
+    len -= 8;
+  }
+#endif
+  return crc32_update_table(crc, buf, len);
+}
+
+#if CRC_X86
+/**
+ * \brief CRC update using carry-less multiplication.
+ *
+ * Folds 64 bytes at a time, following Intel's "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction" paper. Blocks shorter than
+ * 64 bytes and the trailing bytes are handled by the slice-by-8 update.
+ *
+ * \param crc 	CRC register value.
+ * \param buf 	Pointer to data to process.
+ * \param len 	Number of bytes to process.
+ * \return 		Updated CRC register value.
+ */
+__attribute__((target("pclmul,sse4.1"))) uint32_t
+crc32_update_pclmul(uint32_t crc, const uint8_t *buf, uint32_t len) {
+  if (len < 64)
+    return crc32_update_slice8(crc, buf, len);
+
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+  x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+  x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+  x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+  x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  buf += 64;
+  len -= 64;
+
+  // fold 64 bytes at a time
+  while (len >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                       _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                       _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                       _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                       _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+    buf += 64;
+    len -= 64;
+  }
+
+  // fold the four lanes into one
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // fold 16 bytes at a time
+  while (len >= 16) {
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                       _mm_loadu_si128((const __m128i *)buf));
+    buf += 16;
+    len -= 16;
+  }
+
+  // fold 128 bits down to 64 bits
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask32);
+  x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits
+  x2 = _mm_and_si128(x1, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  crc = _mm_extract_epi32(x1, 1);
+
+  return crc32_update_slice8(crc, buf, len);
+}
+#endif
+
+/**
+ * \brief Select the fastest CRC update supported by the CPU.
+ *
+ * \return Pointer to the CRC update function.
+ */
+crc32_update_fn crc32_update_select() {
+  crc32_slice_init();
+#if CRC_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+    return crc32_update_pclmul;
+#endif
+  return crc32_update_slice8;
+}
+
+uint32_t crc32_update_resolve(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+/**
+ * \brief CRC update function in use, selected on the first call.
+ */
+static _Atomic crc32_update_fn crc32_update = crc32_update_resolve;
+static pthread_once_t crc32_update_once = PTHREAD_ONCE_INIT;
+
+/**
+ * \brief Publish the CRC update function selected for the CPU.
+ *
+ * \return
+ */
+void crc32_update_pick() {
+  atomic_store_explicit(&crc32_update, crc32_update_select(),
+                        memory_order_release);
+}
+
+/**
+ * \brief Select the CRC update function, once.
+ *
+ * Safe to call from several threads at a time.
+ *
+ * \return
+ */
+void crc32_update_init() {
+  pthread_once(&crc32_update_once, crc32_update_pick);
+}
+
+/**
+ * \brief Select the CRC update function and run it.
+ *
+ * \param crc 	CRC register value.
+ * \param buf 	Pointer to data to process.
+ * \param len 	Number of bytes to process.
+ * \return 		Updated CRC register value.
+ */
+uint32_t crc32_update_resolve(uint32_t crc, const uint8_t *buf, uint32_t len) {
+  crc32_update_init();
+  crc32_update_fn update =
+      atomic_load_explicit(&crc32_update, memory_order_acquire);
+  return update(crc, buf, len);
+}
+
 /**
  * \brief CRC calculation for TSIP packets.
  *
@@ -78,14 +349,7 @@ const uint32_t crc32_table[] = {
  * \return      Calculated CRC value.
  */
 uint32_t crc32(const uint8_t *buf, const uint32_t start, const uint32_t end) {
-  uint32_t crc = 0xFFFFFFFF;
-
-  for (uint32_t i = start; i < end; i++) {
-    const uint32_t tblindex = (crc ^ buf[i]) & 0xFF;
-    crc = (crc >> 8) ^ crc32_table[tblindex];
-  }
-
-  return (crc ^ 0xFFFFFFFF);
+  return crc32_update(CRC32_INIT, buf + start, end - start) ^ 0xFFFFFFFF;
 }
 /**
  * \brief Convert an array of bytes into an integer for CRC check